@@ -0,0 +1,129 @@
+#include "heap_file.h"
+#include "hash_file.h"
+#include "common.h"
+
+
+#define HEAP_NAME "bench_heap.db"
+#define HASH_NAME "bench_hash.db"
+#define RECORDS_NUM 100000
+#define LOOKUPS 10000
+#define BUCKETS 1024
+
+
+static const int block_sizes[] = { BF_BLOCK_SIZE, 4096, 16384, 65536 };
+
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static unsigned long disk_reads()
+{
+    BF_Stats stats;
+    BF_GetStats(&stats);
+    return stats.reads;
+}
+
+
+static int count_record(Record *rec, void *count)
+{
+    ++*(int*)count;
+    return 0;
+}
+
+
+static void load_files(Record *recs, int n, int block_size)
+{
+    remove(HEAP_NAME);
+    remove(HASH_NAME);
+    assert(HP_CreateFileEx(HEAP_NAME, ID, ROW_LAYOUT, block_size) == 0);
+    assert(HT_CreateFileEx(HASH_NAME, ID, BUCKETS, STATIC_HASH, ROW_LAYOUT, block_size) == 0);
+
+    Heap_file *heap = HP_OpenFile(HEAP_NAME);
+    Hash_file *hash = HT_OpenFile(HASH_NAME);
+    assert(heap != NULL && hash != NULL);
+    assert(HP_BulkLoad(heap, recs, n) == 0);
+    assert(HT_BulkLoad(hash, recs, n, false, NULL) == 0);
+    assert(HP_CloseFile(heap) == 0);
+    assert(HT_CloseFile(hash) == 0);
+}
+
+
+int main(int argc, char *argv[])
+{
+    int n = argc > 1 ? atoi(argv[1]) : RECORDS_NUM;
+    int frames = argc > 2 ? atoi(argv[2]) : BF_BUFFER_SIZE;
+
+    srand(0);
+    Record *recs = malloc(n * sizeof(*recs));
+    int *keys = malloc(LOOKUPS * sizeof(*keys));
+    for (int i = 0; i < n; ++i) {
+        recs[i] = random_record();
+        recs[i].id = i;
+    }
+    for (int i = 0; i < LOOKUPS; ++i)
+        keys[i] = rand() % n;
+
+    printf("%d records, %d hash buckets, %d buffer frames\n", n, BUCKETS, frames);
+    printf("%-10s %10s %12s %12s %12s %16s %16s\n", "block", "recs/block", "heap blocks",
+                                                     "scan reads", "scan (ms)",
+                                                     "reads/lookup", "lookup (us)");
+
+    HT_Init();
+    for (int b = 0; b < array_size(block_sizes); ++b) {
+        assert(BF_InitEx(LRU, frames, BF_MAX_OPEN_FILES) == BF_OK);
+        load_files(recs, n, block_sizes[b]);
+        assert(BF_Close() == BF_OK);
+
+        /* Every measurement starts from an empty buffer pool */
+        assert(BF_InitEx(LRU, frames, BF_MAX_OPEN_FILES) == BF_OK);
+        Heap_file *heap = HP_OpenFile(HEAP_NAME);
+        assert(heap != NULL);
+
+        int visited = 0;
+        unsigned long reads = disk_reads();
+        double start = now();
+        assert(!HP_ForEach(heap, ID, NULL, count_record, &visited));
+        double scan = now() - start;
+        unsigned long scan_reads = disk_reads() - reads;
+        int capacity = heap->rec_capacity, heap_blocks = heap->last_block_id;
+        assert(visited == n);
+        assert(HP_CloseFile(heap) == 0);
+        assert(BF_Close() == BF_OK);
+
+        assert(BF_InitEx(LRU, frames, BF_MAX_OPEN_FILES) == BF_OK);
+        Hash_file *hash = HT_OpenFile(HASH_NAME);
+        assert(hash != NULL);
+
+        Record rec;
+        reads = disk_reads();
+        start = now();
+        for (int i = 0; i < LOOKUPS; ++i) {
+            assert(HT_GetEntry(hash, &keys[i], &rec) == 0);
+            assert(rec.id == keys[i]);
+        }
+        double lookup = now() - start;
+        unsigned long lookup_reads = disk_reads() - reads;
+        assert(HT_CloseFile(hash) == 0);
+        assert(BF_Close() == BF_OK);
+
+        printf("%-10d %10d %12d %12lu %12.3f %16.2f %16.3f\n", block_sizes[b],
+                                                               capacity,
+                                                               heap_blocks,
+                                                               scan_reads,
+                                                               scan * 1e3,
+                                                               (double)lookup_reads / LOOKUPS,
+                                                               lookup / LOOKUPS * 1e6);
+    }
+    HT_Close();
+
+    free(recs);
+    free(keys);
+    remove(HEAP_NAME);
+    remove(HASH_NAME);
+    return 0;
+}
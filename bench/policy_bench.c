@@ -0,0 +1,99 @@
+#include "hash_file.h"
+#include "common.h"
+
+
+#define HASH_NAME "bench_hash.db"
+#define RECORDS_NUM 100000
+#define FRAMES 1000
+#define BUCKETS 1024
+#define LOOKUPS 100000
+#define SCANS 20
+#define HOT_KEYS 100
+
+
+static const ReplacementAlgorithm policies[] = { LRU, MRU, TWO_Q, ARC, CLOCK_PRO };
+static const char *policy_names[] = { "LRU", "MRU", "2Q", "ARC", "CLOCK-Pro" };
+
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+int main(int argc, char *argv[])
+{
+    int n = argc > 1 ? atoi(argv[1]) : RECORDS_NUM;
+    int frames = argc > 2 ? atoi(argv[2]) : FRAMES;
+
+    srand(0);
+    Record *recs = malloc(n * sizeof(*recs));
+    int *keys = malloc(LOOKUPS * sizeof(*keys));
+    for (int i = 0; i < n; ++i) {
+        recs[i] = random_record();
+        recs[i].id = i;
+    }
+
+    /* Nine of ten lookups go to a few hot keys, the rest anywhere in the file */
+    for (int i = 0; i < LOOKUPS; ++i)
+        keys[i] = rand() % 10 ? rand() % HOT_KEYS * (n / HOT_KEYS) : rand() % n;
+
+    HT_Init();
+    assert(BF_InitEx(LRU, frames, BF_MAX_OPEN_FILES) == BF_OK);
+    remove(HASH_NAME);
+    assert(HT_CreateFileEx(HASH_NAME, ID, BUCKETS, STATIC_HASH, ROW_LAYOUT, BF_BLOCK_SIZE) == 0);
+    Hash_file *hash = HT_OpenFile(HASH_NAME);
+    assert(hash != NULL);
+    assert(HT_BulkLoad(hash, recs, n, false, NULL) == 0);
+    assert(HT_CloseFile(hash) == 0);
+    assert(BF_Close() == BF_OK);
+
+    printf("%d records, %d lookups on %d hot keys, %d full scans, %d buffer frames\n",
+           n, LOOKUPS, HOT_KEYS, SCANS, frames);
+    printf("%-10s %14s %16s %12s %12s\n", "policy", "lookup hits", "reads/lookup",
+                                           "scan reads", "total (ms)");
+
+    for (int p = 0; p < array_size(policies); ++p) {
+        assert(BF_InitEx(policies[p], frames, BF_MAX_OPEN_FILES) == BF_OK);
+        hash = HT_OpenFile(HASH_NAME);
+        assert(hash != NULL);
+
+        Record rec;
+        BF_Stats before, after;
+        unsigned long hits = 0, reads = 0, scan_reads = 0;
+        double start = now();
+        for (int i = 0; i < LOOKUPS; ++i) {
+            /* A reporting scan runs every LOOKUPS / SCANS point lookups */
+            if (i % (LOOKUPS / SCANS) == LOOKUPS / SCANS / 2) {
+                BF_GetStats(&before);
+                GET_NUM_ENTRIES(HT_GetAllEntries(hash, CITY, recs[i % n].city, TMP_LIST));
+                BF_GetStats(&after);
+                scan_reads += after.reads - before.reads;
+            }
+
+            BF_GetStats(&before);
+            assert(HT_GetEntry(hash, &keys[i], &rec) == 0);
+            assert(rec.id == keys[i]);
+            BF_GetStats(&after);
+            hits  += after.hits - before.hits;
+            reads += after.reads - before.reads;
+        }
+        double total = now() - start;
+        assert(HT_CloseFile(hash) == 0);
+        assert(BF_Close() == BF_OK);
+
+        printf("%-10s %13.1f%% %16.3f %12lu %12.3f\n", policy_names[p],
+                                                      100.0 * hits / (hits + reads),
+                                                      (double)reads / LOOKUPS,
+                                                      scan_reads,
+                                                      total * 1e3);
+    }
+    HT_Close();
+
+    free(recs);
+    free(keys);
+    remove(HASH_NAME);
+    return 0;
+}
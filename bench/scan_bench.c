@@ -0,0 +1,165 @@
+#include "heap_file.h"
+#include "common.h"
+#include "match.h"
+
+
+#define FILENAME "bench.db"
+#define RECORDS_NUM 50000
+#define ROUNDS 20
+
+
+static const char *level_names[] = {
+    [MATCH_SCALAR] = "scalar",
+    [MATCH_SSE42]  = "sse4.2",
+    [MATCH_AVX2]   = "avx2"
+};
+
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static int count_record(Record *rec, void *count)
+{
+    ++*(int*)count;
+    return 0;
+}
+
+
+/* Lays the records out in block-sized groups, as the file stores them */
+static char *make_blocks(Record *recs, int n, int per_block, rec_layout layout)
+{
+    char *blocks = malloc((n + per_block - 1) / per_block * per_block * sizeof(Record));
+    for (int i = 0; i < n; ++i)
+        set_block_record(blocks + i / per_block * per_block * sizeof(Record), layout,
+                                                                              per_block,
+                                                                              i % per_block,
+                                                                              &recs[i]);
+    return blocks;
+}
+
+
+/* Match every block-sized group of records in memory, without block I/O */
+static double kernel_time(char *blocks, int n, int per_block, rec_layout layout,
+                                                              rec_attr attr,
+                                                              void *value,
+                                                              int *matches)
+{
+    int size = get_attr_type(attr) == STRING ? strlen(value) + 1 : get_attr_size(attr);
+    uint64_t mask[MATCH_WORDS(per_block)];
+    double start = now();
+
+    *matches = 0;
+    for (int r = 0; r < ROUNDS; ++r) {
+        for (int i = 0; i < n; i += per_block) {
+            int count = n - i < per_block ? n - i : per_block;
+            char *block = blocks + i * sizeof(Record);
+            match_records(get_block_member(block, layout, per_block, 0, attr), count,
+                                                                               get_member_stride(layout, attr),
+                                                                               0,
+                                                                               value,
+                                                                               size,
+                                                                               mask);
+            for (int j = match_next(mask, 0, count); j < count; j = match_next(mask, j + 1, count))
+                ++*matches;
+        }
+    }
+    return (now() - start) / ROUNDS;
+}
+
+
+/* Full-file scans through the heap file cursor */
+static double scan_time(Heap_file *handle, rec_attr attr, void *value, int *matches)
+{
+    double start = now();
+    for (int r = 0; r < ROUNDS; ++r) {
+        *matches = 0;
+        assert(!HP_ForEach(handle, attr, value, count_record, matches));
+    }
+    return (now() - start) / ROUNDS;
+}
+
+
+int main(int argc, char *argv[])
+{
+    int n = argc > 1 ? atoi(argv[1]) : RECORDS_NUM;
+    const match_level levels[] = { MATCH_SCALAR, MATCH_SSE42, MATCH_AVX2 };
+    const rec_layout layouts[] = { ROW_LAYOUT, PAX_LAYOUT };
+    const char *layout_names[] = { [ROW_LAYOUT] = "row", [PAX_LAYOUT] = "pax" };
+
+    srand(0);
+    Record *recs = malloc(n * sizeof(*recs));
+    for (int i = 0; i < n; ++i)
+        recs[i] = random_record();
+
+    int missing = -1;
+    char *city = recs[n / 2].city;
+    assert(BF_Init(LRU) == BF_OK);
+
+    for (int f = 0; f < array_size(layouts); ++f) {
+        remove(FILENAME);
+        assert(HP_CreateFileEx(FILENAME, ID, layouts[f], BF_BLOCK_SIZE) == 0);
+
+        Heap_file *handle = HP_OpenFile(FILENAME);
+        assert(handle != NULL);
+        assert(HP_BulkLoad(handle, recs, n) == 0);
+
+        char *blocks = make_blocks(recs, n, handle->rec_capacity, layouts[f]);
+        printf("%s layout: %d records, %d per block, %d rounds\n", layout_names[layouts[f]], 
+                                                                   n, 
+                                                                   handle->rec_capacity, 
+                                                                   ROUNDS);
+        printf("%-8s %16s %16s %16s %16s\n", "kernel", "mem id (ms)", "mem city (ms)",
+                                             "scan id (ms)", "scan city (ms)");
+
+        for (int l = 0; l < array_size(levels); ++l) {
+            if (match_select(levels[l]) != levels[l]) {
+                printf("%-8s %16s\n", level_names[levels[l]], "not supported");
+                continue;
+            }
+
+            int id_matches, city_matches, scan_matches, scan_cities;
+            double mem_id = kernel_time(blocks, n, handle->rec_capacity, layouts[f], ID, 
+                                                                                  &missing, 
+                                                                                  &id_matches);
+            double mem_city = kernel_time(blocks, n, handle->rec_capacity, layouts[f], CITY, 
+                                                                                    city, 
+                                                                                    &city_matches);
+            double scan_id = scan_time(handle, ID, &missing, &scan_matches);
+            double scan_city = scan_time(handle, CITY, city, &scan_cities);
+
+            assert(id_matches == 0 && scan_matches == 0);
+            assert(city_matches == ROUNDS * scan_cities);
+            printf("%-8s %16.3f %16.3f %16.3f %16.3f\n", level_names[levels[l]],
+                                                         mem_id * 1e3,
+                                                         mem_city * 1e3,
+                                                         scan_id * 1e3,
+                                                         scan_city * 1e3);
+        }
+        match_select(MATCH_AUTO);
+
+        /* The same full scan with the file mapped read-only, without copies into the pool */
+        int pool_all, mapped_all;
+        double pool_scan = scan_time(handle, ID, NULL, &pool_all);
+        assert(HP_CloseFile(handle) == 0);
+        handle = HP_OpenFileMapped(FILENAME);
+        assert(handle != NULL);
+        double mapped_scan = scan_time(handle, ID, NULL, &mapped_all);
+        assert(pool_all == n && mapped_all == n);
+        printf("full scan: %.3f ms through the buffer pool, %.3f ms mapped\n", pool_scan * 1e3,
+                                                                              mapped_scan * 1e3);
+
+        printf("\n");
+        free(blocks);
+        assert(HP_CloseFile(handle) == 0);
+    }
+
+    free(recs);
+    assert(BF_Close() == BF_OK);
+    remove(FILENAME);
+    return 0;
+}
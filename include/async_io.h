@@ -0,0 +1,38 @@
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define ASYNC_DEPTH 64
+#define ASYNC_THREADS 4
+
+
+typedef enum {
+	ASYNC_AUTO,
+	ASYNC_IO_URING,
+	ASYNC_THREAD_POOL
+} async_backend;
+
+typedef struct {
+	int tag;
+	ssize_t bytes;
+} Async_read;
+
+
+int async_init(async_backend backend);
+
+bool async_submit(int tag, int fd, void *buf, size_t size, off_t offset);
+
+void async_flush();
+
+int async_reap(Async_read *done, int max, bool wait);
+
+void async_wait();
+
+int async_pending();
+
+void async_close();
+
+#endif /* ASYNC_IO_H */
@@ -1,6 +1,8 @@
 #ifndef BF_H
 #define BF_H
 
+#include <stdbool.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -8,6 +10,7 @@ extern "C" {
 #define BF_BLOCK_SIZE 512      /* Το μέγεθος ενός block σε bytes */
 #define BF_BUFFER_SIZE 100     /* Ο μέγιστος αριθμός block που κρατάμε στην μνήμη */
 #define BF_MAX_OPEN_FILES 100  /* Ο μέγιστος αριθμός ανοικτών αρχείων */
+#define BF_MAX_BLOCK_SIZE 65536 /* Το μέγιστο μέγεθος block που μπορεί να έχει ένα αρχείο */
 
 typedef enum {
 	BF_OK,
@@ -18,14 +21,26 @@ typedef enum {
 	BF_FULL_MEMORY_ERROR,          /* Η μνήμη έχει γεμίσει με ενεργά block */
 	BF_INVALID_BLOCK_NUMBER_ERROR, /* Το block που ζητήθηκε δεν υπάρχει στο αρχείο */
 	BF_AVAILABLE_PIN_BLOCKS_ERROR, /* Το αρχειο δεν μπορεί να κλείσει επειδή υπάρχουν ενεργά Block στην μνήμη */
-	BF_ERROR
+	BF_ERROR,
+	BF_INVALID_BLOCK_SIZE_ERROR,   /* Το μέγεθος block δεν είναι δύναμη του 2 μεταξύ BF_BLOCK_SIZE και BF_MAX_BLOCK_SIZE */
+	BF_READ_ONLY_ERROR             /* Το αρχείο άνοιξε μόνο για ανάγνωση */
 } BF_ErrorCode;
 
 typedef enum {
 	LRU,
-	MRU
+	MRU,
+	TWO_Q,     /* Τα block μπαίνουν σε ουρά δοκιμής και κρατιούνται μόνο όταν ξαναζητηθούν */
+	ARC,       /* Προσαρμόζει το μέρος της μνήμης για πρόσφατα και για συχνά ζητούμενα block */
+	CLOCK_PRO  /* Ρολόι με ζεστά και κρύα block που προσαρμόζει το πλήθος των κρύων */
 } ReplacementAlgorithm;
 
+typedef struct {
+	unsigned long hits;   /* Αιτήματα για block που βρέθηκαν ήδη στην μνήμη */
+	unsigned long reads;  /* Block που διαβάστηκαν από τον δίσκο */
+	unsigned long writes; /* Block που γράφτηκαν στον δίσκο */
+	unsigned long prefetches; /* Block που διαβάστηκαν από τον δίσκο πριν ζητηθούν, με την BF_Prefetch */
+} BF_Stats;
+
 
 // Δομή Block
 typedef struct BF_Block BF_Block;
@@ -58,13 +73,31 @@ void BF_Block_SetDirty(BF_Block *block);
  */
 char* BF_Block_GetData(const BF_Block *block);
 
+/*
+ * Η συνάρτηση BF_Block_GetNum επιστρέφει τον αριθμό του block μέσα στο αρχείο
+ * του. Μετά από την BF_AllocateBlock δίνει τον αριθμό του νέου block, ακόμα
+ * και αν άλλα νήματα έχουν δεσμεύσει block στο ίδιο αρχείο στο μεταξύ.
+ */
+int BF_Block_GetNum(const BF_Block *block);
+
 /*
  * Με τη συνάρτηση BF_Init πραγματοποιείται η αρχικοποίηση του επιπέδου BF.
  * Μπορούμε να επιλέξουμε ανάμεσα σε δύο πολιτικές αντικατάστασις Block
- * εκείνης της LRU και εκείνης της MRU.
+ * εκείνης της LRU και εκείνης της MRU. Οι TWO_Q, ARC και CLOCK_PRO θυμούνται
+ * και block που έφυγαν πρόσφατα από την μνήμη, ώστε μια σάρωση ολόκληρου
+ * αρχείου να μην διώχνει τα block που ζητούνται συχνά.
  */
 BF_ErrorCode BF_Init(const ReplacementAlgorithm repl_alg);
 
+/*
+ * Η συνάρτηση BF_InitEx αρχικοποιεί το επίπεδο BF όπως η BF_Init, με
+ * frames θέσεις block στην μνήμη αντί για BF_BUFFER_SIZE και έως max_files
+ * ανοιχτά αρχεία αντί για BF_MAX_OPEN_FILES. Κάθε θέση δεσμεύει μνήμη ίση
+ * με το μέγεθος block του αρχείου που τη χρησιμοποιεί, την πρώτη φορά που
+ * χρειάζεται.
+ */
+BF_ErrorCode BF_InitEx(const ReplacementAlgorithm repl_alg, int frames, int max_files);
+
 /*
  * Η συνάρτηση BF_CreateFile δημιουργεί ένα αρχείο με όνομα filename το
  * οποίο αποτελείται από blocks. Αν το αρχείο υπάρχει ήδη τότε επιστρέφεται
@@ -74,6 +107,14 @@ BF_ErrorCode BF_Init(const ReplacementAlgorithm repl_alg);
  */
 BF_ErrorCode BF_CreateFile(const char* filename);
 
+/*
+ * Η συνάρτηση BF_CreateFileEx δημιουργεί ένα αρχείο όπως η BF_CreateFile,
+ * με block μεγέθους block_size bytes αντί για BF_BLOCK_SIZE. Το μέγεθος
+ * πρέπει να είναι δύναμη του 2 μεταξύ BF_BLOCK_SIZE και BF_MAX_BLOCK_SIZE
+ * και αποθηκεύεται στο αρχείο, ώστε να ισχύει κάθε φορά που ανοίγει.
+ */
+BF_ErrorCode BF_CreateFileEx(const char* filename, int block_size);
+
 /*
  * Η συνάρτηση BF_OpenFile ανοίγει ένα υπάρχον αρχείο από blocks με όνομα
  * filename και επιστρέφει το αναγνωριστικό του αρχείου στην μεταβλητή
@@ -83,11 +124,23 @@ BF_ErrorCode BF_CreateFile(const char* filename);
  */
 BF_ErrorCode BF_OpenFile(const char* filename, int *file_desc);
 
+/*
+ * Η συνάρτηση BF_OpenFileMapped ανοίγει ένα υπάρχον αρχείο όπως η BF_OpenFile,
+ * μόνο για ανάγνωση. Το αρχείο απεικονίζεται στην μνήμη (mmap) και η
+ * BF_Block_GetData επιστρέφει δείκτη κατευθείαν στην απεικόνιση, χωρίς να
+ * αντιγράφεται το block σε θέση της μνήμης του επιπέδου BF. Τα δεδομένα
+ * των block δεν πρέπει να αλλάζουν και η BF_AllocateBlock επιστρέφει
+ * BF_READ_ONLY_ERROR.
+ */
+BF_ErrorCode BF_OpenFileMapped(const char* filename, int *file_desc);
+
 /*
  * Η συνάρτηση BF_CloseFile κλείνει το ανοιχτό αρχείο με αναγνωριστικό αριθμό
  * file_desc. Σε περίπτωση επιτυχίας επιστρέφεται BF_OK ενώ σε περίπτωση
  * αποτυχίας, επιστρέφεται ένας κωδικός λάθους. Αν θέλετε να δείτε το
  * είδος του λάθους μπορείτε να καλέσετε τη συνάρτηση BF_PrintError.
+ * Αν κάποιο block του αρχείου δεν έχει γίνει unpin, το αρχείο δεν κλείνει
+ * και επιστρέφεται BF_AVAILABLE_PIN_BLOCKS_ERROR.
  */
 BF_ErrorCode BF_CloseFile(const int file_desc);
 
@@ -101,6 +154,14 @@ BF_ErrorCode BF_CloseFile(const int file_desc);
  */
 BF_ErrorCode BF_GetBlockCounter(const int file_desc, int *blocks_num);
 
+/*
+ * Η συνάρτηση BF_GetBlockSize επιστρέφει στην μεταβλητή block_size το
+ * μέγεθος σε bytes των block του ανοιχτού αρχείου file_desc. Σε περίπτωση
+ * επιτυχίας επιστρέφεται BF_OK ενώ σε περίπτωση αποτυχίας, επιστρέφεται
+ * ένας κωδικός λάθους.
+ */
+BF_ErrorCode BF_GetBlockSize(const int file_desc, int *block_size);
+
 /*
  * Με τη συνάρτηση BF_AllocateBlock δεσμεύεται ένα καινούριο block για το
  * αρχείο με αναγνωριστικό αριθμό blockFile. Το νέο block δεσμεύεται πάντα
@@ -129,6 +190,18 @@ BF_ErrorCode BF_GetBlock(const int file_desc,
                          const int block_num,
                          BF_Block *block);
 
+/*
+ * Η συνάρτηση BF_Prefetch ξεκινά την ανάγνωση των n block με αριθμούς
+ * block_nums του αρχείου file_desc, χωρίς να περιμένει να τελειώσει
+ * (με io_uring, ή με νήματα όπου το io_uring δεν υπάρχει). Μια επόμενη
+ * BF_GetBlock για αυτά τα block περιμένει μόνο όσο χρειάζεται για να
+ * ολοκληρωθεί η ανάγνωση. Block που είναι ήδη στην μνήμη παραλείπονται, και
+ * αν δεν υπάρχουν ελεύθερες θέσεις η συνάρτηση επιστρέφει χωρίς να τα
+ * διαβάσει όλα. Σε περίπτωση επιτυχίας επιστρέφεται BF_OK ενώ σε περίπτωση
+ * αποτυχίας, επιστρέφεται ένας κωδικός λάθους.
+ */
+BF_ErrorCode BF_Prefetch(const int file_desc, const int *block_nums, const int n);
+
 /*
  * Η συνάρτηση BF_UnpinBlock αποδεσμεύει το block από το επίπεδο Block το
  * οποίο κάποια στηγμή θα το γράψει στο δίσκο. Σε περίπτωση επιτυχίας
@@ -145,9 +218,29 @@ BF_ErrorCode BF_UnpinBlock(BF_Block *block);
  */
 void BF_PrintError(BF_ErrorCode err);
 
+/*
+ * Η συνάρτηση BF_GetStats επιστρέφει στην μεταβλητή stats πόσα block
+ * βρέθηκαν στην μνήμη, διαβάστηκαν και γράφτηκαν στον δίσκο από την
+ * κλήση της BF_Init.
+ */
+void BF_GetStats(BF_Stats *stats);
+
+/*
+ * Η συνάρτηση BF_AdviseSequential ενημερώνει το λειτουργικό ότι τα block
+ * του αρχείου file_desc θα διαβαστούν στη σειρά (sequential = true), όπως
+ * σε μια σάρωση ολόκληρου του αρχείου, ή ότι η σάρωση τελείωσε
+ * (sequential = false). Οι κλήσεις μετριούνται ανά αρχείο, ώστε η σύσταση
+ * να ισχύει μέχρι να τελειώσει και η τελευταία από σαρώσεις που
+ * επικαλύπτονται. Σε περίπτωση επιτυχίας επιστρέφεται BF_OK ενώ σε
+ * περίπτωση αποτυχίας, επιστρέφεται ένας κωδικός λάθους.
+ */
+BF_ErrorCode BF_AdviseSequential(const int file_desc, const bool sequential);
+
 /*
  * Η συνάρτηση BF_Close κλήνει το επίπεδο Block γράφοντας στον δίσκο όποια
- * block είχε στην μνήμη.
+ * block είχε στην μνήμη. Τα ανοιχτά αρχεία κλείνουν ακόμα και αν έχουν
+ * block που δεν έχουν γίνει unpin, οπότε επιστρέφεται
+ * BF_AVAILABLE_PIN_BLOCKS_ERROR.
  */
 BF_ErrorCode BF_Close();
 
@@ -0,0 +1,21 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define BLOOM_HASHES 3
+#define BLOOM_BUCKET_SIZE 16
+#define BLOOM_BLOCKS(size, block_size) (((size) - 1) / (block_size) + 1)
+
+
+void bloom_add(unsigned char *filter, size_t size, size_t hash);
+
+bool bloom_test(const unsigned char *filter, size_t size, size_t hash);
+
+int bloom_load(int fd, int first_block, unsigned char *filter, size_t size);
+
+int bloom_store(int fd, int *first_block, int *blocks, const unsigned char *filter, 
+                                                       size_t size);
+
+#endif /* BLOOM_H */
@@ -0,0 +1,43 @@
+#ifndef BPLUS_FILE_H
+#define BPLUS_FILE_H
+
+#include "common.h"
+#include "dl_list.h"
+#include "record.h"
+
+typedef struct {
+    char file_type[5];
+    int file_desc;
+    int root;
+    int height;
+    int rec_capacity;
+    int key_capacity;
+    int rec_count;
+    rec_attr attr;
+} BPlus_file;
+
+
+int BPT_CreateFile(const char *filename, rec_attr attr);
+
+BPlus_file *BPT_OpenFile(const char *filename);
+
+int BPT_CloseFile(BPlus_file *handle);
+
+int BPT_InsertEntry(BPlus_file *handle, Record rec);
+
+int BPT_DeleteEntry(BPlus_file *handle, void *value);
+
+int BPT_GetEntry(BPlus_file *handle, void *value, Record *rec);
+
+int BPT_GetRange(BPlus_file *handle, void *low, void *high, Dl_list records);
+
+int BPT_PrintFile(BPlus_file *handle, FILE *stream);
+
+
+typedef struct {
+    int key_num;
+    int next;
+} BPlus_block;
+
+
+#endif /* BPLUS_FILE_H */
@@ -5,11 +5,16 @@
 #include "hash_map.h"
 #include "dl_list.h"
 #include "record.h"
+#include "match.h"
+#include "bloom.h"
+#include <pthread.h>
 
 #define MAX_FILENAME 50
+#define HT_LATCHES 64
 
 
 extern Hash_map file_map;
+extern pthread_mutex_t file_map_lock;
 
 
 typedef struct {
@@ -17,27 +22,76 @@ typedef struct {
     rec_attr attr;
 } Index_info;
 
+typedef enum {
+    STATIC_HASH,
+    EXTENDIBLE_HASH,
+    LINEAR_HASH
+} hash_mode;
+
 typedef struct {
     char file_type[5];
     char filename[MAX_FILENAME + 1];
     int file_desc;
+    int block_size;
     int rec_capacity;
     int rec_count;
     int buckets;
     int last_block_id;
+    int dir_block;
+    int bloom_block;
+    int bloom_blocks;
+    int global_depth;
+    hash_mode mode;
     rec_attr attr;
+    rec_layout layout;
     Index_info index_files[INDEX_ATTR];
     int *hash_table;
+    unsigned char *bloom;
+    bool read_only;
+    pthread_rwlock_t latch;
+    pthread_rwlock_t bucket_latches[HT_LATCHES];
 } Hash_file;
 
+/* The latches a cursor holds, listed per thread while it is open */
+typedef struct Cursor_latch {
+    Hash_file *handle;
+    int *latch;
+    struct Cursor_latch *next;
+} Cursor_latch;
+
+typedef struct {
+    Hash_file *handle;
+    BF_Block *block;
+    bool pinned;
+    bool all;
+    bool sequential;
+    rec_attr attr;
+    char value[sizeof(Record)];
+    int size;
+    uint64_t *mask;
+    int bucket;
+    int block_id;
+    int latch;
+    Cursor_latch held;
+    int pos;
+    Record rec;
+} HT_Scan;
+
 void HT_Init();
 
 void HT_Close();
 
 int HT_CreateFile(const char *filename, rec_attr attr, int buckets);
 
+int HT_CreateFileEx(const char *filename, rec_attr attr, int buckets, 
+                                                         hash_mode mode, 
+                                                         rec_layout layout,
+                                                         int block_size);
+
 Hash_file *HT_OpenFile(const char *filename);
 
+Hash_file *HT_OpenFileMapped(const char *filename);
+
 int HT_CloseFile(Hash_file *handle);
 
 int HT_InsertEntry(Hash_file* info, Record record, int *block_id);
@@ -50,12 +104,49 @@ int HT_PrintFile(Hash_file *handle, FILE *stream);
 
 int HT_GetEntry(Hash_file *handle, void *value, Record *rec);
 
-size_t hash_key(attr_type type, const void *key);
+int HT_Resize(Hash_file *handle, int new_buckets);
+
+/* block_ids[i] is the block holding the record with the key of recs[i], 
+ * which for a dropped duplicate is the block of the record already stored */
+int HT_BulkLoad(Hash_file *handle, Record *recs, int n, bool dedupe, int *block_ids);
+
+int HT_InsertBatch(Hash_file *handle, Record *recs, int n, int *block_ids);
+
+int HT_RangeScan(Hash_file *handle, rec_attr attr, void *low, 
+                                                   void *high, 
+                                                   Record_visit visit, 
+                                                   void *arg);
+
+/* A cursor holds the file latch shared, and the latch of its bucket, until it is 
+ * closed. Writes of the same thread that need either exclusively return -1 
+ * meanwhile, instead of waiting on the cursor forever */
+HT_Scan *HT_Scan_Open(Hash_file *handle, rec_attr attr, void *value);
+
+int HT_Scan_Next(HT_Scan *scan, Record **rec);
+
+int HT_Scan_Close(HT_Scan *scan);
+
+/* visit runs inside a cursor, so its writes to the file follow HT_Scan_Open */
+int HT_ForEach(Hash_file *handle, rec_attr attr, void *value, 
+                                                 Record_visit visit, 
+                                                 void *arg);
+
+bool HT_BucketHead(Hash_file *handle, int bucket);
+
+void HT_LatchCursor(Hash_file *handle, Cursor_latch *cursor);
+
+void HT_UnlatchCursor(Cursor_latch *cursor);
+
+int HT_AddIndex(Hash_file *handle, rec_attr attr, const char *sfilename);
 
 
 typedef struct {
     int rec_num;
     int overf_block;
+    int local_depth;
 } Hash_block;
 
+#define HT_FINGERPRINTS(data) ((unsigned char*)(data) + sizeof(Hash_block))
+#define HT_RECORDS(handle, data) ((char*)(data) + sizeof(Hash_block) + (handle)->rec_capacity)
+
 #endif /* HASH_FILE_H */
\ No newline at end of file
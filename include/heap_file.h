@@ -3,26 +3,61 @@
 
 #include "common.h"
 #include "dl_list.h"
+#include "hash_map.h"
 #include "record.h"
+#include "match.h"
+#include "bloom.h"
 
 typedef struct {
     char file_type[5];
     int file_desc;
     int last_block_id;
+    int block_size;
     int rec_capacity;
     int rec_count;
     rec_attr attr;
+    rec_layout layout;
+    int bloom_size;
+    int bloom_keys;
+    unsigned char *free_map;
+    unsigned char *bloom;
+    Hash_map key_index;
+    bool read_only;
 } Heap_file;
 
+typedef struct {
+    Heap_file *handle;
+    BF_Block *block;
+    bool pinned;
+    bool all;
+    bool sequential;
+    rec_attr attr;
+    char value[sizeof(Record)];
+    int size;
+    uint64_t *mask;
+    int block_id;
+    int last_block;
+    int pos;
+    Record rec;
+} HP_Scan;
+
 
 int HP_CreateFile(const char *filename, rec_attr attr);
 
+int HP_CreateFileEx(const char *filename, rec_attr attr, rec_layout layout, int block_size);
+
 Heap_file *HP_OpenFile(const char *filename);
 
+Heap_file *HP_OpenFileEx(const char *filename, bool key_index);
+
+Heap_file *HP_OpenFileMapped(const char *filename);
+
 int HP_CloseFile(Heap_file *handle);
 
 int HP_InsertEntry(Heap_file *handle, Record rec);
 
+int HP_BulkLoad(Heap_file *handle, Record *recs, int n);
+
 int HP_DeleteEntry(Heap_file *handle, void *value);
 
 int HP_GetAllEntries(Heap_file *handle, rec_attr attr, void *value, Dl_list records);
@@ -31,4 +66,14 @@ int HP_GetEntry(Heap_file *handle, void *value, Record *rec);
 
 int HP_PrintFile(Heap_file *handle, FILE *stream);
 
+HP_Scan *HP_Scan_Open(Heap_file *handle, rec_attr attr, void *value);
+
+int HP_Scan_Next(HP_Scan *scan, Record **rec);
+
+int HP_Scan_Close(HP_Scan *scan);
+
+int HP_ForEach(Heap_file *handle, rec_attr attr, void *value, 
+                                                 Record_visit visit, 
+                                                 void *arg);
+
 #endif /* HEAP_FILE_H */
@@ -0,0 +1,29 @@
+#ifndef MATCH_H
+#define MATCH_H
+
+#include <stdint.h>
+
+#define MATCH_MAX_SIZE 64
+#define MATCH_WORDS(count) (((count) + 63) / 64)
+
+typedef enum {
+	MATCH_AUTO,
+	MATCH_SCALAR,
+	MATCH_SSE42,
+	MATCH_AVX2
+} match_level;
+
+
+match_level match_select(match_level level);
+
+void match_records(const char *data, int count, int stride,
+                                                int offset,
+                                                const void *value,
+                                                int size,
+                                                uint64_t *mask);
+
+void match_bytes(const unsigned char *bytes, int count, unsigned char byte, uint64_t *mask);
+
+int match_next(const uint64_t *mask, int pos, int count);
+
+#endif /* MATCH_H */
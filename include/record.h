@@ -1,6 +1,8 @@
 #ifndef RECORD_H
 #define RECORD_H
 
+#include <stddef.h>
+
 #define INDEX_ATTR 3
 
 
@@ -38,6 +40,13 @@ typedef enum {
 	STRING
 } attr_type;
 
+typedef enum {
+	ROW_LAYOUT,
+	PAX_LAYOUT
+} rec_layout;
+
+typedef int (*Record_visit)(Record *rec, void *arg);
+
 
 
 Record random_record(void);
@@ -46,12 +55,33 @@ SRecord create_srecord(void *value, int block_id, rec_attr attr);
 
 void print_record(Record *rec);
 
+int list_record(Record *rec, void *records);
+
 int get_attr_offset(rec_attr attr);
 
 int get_attr_size(rec_attr attr);
 
+int get_value_size(rec_attr attr, const void *value);
+
 attr_type get_attr_type(rec_attr attr);
 
 void *get_rec_member(Record *rec, rec_attr attr);
 
+int compare_keys(const void *a, const void *b, rec_attr attr);
+
+size_t hash_key(attr_type type, const void *key);
+
+unsigned char key_fingerprint(attr_type type, const void *key);
+
+void *get_block_member(char *data, rec_layout layout, int capacity, int pos, rec_attr attr);
+
+int get_member_stride(rec_layout layout, rec_attr attr);
+
+void get_block_record(char *data, rec_layout layout, int capacity, int pos, Record *rec);
+
+void set_block_record(char *data, rec_layout layout, int capacity, int pos, Record *rec);
+
+void remove_block_record(char *data, rec_layout layout, int capacity, int pos, 
+                                                                      int rec_num);
+
 #endif /* RECORD_H */
@@ -9,19 +9,54 @@ typedef struct {
     char filename[MAX_FILENAME + 1];
     char index_filename[MAX_FILENAME + 1];
     int file_desc;
+    int block_size;
     int rec_capacity;
     int rec_count;
     int buckets;
     int last_block_id;
+    int dir_block;
+    int bloom_block;
+    int bloom_blocks;
+    int init_buckets;
+    int level;
+    int next;
+    hash_mode mode;
     rec_attr attr;
     int *hash_table;
+    unsigned char *bloom;
+    pthread_rwlock_t latch;
 } SHash_file;
 
+typedef struct {
+    SHash_file *handle;
+    Hash_file *ht_handle;
+    bool close_ht;
+    Cursor_latch held;
+    BF_Block *block;
+    bool pinned;
+    char value[sizeof(Record)];
+    int size;
+    unsigned char fingerprint;
+    uint64_t *mask;
+    int *block_ids;
+    int blocks_num;
+    int next;
+    int block_id;
+    int pos;
+    Record rec;
+} SHT_Scan;
+
 
 int SHT_CreateFile(const char *sfilename, rec_attr attr, 
                                           const char *filename,
                                           int buckets);
 
+int SHT_CreateFileEx(const char *sfilename, rec_attr attr, 
+                                            const char *filename,
+                                            int buckets,
+                                            hash_mode mode,
+                                            int block_size);
+
 SHash_file *SHT_OpenFile(const char *sfilename);
 
 int SHT_CloseFile(SHash_file *handle);
@@ -32,11 +67,28 @@ int SHT_DeleteEntry(SHash_file *handle, void *value, int block_id);
 
 int SHT_GetEntries(SHash_file *handle, void *value, Dl_list records);
 
+SHT_Scan *SHT_Scan_Open(SHash_file *handle, void *value);
+
+int SHT_Scan_Next(SHT_Scan *scan, Record **rec);
+
+int SHT_Scan_Close(SHT_Scan *scan);
+
+int SHT_ForEach(SHash_file *handle, void *value, Record_visit visit, void *arg);
+
+int SHT_InsertBatch(SHash_file *handle, Record *recs, int n, int *block_ids);
+
+int SHT_DeleteBatch(SHash_file *handle, Record *recs, int n, int *block_ids);
+
+int SHT_Build(const char *sfilename, rec_attr attr, const char *filename);
+
 
 typedef struct {
     int rec_num;
     int overf_block;
 } SHash_block;
 
+#define SHT_FINGERPRINTS(data) ((unsigned char*)(data) + sizeof(SHash_block))
+#define SHT_RECORDS(handle, data) ((char*)(data) + sizeof(SHash_block) + (handle)->rec_capacity)
+
 
 #endif /* SHASH_FILE_H */
@@ -0,0 +1,613 @@
+#include "bplus_file.h"
+
+#define RECORDS_CAPACITY (BF_BLOCK_SIZE - sizeof(BPlus_block)) / sizeof(Record)
+#define PAIR_SIZE(handle) (get_attr_size((handle)->attr) + sizeof(int))
+#define MAX_HEIGHT 32
+
+
+static int BPT_FindLeaf(BPlus_file *handle, void *value, int *path);
+static int BPT_InsertParent(BPlus_file *handle, int *path, int level,
+                                                           int left,
+                                                           void *key,
+                                                           int right);
+static int BPT_NewBlock(BPlus_file *handle, BF_Block *block, int *block_id);
+static int leaf_search(BPlus_file *handle, char *data, int rec_num, void *value,
+                                                                    bool *found);
+static int node_search(BPlus_file *handle, char *data, int key_num, void *value);
+static void *node_key(BPlus_file *handle, char *data, int i);
+static int node_child(BPlus_file *handle, char *data, int i);
+
+
+int BPT_CreateFile(const char *filename, rec_attr attr) 
+{
+	int fd;
+	CALL_BF(BF_CreateFile(filename), error);
+	CALL_BF(BF_OpenFile(filename, &fd), delete_file);
+
+	BF_Block *block;
+	BF_Block_Init(&block);
+
+	CALL_BF(BF_AllocateBlock(fd, block), bf_cleanup);
+
+	BPlus_file handle = {
+		.root         = 1,
+		.height       = 1,
+		.rec_capacity = RECORDS_CAPACITY,
+		.key_capacity = (BF_BLOCK_SIZE - sizeof(BPlus_block) - sizeof(int))
+		              / (get_attr_size(attr) + sizeof(int)),
+		.attr         = attr,
+		.file_type    = "bpt"
+	};
+
+	COPY(
+		&handle,
+		BF_Block_GetData(block),
+		sizeof(handle),
+		BF_BLOCK_SIZE
+	);
+
+	BF_Block_SetDirty(block);
+	CALL_BF(BF_UnpinBlock(block), bf_cleanup);
+
+	/* The root starts out as a single empty leaf */
+	BPlus_block root = { .key_num = 0, .next = -1 };
+	CALL_BF(BF_AllocateBlock(fd, block), bf_cleanup);
+	COPY(
+		&root,
+		BF_Block_GetData(block),
+		sizeof(root),
+		BF_BLOCK_SIZE
+	);
+
+	BF_Block_SetDirty(block);
+	CALL_BF(BF_UnpinBlock(block), bf_cleanup);
+	BF_Block_Destroy(&block);
+
+	CALL_BF(BF_CloseFile(fd), error);
+	return 0;
+
+	bf_cleanup:
+		BF_Block_Destroy(&block);
+		CALL_BF(BF_CloseFile(fd), delete_file);
+
+	delete_file:
+		if (remove(filename) == -1)
+			fprintf(stderr, "%s\n", strerror(errno));
+	error:
+		return -1;
+}
+
+BPlus_file *BPT_OpenFile(const char *filename) 
+{
+	int fd;
+	CALL_BF(BF_OpenFile(filename, &fd), error);
+
+	BF_Block *block;
+	BF_Block_Init(&block);
+
+	CALL_BF(BF_GetBlock(fd, 0, block), bf_cleanup);
+	char *data = BF_Block_GetData(block);
+
+	if (strncmp(data, "bpt", strlen("bpt") + 1)) {
+		fprintf(stderr,
+			"Error! "
+			"No proper B+ tree file was given\n"
+		);
+		CALL_BF(BF_UnpinBlock(block), bf_cleanup);
+		goto bf_cleanup;
+	}
+
+	BPlus_file *handle = malloc(sizeof(*handle));
+	memcpy(handle, data, sizeof(*handle));
+	handle->file_desc = fd;
+
+	CALL_BF(BF_UnpinBlock(block), bf_cleanup);
+	BF_Block_Destroy(&block);
+	return handle;
+
+	bf_cleanup:
+		BF_Block_Destroy(&block);
+		CALL_BF(BF_CloseFile(fd), error);
+
+	error:
+		return NULL;
+}
+
+int BPT_CloseFile(BPlus_file *handle) 
+{
+	BF_Block *block;
+	BF_Block_Init(&block);
+
+	CALL_BF(BF_GetBlock(handle->file_desc, 0, block), bf_cleanup);
+	memcpy(BF_Block_GetData(block), handle, sizeof(*handle));
+
+	BF_Block_SetDirty(block);
+	CALL_BF(BF_UnpinBlock(block), bf_cleanup);
+	BF_Block_Destroy(&block);
+
+	CALL_BF(BF_CloseFile(handle->file_desc), error);
+	free(handle);
+	return 0;
+
+
+	bf_cleanup:
+		BF_Block_Destroy(&block);
+		CALL_BF(BF_CloseFile(handle->file_desc), error);
+
+	error:
+		free(handle);
+		return -1;
+}
+
+
+
+int BPT_InsertEntry(BPlus_file *handle, Record rec) 
+{
+	int path[MAX_HEIGHT], right;
+	bool found;
+	BPlus_block block_data;
+	BF_Block *block;
+	void *value = get_rec_member(&rec, handle->attr);
+
+	int leaf = BPT_FindLeaf(handle, value, path);
+	if (leaf < 0)
+		return -1;
+
+	BF_Block_Init(&block);
+	CALL_BF(BF_GetBlock(handle->file_desc, leaf, block), error);
+	char *data = BF_Block_GetData(block);
+	memcpy(&block_data, data, sizeof(BPlus_block));
+
+	int pos = leaf_search(handle, data, block_data.key_num, value, &found);
+	if (found) {
+		CALL_BF(BF_UnpinBlock(block), error);
+		BF_Block_Destroy(&block);
+		return 0;
+	}
+
+	/* The records of a full leaf plus the new one are split in two halves */
+	char buffer[BF_BLOCK_SIZE + sizeof(Record)];
+	char *recs = data + sizeof(BPlus_block);
+	memcpy(buffer, recs, pos * sizeof(Record));
+	memcpy(buffer + pos * sizeof(Record), &rec, sizeof(Record));
+	memcpy(
+		buffer + (pos + 1) * sizeof(Record),
+		recs + pos * sizeof(Record),
+		(block_data.key_num - pos) * sizeof(Record)
+	);
+
+	int rec_num = block_data.key_num + 1;
+	handle->rec_count++;
+
+	if (rec_num <= handle->rec_capacity) {
+		block_data.key_num = rec_num;
+		memcpy(data, &block_data, sizeof(BPlus_block));
+		memcpy(recs, buffer, rec_num * sizeof(Record));
+		BF_Block_SetDirty(block);
+		CALL_BF(BF_UnpinBlock(block), error);
+		BF_Block_Destroy(&block);
+		return 0;
+	}
+
+	int left_num = rec_num / 2;
+	BPlus_block right_data = {
+		.key_num = rec_num - left_num,
+		.next = block_data.next
+	};
+
+	BF_Block *right_block;
+	BF_Block_Init(&right_block);
+	if (BPT_NewBlock(handle, right_block, &right) < 0) {
+		BF_Block_Destroy(&right_block);
+		goto unpin;
+	}
+
+	char *right_ptr = BF_Block_GetData(right_block);
+	memcpy(right_ptr, &right_data, sizeof(BPlus_block));
+	memcpy(
+		right_ptr + sizeof(BPlus_block),
+		buffer + left_num * sizeof(Record),
+		right_data.key_num * sizeof(Record)
+	);
+
+	block_data.key_num = left_num;
+	block_data.next = right;
+	memcpy(data, &block_data, sizeof(BPlus_block));
+	memcpy(recs, buffer, left_num * sizeof(Record));
+
+	/* The first key of the right leaf separates the two leaves */
+	char key[BF_BLOCK_SIZE];
+	memcpy(
+		key,
+		right_ptr + sizeof(BPlus_block) + get_attr_offset(handle->attr),
+		get_attr_size(handle->attr)
+	);
+
+	BF_Block_SetDirty(right_block);
+	BF_Block_SetDirty(block);
+	CALL_BF(BF_UnpinBlock(right_block), error);
+	BF_Block_Destroy(&right_block);
+	CALL_BF(BF_UnpinBlock(block), error);
+	BF_Block_Destroy(&block);
+
+	return BPT_InsertParent(handle, path, handle->height - 1, leaf, key, right);
+
+	unpin:
+		BF_UnpinBlock(block);
+	error:
+		BF_Block_Destroy(&block);
+		return -1;
+}
+
+int BPT_DeleteEntry(BPlus_file *handle, void *value) 
+{
+	int path[MAX_HEIGHT];
+	bool found;
+	BPlus_block block_data;
+	BF_Block *block;
+
+	int leaf = BPT_FindLeaf(handle, value, path);
+	if (leaf < 0)
+		return -1;
+
+	BF_Block_Init(&block);
+	CALL_BF(BF_GetBlock(handle->file_desc, leaf, block), error);
+	char *data = BF_Block_GetData(block);
+	memcpy(&block_data, data, sizeof(BPlus_block));
+
+	/* Leaves are not merged, later inserts in their key range reuse the space */
+	int pos = leaf_search(handle, data, block_data.key_num, value, &found);
+	if (found) {
+		char *recs = data + sizeof(BPlus_block);
+		memmove(
+			recs + pos * sizeof(Record),
+			recs + (pos + 1) * sizeof(Record),
+			(block_data.key_num - pos - 1) * sizeof(Record)
+		);
+		block_data.key_num--;
+		memcpy(data, &block_data, sizeof(BPlus_block));
+
+		BF_Block_SetDirty(block);
+		handle->rec_count--;
+	}
+	CALL_BF(BF_UnpinBlock(block), error);
+	BF_Block_Destroy(&block);
+	return 0;
+
+	error:
+		BF_Block_Destroy(&block);
+		return -1;
+}
+
+
+
+int BPT_GetEntry(BPlus_file *handle, void *value, Record *rec) 
+{
+	int path[MAX_HEIGHT];
+	bool found;
+	BPlus_block block_data;
+	BF_Block *block;
+
+	rec->id = -1;
+	int leaf = BPT_FindLeaf(handle, value, path);
+	if (leaf < 0)
+		return -1;
+
+	BF_Block_Init(&block);
+	CALL_BF(BF_GetBlock(handle->file_desc, leaf, block), error);
+	char *data = BF_Block_GetData(block);
+	memcpy(&block_data, data, sizeof(BPlus_block));
+
+	int pos = leaf_search(handle, data, block_data.key_num, value, &found);
+	if (found)
+		memcpy(
+			rec,
+			data + sizeof(BPlus_block) + pos * sizeof(Record),
+			sizeof(Record)
+		);
+
+	CALL_BF(BF_UnpinBlock(block), error);
+	BF_Block_Destroy(&block);
+	return 0;
+
+	error:
+		BF_Block_Destroy(&block);
+		return -1;
+}
+
+int BPT_GetRange(BPlus_file *handle, void *low, void *high, Dl_list records) 
+{
+	int path[MAX_HEIGHT];
+	bool found;
+	BPlus_block block_data;
+	BF_Block *block;
+
+	int block_t = BPT_FindLeaf(handle, low, path);
+	if (block_t < 0)
+		return -1;
+
+	BF_Block_Init(&block);
+	for (bool first = true; block_t != -1; first = false) {
+		CALL_BF(BF_GetBlock(handle->file_desc, block_t, block), error);
+		char *data = BF_Block_GetData(block);
+		memcpy(&block_data, data, sizeof(BPlus_block));
+
+		int pos = first && low != NULL
+			? leaf_search(handle, data, block_data.key_num, low, &found)
+			: 0;
+
+		data += sizeof(BPlus_block) + pos * sizeof(Record);
+		for (int j = pos; j < block_data.key_num; j++, data += sizeof(Record)) {
+			if (high != NULL && compare_keys(
+				data + get_attr_offset(handle->attr), high, handle->attr) > 0) {
+				block_data.next = -1;
+				break;
+			}
+			Record *rec = malloc(sizeof(*rec));
+			list_insert(records, memcpy(rec, data, sizeof(*rec)));
+		}
+		block_t = block_data.next;
+		CALL_BF(BF_UnpinBlock(block), error);
+	}
+	BF_Block_Destroy(&block);
+	return 0;
+
+	error:
+		BF_Block_Destroy(&block);
+		return -1;
+}
+
+
+
+int BPT_PrintFile(BPlus_file *handle, FILE *stream) 
+{
+	int path[MAX_HEIGHT];
+	BPlus_block block_data;
+	BF_Block *block;
+
+	int block_t = BPT_FindLeaf(handle, NULL, path);
+	if (block_t < 0)
+		return -1;
+
+	BF_Block_Init(&block);
+	while (block_t != -1) {
+		CALL_BF(BF_GetBlock(handle->file_desc, block_t, block), error);
+		char *data = BF_Block_GetData(block);
+		memcpy(&block_data, data, sizeof(BPlus_block));
+		data += sizeof(BPlus_block);
+
+		if (block_data.key_num > 0)
+			fprintf(stream, "Records in %d block\n", block_t);
+
+		for (int j = 0; j < block_data.key_num; j++, data += sizeof(Record)) {
+			Record rec;
+			memcpy(&rec, data, sizeof(Record));
+			fprintf(stream,
+				"Id: %d\n"
+				"Name: %s\n"
+				"Surname: %s\n"
+				"City: %s\n\n",
+				rec.id, rec.name,
+				rec.surname, rec.city
+			);
+		}
+		block_t = block_data.next;
+		CALL_BF(BF_UnpinBlock(block), error);
+	}
+	BF_Block_Destroy(&block);
+	return 0;
+
+	error:
+		BF_Block_Destroy(&block);
+		return -1;
+}
+
+
+
+
+/* Walks from the root to the leaf that may hold value (the leftmost leaf
+ * if value is NULL), storing the internal nodes passed in path */
+static int BPT_FindLeaf(BPlus_file *handle, void *value, int *path) 
+{
+	BPlus_block block_data;
+	BF_Block *block;
+	BF_Block_Init(&block);
+
+	int block_t = handle->root;
+	for (int level = 0; level < handle->height - 1; ++level) {
+		path[level] = block_t;
+		CALL_BF(BF_GetBlock(handle->file_desc, block_t, block), error);
+		char *data = BF_Block_GetData(block);
+		memcpy(&block_data, data, sizeof(BPlus_block));
+
+		int i = value != NULL
+			? node_search(handle, data, block_data.key_num, value)
+			: 0;
+		block_t = node_child(handle, data, i);
+		CALL_BF(BF_UnpinBlock(block), error);
+	}
+	BF_Block_Destroy(&block);
+	return block_t;
+
+	error:
+		BF_Block_Destroy(&block);
+		return -1;
+}
+
+/* Adds the separator key with the new right sibling to the parent of left,
+ * splitting full internal nodes up to a new root if needed */
+static int BPT_InsertParent(BPlus_file *handle, int *path, int level,
+                                                           int left,
+                                                           void *key,
+                                                           int right) 
+{
+	int pair_size = PAIR_SIZE(handle);
+	int key_size = get_attr_size(handle->attr);
+	BPlus_block block_data;
+	BF_Block *block;
+	BF_Block_Init(&block);
+
+	if (level == 0) {
+		if (handle->height == MAX_HEIGHT) {
+			fprintf(stderr, "Error! B+ tree exceeds the maximum height\n");
+			goto error;
+		}
+
+		int root;
+		if (BPT_NewBlock(handle, block, &root) < 0)
+			goto error;
+
+		char *data = BF_Block_GetData(block);
+		block_data = (BPlus_block) { .key_num = 1, .next = -1 };
+		memcpy(data, &block_data, sizeof(BPlus_block));
+		data += sizeof(BPlus_block);
+		memcpy(data, &left, sizeof(int));
+		memcpy(data + sizeof(int), key, key_size);
+		memcpy(data + sizeof(int) + key_size, &right, sizeof(int));
+
+		handle->root = root;
+		handle->height++;
+
+		BF_Block_SetDirty(block);
+		CALL_BF(BF_UnpinBlock(block), error);
+		BF_Block_Destroy(&block);
+		return 0;
+	}
+
+	int parent = path[level - 1];
+	CALL_BF(BF_GetBlock(handle->file_desc, parent, block), error);
+	char *data = BF_Block_GetData(block);
+	memcpy(&block_data, data, sizeof(BPlus_block));
+
+	/* Pairs of (key, right child) follow the leftmost child */
+	char buffer[BF_BLOCK_SIZE + BF_BLOCK_SIZE];
+	char *pairs = data + sizeof(BPlus_block) + sizeof(int);
+	int pos = node_search(handle, data, block_data.key_num, key);
+
+	memcpy(buffer, pairs, pos * pair_size);
+	memcpy(buffer + pos * pair_size, key, key_size);
+	memcpy(buffer + pos * pair_size + key_size, &right, sizeof(int));
+	memcpy(
+		buffer + (pos + 1) * pair_size,
+		pairs + pos * pair_size,
+		(block_data.key_num - pos) * pair_size
+	);
+
+	int key_num = block_data.key_num + 1;
+	if (key_num <= handle->key_capacity) {
+		block_data.key_num = key_num;
+		memcpy(data, &block_data, sizeof(BPlus_block));
+		memcpy(pairs, buffer, key_num * pair_size);
+		BF_Block_SetDirty(block);
+		CALL_BF(BF_UnpinBlock(block), error);
+		BF_Block_Destroy(&block);
+		return 0;
+	}
+
+	/* The middle key moves up and its child becomes the leftmost child
+	 * of the new right node */
+	int mid = key_num / 2, new_node;
+	char up[BF_BLOCK_SIZE];
+	memcpy(up, buffer + mid * pair_size, key_size);
+
+	BF_Block *right_block;
+	BF_Block_Init(&right_block);
+	if (BPT_NewBlock(handle, right_block, &new_node) < 0) {
+		BF_Block_Destroy(&right_block);
+		goto unpin;
+	}
+
+	char *right_ptr = BF_Block_GetData(right_block);
+	BPlus_block right_data = { .key_num = key_num - mid - 1, .next = -1 };
+	memcpy(right_ptr, &right_data, sizeof(BPlus_block));
+	memcpy(
+		right_ptr + sizeof(BPlus_block),
+		buffer + mid * pair_size + key_size,
+		sizeof(int) + right_data.key_num * pair_size
+	);
+
+	block_data.key_num = mid;
+	memcpy(data, &block_data, sizeof(BPlus_block));
+	memcpy(pairs, buffer, mid * pair_size);
+
+	BF_Block_SetDirty(right_block);
+	BF_Block_SetDirty(block);
+	CALL_BF(BF_UnpinBlock(right_block), error);
+	BF_Block_Destroy(&right_block);
+	CALL_BF(BF_UnpinBlock(block), error);
+	BF_Block_Destroy(&block);
+
+	return BPT_InsertParent(handle, path, level - 1, parent, up, new_node);
+
+	unpin:
+		BF_UnpinBlock(block);
+	error:
+		BF_Block_Destroy(&block);
+		return -1;
+}
+
+static int BPT_NewBlock(BPlus_file *handle, BF_Block *block, int *block_id) 
+{
+	CALL_BF(BF_AllocateBlock(handle->file_desc, block), error);
+	CALL_BF(BF_GetBlockCounter(handle->file_desc, block_id), unpin);
+	--*block_id;
+	return 0;
+
+	unpin:
+		BF_UnpinBlock(block);
+	error:
+		return -1;
+}
+
+/* Position of the first record with key >= value */
+static int leaf_search(BPlus_file *handle, char *data, int rec_num, void *value,
+                                                                    bool *found) 
+{
+	int offset = sizeof(BPlus_block) + get_attr_offset(handle->attr);
+	int low = 0, high = rec_num;
+
+	*found = false;
+	while (low < high) {
+		int mid = (low + high) / 2;
+		int code = compare_keys(data + offset + mid * sizeof(Record), value, handle->attr);
+		if (code == 0) {
+			*found = true;
+			return mid;
+		}
+		if (code < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+/* Index of the child whose subtree may hold value */
+static int node_search(BPlus_file *handle, char *data, int key_num, void *value) 
+{
+	int low = 0, high = key_num;
+	while (low < high) {
+		int mid = (low + high) / 2;
+		if (compare_keys(node_key(handle, data, mid), value, handle->attr) <= 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+static void *node_key(BPlus_file *handle, char *data, int i) 
+{
+	return data + sizeof(BPlus_block) + sizeof(int) + i * PAIR_SIZE(handle);
+}
+
+static int node_child(BPlus_file *handle, char *data, int i) 
+{
+	int child;
+	memcpy(
+		&child,
+		data + sizeof(BPlus_block) + i * PAIR_SIZE(handle),
+		sizeof(int)
+	);
+	return child;
+}
@@ -1,22 +1,85 @@
 #include "hash_file.h"
 #include "shash_file.h"
 
-#define RECORDS_CAPACITY (BF_BLOCK_SIZE - sizeof(Hash_block)) / sizeof(Record) 
-#define BUCKETS_PER_BLOCK (BF_BLOCK_SIZE / sizeof(int))
-#define HT_INFO_SIZE (sizeof(Hash_file) - sizeof(int*))
-
-static size_t hash_strings(const void *key);
+#define RECORDS_CAPACITY(block_size) ((block_size) - sizeof(Hash_block)) / (sizeof(Record) + 1)
+#define BUCKETS_PER_BLOCK(block_size) ((block_size) / sizeof(int))
+#define HT_INFO_SIZE offsetof(Hash_file, hash_table)
+#define MAX_GLOBAL_DEPTH 20
+#define SORT_RECORDS 1024
+#define MERGE_WAYS 16
+#define MERGE_RECORDS (SORT_RECORDS / MERGE_WAYS)
+#define READ_AHEAD 16
+#define BUCKET_BLOOM(handle, bucket) ((handle)->bloom + (bucket) * BLOOM_BUCKET_SIZE)
+
+typedef struct {
+	int bucket;
+	int block_id;
+	bool skip;
+	Record *rec;
+} Bucket_entry;
+
+typedef struct {
+	Record buffer[MERGE_RECORDS];
+	int pos;
+	int size;
+	long next;
+	long end;
+} Run_reader;
+
+static Hash_file *HT_Open(const char *filename, bool mapped);
+static bool read_only(Hash_file *handle);
+static size_t hash_filename(void *key);
 static int HT_FindEntry(Hash_file *handle, void *value, Record_pos *rec_pos, 
                                                         int *empty_block,
 										                Record *rec);
-static void update_data(char *data, char *action, void *value);
+static int HT_SplitBucket(Hash_file *handle, void *value);
+static int HT_Insert(Hash_file *handle, Record record, int *block_id);
+static int HT_Delete(Hash_file *handle, void *value);
+static int HT_Rehash(Hash_file *handle, int new_buckets);
+static int HT_Load(Hash_file *handle, Record *recs, int n, bool dedupe, int *block_ids);
+static int HT_LoadBatch(Hash_file *handle, Record *recs, int n, int *block_ids);
+static int update_indexes(Hash_file *handle, Record *recs, int n, int *old_ids, 
+                                                                   int *new_ids);
+static Bucket_entry *sort_by_bucket(Hash_file *handle, Record *recs, int n);
+static int compare_entries(const void *a, const void *b, void *handle);
+static int dedupe_bucket(Hash_file *handle, Bucket_entry *entries, int count, 
+                                                                int **room, 
+                                                                int *room_num);
+static int append_records(Hash_file *handle, Bucket_entry *entries, int count, 
+                                                                 int *room, 
+                                                                 int room_num);
+static int merge_runs(FILE *runs, long *bounds, int runs_num, rec_attr attr, 
+                                                              FILE *out, 
+                                                              Record_visit visit, 
+                                                              void *arg);
+static bool read_run(FILE *runs, Run_reader *reader);
+static int compare_records(const void *a, const void *b, void *attr);
+static void update_data(Hash_file *handle, char *data, char *action, void *value);
+static void read_ahead(HT_Scan *scan);
+static int latch_bucket(Hash_file *handle, void *value, bool write, bool whole_file);
+static int latch_writer(Hash_file *handle, void *value);
+static int bucket_latch(Hash_file *handle, void *value);
+static bool latched_by_cursor(Hash_file *handle, void *value);
+static void hold_cursor(Cursor_latch *cursor);
+static void release_cursor(Cursor_latch *cursor);
+static int switch_bucket(Hash_file *handle, int latch, int bucket);
+static void unlatch_bucket(Hash_file *handle, int latch);
+static bool has_indexes(Hash_file *handle);
+static void destroy_latches(Hash_file *handle);
+static void match_keys(Hash_file *handle, char *data, int rec_num, void *value, 
+                                                                   int size, 
+                                                                   uint64_t *mask);
 
 Hash_map file_map;
+pthread_mutex_t file_map_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Cursors the calling thread keeps open, with the latches they hold */
+static __thread Cursor_latch *cursor_latches;
 
 void HT_Init(void) 
 {
 	file_map = hash_map_create(0, (Comparator)strcmp, 
-							      (Hash_func)hash_strings, 
+							      hash_filename, 
 								  free, NULL);
 }
 
@@ -28,6 +91,15 @@ void HT_Close(void)
 
 
 int HT_CreateFile(const char *filename, rec_attr attr, int buckets) 
+{
+	return HT_CreateFileEx(filename, attr, buckets, STATIC_HASH, ROW_LAYOUT, BF_BLOCK_SIZE);
+}
+
+
+int HT_CreateFileEx(const char *filename, rec_attr attr, int buckets, 
+                                                         hash_mode mode, 
+                                                         rec_layout layout,
+                                                         int block_size) 
 {
 	if (strlen(filename) > MAX_FILENAME) {
 		fprintf(stderr,
@@ -38,11 +110,24 @@ int HT_CreateFile(const char *filename, rec_attr attr, int buckets)
 		return -1;
 	}
 
+	if (mode == LINEAR_HASH) {
+		fprintf(stderr, "Linear hashing is not supported for primary indexes\n");
+		return -1;
+	}
+
+	int global_depth = 0;
+	if (mode == EXTENDIBLE_HASH) {
+		while ((1 << global_depth) < buckets)
+			global_depth++;
+		buckets = 1 << global_depth;
+	}
+
 
     int fd;
-    CALL_BF(BF_CreateFile(filename), error);
+    CALL_BF(BF_CreateFileEx(filename, block_size), error);
     CALL_BF(BF_OpenFile(filename, &fd), delete_file);
 
+    int dir_blocks = (buckets - 1) / BUCKETS_PER_BLOCK(block_size) + 1;
     int last_block = 0, _buckets = buckets;
     BF_Block *block, *buckets_;
 
@@ -53,18 +138,46 @@ int HT_CreateFile(const char *filename, rec_attr attr, int buckets)
     do {
         last_block++;
         CALL_BF(BF_AllocateBlock(fd, buckets_), bf_cleanup);
-        _buckets -= BUCKETS_PER_BLOCK;
-        memset(BF_Block_GetData(buckets_), -1, BF_BLOCK_SIZE);
+        char *data = BF_Block_GetData(buckets_);
+        memset(data, -1, block_size);
+
+        /* Extendible buckets start with one empty data block each, 
+         * allocated right after the directory */
+        for (int i = 0; mode == EXTENDIBLE_HASH 
+                     && i < BUCKETS_PER_BLOCK(block_size) && i < _buckets; ++i) {
+            int block_id = dir_blocks + (last_block - 1) * BUCKETS_PER_BLOCK(block_size) + i + 1;
+            memcpy(data + i * sizeof(int), &block_id, sizeof(int));
+        }
+        _buckets -= BUCKETS_PER_BLOCK(block_size);
         BF_Block_SetDirty(buckets_);
         CALL_BF(BF_UnpinBlock(buckets_), bf_cleanup);
     } while (_buckets > 0);
 
+    for (int i = 0; mode == EXTENDIBLE_HASH && i < buckets; ++i) {
+        Hash_block block_data = {
+            .rec_num     = 0,
+            .overf_block = -1,
+            .local_depth = global_depth
+        };
+        CALL_BF(BF_AllocateBlock(fd, buckets_), bf_cleanup);
+        memcpy(BF_Block_GetData(buckets_), &block_data, sizeof(Hash_block));
+        BF_Block_SetDirty(buckets_);
+        CALL_BF(BF_UnpinBlock(buckets_), bf_cleanup);
+    }
+
 
     Hash_file handle = {
         .buckets       = buckets,
-        .rec_capacity  = RECORDS_CAPACITY,
+        .block_size    = block_size,
+        .rec_capacity  = RECORDS_CAPACITY(block_size),
         .attr          = attr,
         .last_block_id = last_block,
+        .dir_block     = 1,
+        .bloom_block   = -1,
+        .bloom_blocks  = 0,
+        .global_depth  = global_depth,
+        .mode          = mode,
+        .layout        = layout,
 		.file_type     = "hash"
     };
 
@@ -75,7 +188,7 @@ int HT_CreateFile(const char *filename, rec_attr attr, int buckets)
 	}
 
 	COPY(filename, handle.filename, strlen(filename), MAX_FILENAME + 1);
-    COPY(&handle, BF_Block_GetData(block), HT_INFO_SIZE, BF_BLOCK_SIZE);
+    COPY(&handle, BF_Block_GetData(block), HT_INFO_SIZE, block_size);
     BF_Block_SetDirty(block);
 
     CALL_BF(BF_UnpinBlock(block), bf_cleanup);
@@ -99,9 +212,20 @@ int HT_CreateFile(const char *filename, rec_attr attr, int buckets)
 }
 
 Hash_file *HT_OpenFile(const char *filename) 
+{
+	return HT_Open(filename, false);
+}
+
+/* Blocks are read straight from the mapped file, which is never written */
+Hash_file *HT_OpenFileMapped(const char *filename) 
+{
+	return HT_Open(filename, true);
+}
+
+static Hash_file *HT_Open(const char *filename, bool mapped) 
 {
     int fd;
-	CALL_BF(BF_OpenFile(filename, &fd), error);
+	CALL_BF(mapped ? BF_OpenFileMapped(filename, &fd) : BF_OpenFile(filename, &fd), error);
 
     BF_Block *metadata_block;
     BF_Block *buckets_block;
@@ -124,24 +248,36 @@ Hash_file *HT_OpenFile(const char *filename)
     Hash_file *handle = malloc(sizeof(*handle));
     memcpy(handle, BF_Block_GetData(metadata_block), HT_INFO_SIZE);
     handle->file_desc = fd;
+    handle->read_only = mapped;
+    pthread_rwlock_init(&handle->latch, NULL);
+    for (int i = 0; i < HT_LATCHES; ++i)
+        pthread_rwlock_init(&handle->bucket_latches[i], NULL);
 
 
     handle->hash_table = malloc(sizeof(int) * handle->buckets);
     int buckets = handle->buckets;
-    for (int i = 1; i <= handle->last_block_id; ++i) {
+    for (int i = handle->dir_block; i <= handle->last_block_id; ++i) {
 	    CALL_BF(BF_GetBlock(fd, i, buckets_block), bf_cleanup);
         memcpy(
-        	handle->hash_table + (i - 1) * BUCKETS_PER_BLOCK, 
+        	handle->hash_table + (i - handle->dir_block) * BUCKETS_PER_BLOCK(handle->block_size), 
             BF_Block_GetData(buckets_block), 
-            buckets >= BUCKETS_PER_BLOCK 
-                ? BF_BLOCK_SIZE 
+            buckets >= BUCKETS_PER_BLOCK(handle->block_size) 
+                ? handle->block_size 
                 : buckets * sizeof(int)
         );
-        buckets -= BUCKETS_PER_BLOCK;
+        buckets -= BUCKETS_PER_BLOCK(handle->block_size);
 		CALL_BF(BF_UnpinBlock(buckets_block), bf_cleanup);
     }
 
+	/* The filters of a file that was never closed are all empty */
+	handle->bloom = calloc(handle->buckets, BLOOM_BUCKET_SIZE);
+	if (handle->bloom_block > 0 && bloom_load(fd, handle->bloom_block, handle->bloom, 
+	                                          handle->buckets * BLOOM_BUCKET_SIZE) < 0)
+		goto bf_cleanup;
+
+	pthread_mutex_lock(&file_map_lock);
 	hash_map_insert(file_map, strdup(handle->filename), handle);
+	pthread_mutex_unlock(&file_map_lock);
     BF_Block_Destroy(&buckets_block);
 	BF_Block_Destroy(&metadata_block);
     return handle;
@@ -159,43 +295,58 @@ int HT_CloseFile(Hash_file *handle)
     BF_Block *block;
     BF_Block_Init(&block);
 
-    CALL_BF(BF_GetBlock(handle->file_desc, 0, block), bf_cleanup);
-    char *data = BF_Block_GetData(block);
-
-    memcpy(
-        data + offsetof(Hash_file, rec_count),
-        &handle->rec_count,
-        sizeof_field(Hash_file, rec_count)
-    );
-
-	memcpy(
-		data + offsetof(Hash_file, index_files),
-		handle->index_files,
-		sizeof_field(Hash_file, index_files)
-	);
+    /* Files opened read-only are left as they were found */
+    if (handle->read_only)
+        goto close_file;
+
+    /* A directory that doubled since creation no longer fits in its 
+     * blocks, so it is moved to fresh blocks at the end of the file. 
+     * Its old blocks, like those of a filter that grew, stay unused, 
+     * since the file keeps no list of free blocks */
+    int dir_blocks = (handle->buckets - 1) / BUCKETS_PER_BLOCK(handle->block_size) + 1;
+    if (dir_blocks > handle->last_block_id - handle->dir_block + 1) {
+        CALL_BF(BF_GetBlockCounter(handle->file_desc, &handle->dir_block), bf_cleanup);
+        for (int i = 0; i < dir_blocks; ++i) {
+            CALL_BF(BF_AllocateBlock(handle->file_desc, block), bf_cleanup);
+            CALL_BF(BF_UnpinBlock(block), bf_cleanup);
+        }
+        handle->last_block_id = handle->dir_block + dir_blocks - 1;
+    }
 
+    if (bloom_store(handle->file_desc, &handle->bloom_block, &handle->bloom_blocks, 
+                                       handle->bloom, 
+                                       handle->buckets * BLOOM_BUCKET_SIZE) < 0)
+        goto bf_cleanup;
 
+    CALL_BF(BF_GetBlock(handle->file_desc, 0, block), bf_cleanup);
+    memcpy(BF_Block_GetData(block), handle, HT_INFO_SIZE);
     BF_Block_SetDirty(block);
     CALL_BF(BF_UnpinBlock(block), bf_cleanup);
 
-    for (int i = 1; i <= handle->last_block_id; ++i) {
+    int buckets = handle->buckets;
+    for (int i = handle->dir_block; i <= handle->last_block_id; ++i) {
         CALL_BF(BF_GetBlock(handle->file_desc, i, block), bf_cleanup);
         memcpy(
             BF_Block_GetData(block),
-            handle->hash_table + (i - 1) * BUCKETS_PER_BLOCK,
-            i != handle->last_block_id 
-                ? BF_BLOCK_SIZE 
-                : sizeof(int) * handle->buckets
+            handle->hash_table + (i - handle->dir_block) * BUCKETS_PER_BLOCK(handle->block_size),
+            buckets >= BUCKETS_PER_BLOCK(handle->block_size)
+                ? handle->block_size 
+                : sizeof(int) * buckets
         );
-        handle->buckets -= BUCKETS_PER_BLOCK;
+        buckets -= BUCKETS_PER_BLOCK(handle->block_size);
         BF_Block_SetDirty(block);
         CALL_BF(BF_UnpinBlock(block), bf_cleanup);
     }
 
+    close_file:
     BF_Block_Destroy(&block);
     CALL_BF(BF_CloseFile(handle->file_desc), error);
+	pthread_mutex_lock(&file_map_lock);
 	hash_map_delete(file_map, handle->filename);
+	pthread_mutex_unlock(&file_map_lock);
+    destroy_latches(handle);
     free(handle->hash_table);
+    free(handle->bloom);
     free(handle);
 
     return 0;
@@ -204,14 +355,33 @@ int HT_CloseFile(Hash_file *handle)
 		BF_Block_Destroy(&block);
 		CALL_BF(BF_CloseFile(handle->file_desc), error);
 	error:
+		pthread_mutex_lock(&file_map_lock);
 		hash_map_delete(file_map, handle->filename);
+		pthread_mutex_unlock(&file_map_lock);
+		destroy_latches(handle);
 		free(handle->hash_table);
+		free(handle->bloom);
 		free(handle);
 		return -1;
 }
 
 
 int HT_InsertEntry(Hash_file *handle, Record record, int *block_id) 
+{
+	if (read_only(handle))
+		return -1;
+
+	void *value = get_rec_member(&record, handle->attr);
+	if (latched_by_cursor(handle, value))
+		return -1;
+
+	int latch = latch_writer(handle, value);
+	int code = HT_Insert(handle, record, block_id);
+	unlatch_bucket(handle, latch);
+	return code;
+}
+
+static int HT_Insert(Hash_file *handle, Record record, int *block_id) 
 {
 	int empty_block = -1;
 	Record_pos tmp_pos = { .block_id = -1 };
@@ -226,6 +396,19 @@ int HT_InsertEntry(Hash_file *handle, Record record, int *block_id)
 		return tmp_pos.block_id < 0 ? -1 : 0;
 	}
 
+	/* Extendible buckets split until the record fits, only chaining 
+	 * overflow blocks once the directory cannot grow any further */
+	while (handle->mode == EXTENDIBLE_HASH && empty_block < 0) {
+		int code = HT_SplitBucket(handle, value);
+		if (code <= 0) {
+			if (code < 0)
+				return -1;
+			break;
+		}
+		if (HT_FindEntry(handle, value, NULL, &empty_block, NULL) < 0)
+			return -1;
+	}
+
 	BF_Block_Init(&block);
 	if (empty_block > 0)
 		CALL_BF(
@@ -247,23 +430,22 @@ int HT_InsertEntry(Hash_file *handle, Record record, int *block_id)
 	
 
 	char *data = BF_Block_GetData(block);
-	int bucket = hash_key(get_attr_type(handle->attr), value) % handle->buckets;
+	size_t hash = hash_key(get_attr_type(handle->attr), value);
+	int bucket = hash % handle->buckets;
 	if (empty_block < 0) {
 		Hash_block block_data = { 
 			.overf_block = handle->hash_table[bucket],
-			.rec_num = 0
+			.rec_num = 0,
+			.local_depth = handle->mode == EXTENDIBLE_HASH
+				? handle->global_depth
+				: 0
 		};
-		CALL_BF(
-			BF_GetBlockCounter(
-				handle->file_desc,
-				&handle->hash_table[bucket]
-			),
-			unpin
-		);
-		--handle->hash_table[bucket];
+		/* Read ahead peeks at the heads of buckets it does not latch */
+		__atomic_store_n(&handle->hash_table[bucket], BF_Block_GetNum(block), __ATOMIC_RELAXED);
 		memcpy(data, &block_data, sizeof(Hash_block));
 	}
-	update_data(data, "insert", &record);
+	update_data(handle, data, "insert", &record);
+	bloom_add(BUCKET_BLOOM(handle, bucket), BLOOM_BUCKET_SIZE, hash);
 
 	if (block_id != NULL)
 		*block_id = empty_block < 0 
@@ -273,19 +455,27 @@ int HT_InsertEntry(Hash_file *handle, Record record, int *block_id)
 	BF_Block_SetDirty(block);
 	CALL_BF(BF_UnpinBlock(block), error);
 	BF_Block_Destroy(&block);
-	handle->rec_count++;
+	__atomic_add_fetch(&handle->rec_count, 1, __ATOMIC_RELAXED);
 
 	return 0;
 
-	unpin:
-		CALL_BF(BF_UnpinBlock(block), error);
-
 	error:
 		BF_Block_Destroy(&block);
 		return -1;
 }
 
 int HT_DeleteEntry(Hash_file *handle, void *value) 
+{
+	if (read_only(handle) || latched_by_cursor(handle, value))
+		return -1;
+
+	int latch = latch_writer(handle, value);
+	int code = HT_Delete(handle, value);
+	unlatch_bucket(handle, latch);
+	return code;
+}
+
+static int HT_Delete(Hash_file *handle, void *value) 
 {
 	int code;
 	BF_Block *block;
@@ -307,40 +497,20 @@ int HT_DeleteEntry(Hash_file *handle, void *value)
 	);
 
 	update_data(
+		handle,
 		BF_Block_GetData(block),
 		"delete",
 		&rec_pos.pos
 	);
 
-	for (rec_attr attr_ = NAME; attr_ <= CITY; ++attr_) {
-		if (strcmp("", handle->index_files[attr_ - 1].filename)) {
-			Map_tuple tuple = hash_map_value(
-				file_map, 
-				handle->index_files[attr_ - 1].filename
-			);
-
-			SHash_file *shandle = tuple != NULL
-				? (SHash_file*)map_tuple_value(tuple)
-				: SHT_OpenFile(handle->index_files[attr_ - 1].filename);
-
-			if (shandle == NULL)
-				goto bf_cleanup;
-
-			SHT_DeleteEntry(
-				shandle, 
-				get_rec_member(&rec, attr_), 
-				rec_pos.block_id
-			);
-			if (tuple == NULL && SHT_CloseFile(shandle) < 0)
-				goto bf_cleanup;
-		}
-	}
+	if (update_indexes(handle, &rec, 1, &rec_pos.block_id, NULL) < 0)
+		goto bf_cleanup;
 
 	BF_Block_SetDirty(block);
 	CALL_BF(BF_UnpinBlock(block), bf_cleanup);
 	BF_Block_Destroy(&block);
 	
-	handle->rec_count--;
+	__atomic_sub_fetch(&handle->rec_count, 1, __ATOMIC_RELAXED);
 	return 0;
 
 	bf_cleanup:
@@ -350,7 +520,9 @@ int HT_DeleteEntry(Hash_file *handle, void *value)
 
 int HT_GetEntry(Hash_file *handle, void *value, Record *rec) 
 {
+	int latch = latch_bucket(handle, value, false, false);
 	int code = HT_FindEntry(handle, value, NULL, NULL, rec);
+	unlatch_bucket(handle, latch);
 	return code < 0 ? -1 : 0;
 }
 
@@ -358,59 +530,7 @@ int HT_GetAllEntries(Hash_file *handle, rec_attr attr,
 										void *value, 
 										Dl_list records) 
 {
-	if (handle->attr == attr) {
-		Record rec = {};
-		int code = HT_GetEntry(handle, value, &rec);
-
-		if (code < 0 || rec.id < 0)
-			return code < 0 ? -1 : 0;
-
-		Record *rec_ = malloc(sizeof(*rec_));
-		list_insert(records, memcpy(rec_, &rec, sizeof(*rec_)));
-		return 0; 
-	}
-
-
-	int offset = get_attr_offset(attr);
-	int size = get_attr_type(attr) == STRING
-		? strlen(value) + 1
-		: get_attr_size(attr);
-
-	BF_Block *block;
-	Hash_block block_data;
-	BF_Block_Init(&block);
-	for (int i = 0; i < handle->buckets; ++i) {
-		int block_t = handle->hash_table[i];
-		while (block_t != -1) {
-			CALL_BF(
-				BF_GetBlock(
-					handle->file_desc,
-					block_t,
-					block
-				),
-				error
-			);
-			char *data = BF_Block_GetData(block);
-			memcpy(&block_data, data, sizeof(Hash_block));
-			data += sizeof(Hash_block);
-
-			for (int j = 0; j < block_data.rec_num; j++, data += sizeof(Record)) {
-				if (memcmp(data + offset, value, size) == 0) {
-					Record *tmp = malloc(sizeof(*tmp));
-					list_insert(records, memcpy(tmp, data, sizeof(*tmp)));
-				}
-			}
-			block_t = block_data.overf_block;
-			CALL_BF(BF_UnpinBlock(block), error);
-		}
-	}
-	BF_Block_Destroy(&block);
-	return 0;
-
-	error:
-		BF_Block_Destroy(&block);
-		return -1;
-
+	return HT_ForEach(handle, attr, value, list_record, records);
 }
 
 int HT_PrintFile(Hash_file *handle, FILE *stream) 
@@ -418,8 +538,12 @@ int HT_PrintFile(Hash_file *handle, FILE *stream)
 	BF_Block *block;
 	BF_Block_Init(&block);
 
+	int latch = -1;
+	pthread_rwlock_rdlock(&handle->latch);
+	CALL_BF(BF_AdviseSequential(handle->file_desc, true), error);
 	for (int i = 0; i < handle->buckets; i++) {
-		int block_t = handle->hash_table[i];
+		latch = switch_bucket(handle, latch, i);
+		int block_t = HT_BucketHead(handle, i) ? handle->hash_table[i] : -1;
 
 		if (block_t > 0)
 			fprintf(stream, "Records in %d bucket\n\n", i);
@@ -432,7 +556,7 @@ int HT_PrintFile(Hash_file *handle, FILE *stream)
 					block_t, 
 					block
 				),
-				error
+				unadvise
 			);
 			char *data = BF_Block_GetData(block);
 			int rec_num;
@@ -448,10 +572,10 @@ int HT_PrintFile(Hash_file *handle, FILE *stream)
 				sizeof_field(Hash_block, overf_block)
 			);
 
-			data += sizeof(Hash_block);
-			for (int j = 0; j < rec_num; j++, data += sizeof(Record)) {
+			data = HT_RECORDS(handle, data);
+			for (int j = 0; j < rec_num; j++) {
 				Record rec;
-				memcpy(&rec, data, sizeof(Record));
+				get_block_record(data, handle->layout, handle->rec_capacity, j, &rec);
 				fprintf(stream,
 					"Id: %d\n"
 					"Name: %s\n"
@@ -461,15 +585,570 @@ int HT_PrintFile(Hash_file *handle, FILE *stream)
 					rec.surname, rec.city
 				);				
 			}
-			CALL_BF(BF_UnpinBlock(block), error);
+			CALL_BF(BF_UnpinBlock(block), unadvise);
 		}
 	}
+	CALL_BF(BF_AdviseSequential(handle->file_desc, false), error);
+	unlatch_bucket(handle, latch);
 	BF_Block_Destroy(&block);
 	
 	return 0;
 
+	unadvise:
+		BF_AdviseSequential(handle->file_desc, false);
+	error:
+		unlatch_bucket(handle, latch);
+		BF_Block_Destroy(&block);
+		return -1;
+}
+
+
+int HT_RangeScan(Hash_file *handle, rec_attr attr, void *low, 
+                                                   void *high, 
+                                                   Record_visit visit, 
+                                                   void *arg) 
+{
+	int count = 0, runs_num = 0, code = 0;
+	Record *buffer = malloc(SORT_RECORDS * sizeof(Record));
+	long *bounds = malloc(sizeof(long));
+	FILE *runs = NULL;
+	bounds[0] = 0;
+
+	BF_Block *block;
+	Hash_block block_data;
+	BF_Block_Init(&block);
+
+	/* Qualifying records are collected bucket by bucket into sorted runs 
+	 * of at most SORT_RECORDS records, spilled to a temporary file */
+	int latch = -1;
+	pthread_rwlock_rdlock(&handle->latch);
+	for (int i = 0; i < handle->buckets; ++i) {
+		latch = switch_bucket(handle, latch, i);
+		int block_t = HT_BucketHead(handle, i) ? handle->hash_table[i] : -1;
+		while (block_t != -1) {
+			CALL_BF(BF_GetBlock(handle->file_desc, block_t, block), error);
+			char *data = BF_Block_GetData(block);
+			memcpy(&block_data, data, sizeof(Hash_block));
+			data = HT_RECORDS(handle, data);
+
+			for (int j = 0; j < block_data.rec_num; j++) {
+				void *key = get_block_member(data, handle->layout, handle->rec_capacity, j, attr);
+				if ((low != NULL && compare_keys(key, low, attr) < 0)
+				 || (high != NULL && compare_keys(key, high, attr) > 0))
+					continue;
+
+				get_block_record(data, handle->layout, handle->rec_capacity, j, &buffer[count++]);
+				if (count < SORT_RECORDS)
+					continue;
+
+				qsort_r(buffer, count, sizeof(Record), compare_records, &attr);
+				if ((runs == NULL && (runs = tmpfile()) == NULL)
+				 || fwrite(buffer, sizeof(Record), count, runs) != count) {
+					BF_UnpinBlock(block);
+					goto io_error;
+				}
+				bounds = realloc(bounds, (++runs_num + 1) * sizeof(long));
+				bounds[runs_num] = bounds[runs_num - 1] + count;
+				count = 0;
+			}
+			block_t = block_data.overf_block;
+			CALL_BF(BF_UnpinBlock(block), error);
+		}
+	}
+	unlatch_bucket(handle, latch);
+	BF_Block_Destroy(&block);
+
+	qsort_r(buffer, count, sizeof(Record), compare_records, &attr);
+	if (runs == NULL) {
+		for (int i = 0; i < count && !code; ++i)
+			code = visit(&buffer[i], arg);
+		free(buffer);
+		free(bounds);
+		return code;
+	}
+
+	if (count > 0) {
+		if (fwrite(buffer, sizeof(Record), count, runs) != count)
+			goto io_cleanup;
+		bounds = realloc(bounds, (++runs_num + 1) * sizeof(long));
+		bounds[runs_num] = bounds[runs_num - 1] + count;
+	}
+	free(buffer);
+	buffer = NULL;
+
+	/* Runs are merged MERGE_WAYS at a time until one final merge is left */
+	while (runs_num > MERGE_WAYS) {
+		FILE *merged = tmpfile();
+		if (merged == NULL)
+			goto io_cleanup;
+
+		int merged_num = 0;
+		for (int i = 0; i < runs_num; i += MERGE_WAYS, ++merged_num) {
+			int ways = runs_num - i < MERGE_WAYS ? runs_num - i : MERGE_WAYS;
+			if (merge_runs(runs, bounds + i, ways, attr, merged, NULL, NULL) < 0) {
+				fclose(merged);
+				goto io_cleanup;
+			}
+			bounds[merged_num + 1] = bounds[i + ways];
+		}
+		fclose(runs);
+		runs = merged;
+		runs_num = merged_num;
+	}
+
+	code = merge_runs(runs, bounds, runs_num, attr, NULL, visit, arg);
+	fclose(runs);
+	free(bounds);
+	return code;
+
+	error:
+		unlatch_bucket(handle, latch);
+		BF_Block_Destroy(&block);
+		free(buffer);
+		free(bounds);
+		if (runs != NULL)
+			fclose(runs);
+		return -1;
+
+	io_error:
+		unlatch_bucket(handle, latch);
+		BF_Block_Destroy(&block);
+	io_cleanup:
+		fprintf(stderr, "Error! Could not write sorted runs\n");
+		free(buffer);
+		free(bounds);
+		if (runs != NULL)
+			fclose(runs);
+		return -1;
+}
+
+
+HT_Scan *HT_Scan_Open(Hash_file *handle, rec_attr attr, void *value) 
+{
+	HT_Scan *scan = malloc(sizeof(*scan));
+	*scan = (HT_Scan) {
+		.handle = handle,
+		.attr = attr,
+		.all = value == NULL,
+		.bucket = -1,
+		.block_id = -1,
+		.mask = malloc(MATCH_WORDS(handle->rec_capacity) * sizeof(uint64_t))
+	};
+
+	if (value != NULL) {
+		scan->size = get_value_size(attr, value);
+		memcpy(scan->value, value, scan->size);
+	}
+
+	/* Primary key lookups only walk the chain of the key's bucket, and hold its latch. 
+	 * Other scans latch each bucket while they are in it */
+	bool lookup = value != NULL && attr == handle->attr;
+	scan->latch = lookup ? latch_bucket(handle, value, false, false) : -1;
+	if (!lookup)
+		pthread_rwlock_rdlock(&handle->latch);
+	scan->held = (Cursor_latch) { .handle = handle, .latch = &scan->latch };
+	hold_cursor(&scan->held);
+
+	if (lookup) {
+		size_t hash = hash_key(get_attr_type(attr), value);
+		int bucket = hash % handle->buckets;
+		scan->bucket = handle->buckets;
+		scan->block_id = bloom_test(BUCKET_BLOOM(handle, bucket), BLOOM_BUCKET_SIZE, hash)
+			? handle->hash_table[bucket]
+			: -1;
+	}
+
+	/* Scans over every bucket let the OS read ahead */
+	scan->sequential = scan->bucket == -1 
+	                && BF_AdviseSequential(handle->file_desc, true) == BF_OK;
+	BF_Block_Init(&scan->block);
+	return scan;
+}
+
+int HT_Scan_Next(HT_Scan *scan, Record **rec) 
+{
+	Hash_file *handle = scan->handle;
+	Hash_block block_data;
+
+	while (true) {
+		if (scan->block_id == -1) {
+			while (++scan->bucket < handle->buckets && !HT_BucketHead(handle, scan->bucket));
+			if (scan->bucket >= handle->buckets)
+				return 0;
+
+			scan->latch = switch_bucket(handle, scan->latch, scan->bucket);
+			if (scan->sequential && scan->bucket % (READ_AHEAD / 2) == 0)
+				read_ahead(scan);
+			scan->block_id = handle->hash_table[scan->bucket];
+			scan->pos = 0;
+			continue;
+		}
+
+		bool fetched = !scan->pinned;
+		if (fetched) {
+			CALL_BF(BF_GetBlock(handle->file_desc, scan->block_id, scan->block), error);
+			scan->pinned = true;
+		}
+
+		char *data = BF_Block_GetData(scan->block);
+		memcpy(&block_data, data, sizeof(Hash_block));
+
+		/* Compare the attribute of the whole block once, when it is pinned. 
+		 * Keys are first filtered on their fingerprints */
+		if (fetched && !scan->all && scan->attr == handle->attr)
+			match_keys(handle, data, block_data.rec_num, scan->value, scan->size, scan->mask);
+		else if (fetched && !scan->all)
+			match_records(
+				get_block_member(HT_RECORDS(handle, data), handle->layout, 
+				                                           handle->rec_capacity, 0, 
+				                                           scan->attr), 
+				block_data.rec_num, 
+				get_member_stride(handle->layout, scan->attr), 
+				0, scan->value, scan->size, scan->mask
+			);
+		data = HT_RECORDS(handle, data);
+
+		if (!scan->all)
+			scan->pos = match_next(scan->mask, scan->pos, block_data.rec_num);
+		if (scan->pos < block_data.rec_num) {
+			/* Records of PAX blocks are put together in the cursor */
+			if (handle->layout == PAX_LAYOUT) {
+				get_block_record(data, handle->layout, handle->rec_capacity, scan->pos, &scan->rec);
+				*rec = &scan->rec;
+			} else {
+				*rec = (Record*)(data + scan->pos * sizeof(Record));
+			}
+			scan->pos++;
+			return 1;
+		}
+
+		scan->pinned = false;
+		scan->block_id = block_data.overf_block;
+		scan->pos = 0;
+		CALL_BF(BF_UnpinBlock(scan->block), error);
+	}
+
+	error:
+		return -1;
+}
+
+int HT_Scan_Close(HT_Scan *scan) 
+{
+	int code = 0;
+	if (scan->pinned && BF_UnpinBlock(scan->block) != BF_OK)
+		code = -1;
+	if (scan->sequential && BF_AdviseSequential(scan->handle->file_desc, false) != BF_OK)
+		code = -1;
+	release_cursor(&scan->held);
+	unlatch_bucket(scan->handle, scan->latch);
+
+	BF_Block_Destroy(&scan->block);
+	free(scan->mask);
+	free(scan);
+	return code;
+}
+
+
+int HT_ForEach(Hash_file *handle, rec_attr attr, void *value, 
+                                                 Record_visit visit, 
+                                                 void *arg) 
+{
+	int code, stop = 0;
+	Record *rec;
+	HT_Scan *scan = HT_Scan_Open(handle, attr, value);
+
+	if (scan == NULL)
+		return -1;
+
+	while ((code = HT_Scan_Next(scan, &rec)) > 0 && !(stop = visit(rec, arg)));
+
+	if (HT_Scan_Close(scan) < 0 || code < 0)
+		return -1;
+	return stop;
+}
+
+
+/* Several directory entries share a bucket once it has split less often 
+ * than the directory doubled; only the lowest of them owns the chain */
+bool HT_BucketHead(Hash_file *handle, int bucket) 
+{
+	if (bucket == 0 || handle->mode != EXTENDIBLE_HASH)
+		return true;
+
+	int high_bit = 1 << (31 - __builtin_clz(bucket));
+	return handle->hash_table[bucket] != handle->hash_table[bucket - high_bit];
+}
+
+/* Latches the file shared for a cursor of another file type, 
+ * such as a secondary index cursor reading its primary blocks */
+void HT_LatchCursor(Hash_file *handle, Cursor_latch *cursor) 
+{
+	pthread_rwlock_rdlock(&handle->latch);
+	*cursor = (Cursor_latch) { .handle = handle };
+	hold_cursor(cursor);
+}
+
+void HT_UnlatchCursor(Cursor_latch *cursor) 
+{
+	release_cursor(cursor);
+	pthread_rwlock_unlock(&cursor->handle->latch);
+}
+
+/* Records a secondary index of the file, under its exclusive latch 
+ * since writers decide how to latch by whether the file has indexes */
+int HT_AddIndex(Hash_file *handle, rec_attr attr, const char *sfilename) 
+{
+	if (latched_by_cursor(handle, NULL))
+		return -1;
+
+	pthread_rwlock_wrlock(&handle->latch);
+	COPY(sfilename, handle->index_files[attr - 1].filename, strlen(sfilename), MAX_FILENAME + 1);
+	pthread_rwlock_unlock(&handle->latch);
+	return 0;
+}
+
+
+int HT_Resize(Hash_file *handle, int new_buckets) 
+{
+	if (read_only(handle) || latched_by_cursor(handle, NULL))
+		return -1;
+
+	pthread_rwlock_wrlock(&handle->latch);
+	int code = HT_Rehash(handle, new_buckets);
+	pthread_rwlock_unlock(&handle->latch);
+	return code;
+}
+
+static int HT_Rehash(Hash_file *handle, int new_buckets) 
+{
+	if (handle->mode != STATIC_HASH) {
+		fprintf(stderr, "Error! Only static hash files can be resized\n");
+		return -1;
+	}
+	if (new_buckets <= 0) {
+		fprintf(stderr, "Error! The number of buckets must be positive\n");
+		return -1;
+	}
+
+	int *hash_table = malloc(new_buckets * sizeof(int));
+	unsigned char *bloom = calloc(new_buckets, BLOOM_BUCKET_SIZE);
+	int *counts = calloc(new_buckets, sizeof(int));
+	bool indexed = has_indexes(handle);
+	Record *moved = NULL;
+	int *old_ids = NULL, *new_ids = NULL;
+	int moved_num = 0;
+	char buffer[handle->block_size];
+	Hash_block block_data;
+	BF_Block *block;
+
+	memset(hash_table, -1, new_buckets * sizeof(int));
+	BF_Block_Init(&block);
+
+	/* Records are redistributed in one pass into new blocks, so the old chains 
+	 * stay intact until the new directory replaces the old one. Their blocks 
+	 * are left unused afterwards, since the file keeps no list of free blocks */
+	for (int i = 0; i < handle->buckets; ++i) {
+		int block_t = handle->hash_table[i];
+		while (block_t != -1) {
+			CALL_BF(BF_GetBlock(handle->file_desc, block_t, block), error);
+			memcpy(buffer, BF_Block_GetData(block), handle->block_size);
+			CALL_BF(BF_UnpinBlock(block), error);
+			memcpy(&block_data, buffer, sizeof(Hash_block));
+
+			if (indexed) {
+				moved   = realloc(moved, (moved_num + block_data.rec_num) * sizeof(Record));
+				old_ids = realloc(old_ids, (moved_num + block_data.rec_num) * sizeof(int));
+				new_ids = realloc(new_ids, (moved_num + block_data.rec_num) * sizeof(int));
+			}
+
+			char *data = HT_RECORDS(handle, buffer);
+			for (int j = 0; j < block_data.rec_num; j++) {
+				Record rec;
+				get_block_record(data, handle->layout, handle->rec_capacity, j, &rec);
+				void *value = get_rec_member(&rec, handle->attr);
+				size_t hash = hash_key(get_attr_type(handle->attr), value);
+				int bucket = hash % new_buckets;
+				bloom_add(bloom + bucket * BLOOM_BUCKET_SIZE, BLOOM_BUCKET_SIZE, hash);
+
+				if (hash_table[bucket] == -1 || counts[bucket] == handle->rec_capacity) {
+					Hash_block new_data = {
+						.rec_num = 0,
+						.overf_block = hash_table[bucket]
+					};
+					CALL_BF(BF_AllocateBlock(handle->file_desc, block), error);
+					hash_table[bucket] = BF_Block_GetNum(block);
+					memcpy(BF_Block_GetData(block), &new_data, sizeof(Hash_block));
+					counts[bucket] = 0;
+				} else {
+					CALL_BF(BF_GetBlock(handle->file_desc, hash_table[bucket], block), error);
+				}
+
+				update_data(handle, BF_Block_GetData(block), "insert", &rec);
+				counts[bucket]++;
+				BF_Block_SetDirty(block);
+				CALL_BF(BF_UnpinBlock(block), error);
+
+				if (indexed) {
+					moved[moved_num]   = rec;
+					old_ids[moved_num] = block_t;
+					new_ids[moved_num++] = hash_table[bucket];
+				}
+			}
+			block_t = block_data.overf_block;
+		}
+	}
+
+	int dir_blocks = (new_buckets - 1) / BUCKETS_PER_BLOCK(handle->block_size) + 1;
+	if (dir_blocks < handle->last_block_id - handle->dir_block + 1)
+		handle->last_block_id = handle->dir_block + dir_blocks - 1;
+
+	free(handle->hash_table);
+	free(handle->bloom);
+	handle->hash_table = hash_table;
+	handle->bloom = bloom;
+	handle->buckets = new_buckets;
+
+	/* The indexes follow the records once the file holds them in their new blocks */
+	int code = indexed ? update_indexes(handle, moved, moved_num, old_ids, new_ids) : 0;
+
+	BF_Block_Destroy(&block);
+	free(counts);
+	free(moved);
+	free(old_ids);
+	free(new_ids);
+	return code;
+
 	error:
 		BF_Block_Destroy(&block);
+		free(hash_table);
+		free(bloom);
+		free(counts);
+		free(moved);
+		free(old_ids);
+		free(new_ids);
+		return -1;
+}
+
+
+int HT_BulkLoad(Hash_file *handle, Record *recs, int n, bool dedupe, 
+                                                      int *block_ids) 
+{
+	if (read_only(handle) || latched_by_cursor(handle, NULL))
+		return -1;
+
+	pthread_rwlock_wrlock(&handle->latch);
+	int code = HT_Load(handle, recs, n, dedupe, block_ids);
+	pthread_rwlock_unlock(&handle->latch);
+	return code;
+}
+
+static int HT_Load(Hash_file *handle, Record *recs, int n, bool dedupe, int *block_ids) 
+{
+	if (handle->mode != STATIC_HASH) {
+		for (int i = 0; i < n; ++i)
+			if (HT_Insert(handle, recs[i], block_ids != NULL ? &block_ids[i] : NULL) < 0)
+				return -1;
+		return 0;
+	}
+
+	Bucket_entry *entries = sort_by_bucket(handle, recs, n);
+	for (int start = 0, end; start < n; start = end) {
+		for (end = start; end < n && entries[end].bucket == entries[start].bucket; ++end);
+
+		int *room = NULL, room_num = 0;
+		int head = handle->hash_table[entries[start].bucket];
+		int code = dedupe 
+			? dedupe_bucket(handle, entries + start, end - start, &room, &room_num) 
+			: 0;
+
+		if (code == 0)
+			code = dedupe || head == -1
+				? append_records(handle, entries + start, end - start, room, room_num)
+				: append_records(handle, entries + start, end - start, &head, 1);
+		free(room);
+
+		if (code < 0) {
+			free(entries);
+			return -1;
+		}
+	}
+
+	for (int i = 0; block_ids != NULL && i < n; ++i)
+		block_ids[entries[i].rec - recs] = entries[i].block_id;
+
+	free(entries);
+	return 0;
+}
+
+
+int HT_InsertBatch(Hash_file *handle, Record *recs, int n, int *block_ids) 
+{
+	if (read_only(handle) || latched_by_cursor(handle, NULL))
+		return -1;
+
+	pthread_rwlock_wrlock(&handle->latch);
+	int code = HT_LoadBatch(handle, recs, n, block_ids);
+	pthread_rwlock_unlock(&handle->latch);
+	return code;
+}
+
+static int HT_LoadBatch(Hash_file *handle, Record *recs, int n, int *block_ids) 
+{
+	int *ids = block_ids != NULL ? block_ids : malloc((n + 1) * sizeof(int));
+	int new_num = 0;
+
+	/* Splits move records that are already indexed, 
+	 * so extendible files index every record as it goes in */
+	if (handle->mode != STATIC_HASH) {
+		for (int i = 0; i < n; ++i) {
+			int rec_count = handle->rec_count;
+			if (HT_Insert(handle, recs[i], &ids[i]) < 0
+			 || (rec_count < handle->rec_count 
+			  && update_indexes(handle, &recs[i], 1, NULL, &ids[i]) < 0))
+				goto error;
+		}
+		if (block_ids == NULL)
+			free(ids);
+		return 0;
+	}
+
+	Bucket_entry *entries = sort_by_bucket(handle, recs, n);
+	for (int start = 0, end; start < n; start = end) {
+		for (end = start; end < n && entries[end].bucket == entries[start].bucket; ++end);
+
+		int *room = NULL, room_num = 0;
+		int code = dedupe_bucket(handle, entries + start, end - start, &room, &room_num);
+		if (code == 0)
+			code = append_records(handle, entries + start, end - start, room, room_num);
+		free(room);
+
+		if (code < 0) {
+			free(entries);
+			goto error;
+		}
+	}
+
+	Record *new_recs = malloc((n + 1) * sizeof(Record));
+	int *new_ids = malloc((n + 1) * sizeof(int));
+	for (int i = 0; i < n; ++i) {
+		ids[entries[i].rec - recs] = entries[i].block_id;
+		if (!entries[i].skip) {
+			new_recs[new_num] = *entries[i].rec;
+			new_ids[new_num++] = entries[i].block_id;
+		}
+	}
+	free(entries);
+
+	int code = update_indexes(handle, new_recs, new_num, NULL, new_ids);
+	free(new_recs);
+	free(new_ids);
+	if (block_ids == NULL)
+		free(ids);
+	return code;
+
+	error:
+		if (block_ids == NULL)
+			free(ids);
 		return -1;
 }
 
@@ -478,17 +1157,25 @@ static int HT_FindEntry(Hash_file *handle, void *value, Record_pos *rec_pos,
                                                         int *empty_block,
 													    Record *rec) 
 {
-	int bucket = hash_key(get_attr_type(handle->attr), value) % handle->buckets;
+	size_t hash = hash_key(get_attr_type(handle->attr), value);
+	int bucket = hash % handle->buckets;
 	int block_t = handle->hash_table[bucket];
 	bool found = false;
 	Hash_block block_data;
 	BF_Block *block;
 
+	/* Keys missing from the bucket's filter are not in its chain, 
+	 * so inserts only look for room, without comparing keys */
+	bool absent = !bloom_test(BUCKET_BLOOM(handle, bucket), BLOOM_BUCKET_SIZE, hash);
+	if (absent && empty_block == NULL) {
+		if (rec != NULL)
+			rec->id = -1;
+		return 0;
+	}
+
 
-	int offset = get_attr_offset(handle->attr);
-	int size = get_attr_type(handle->attr) == STRING
-		? strlen(value) + 1
-		: get_attr_size(handle->attr);
+	int size = get_value_size(handle->attr, value);
+	uint64_t mask[MATCH_WORDS(handle->rec_capacity)];
 
 	BF_Block_Init(&block);
 	while (block_t != -1) {
@@ -507,18 +1194,26 @@ static int HT_FindEntry(Hash_file *handle, void *value, Record_pos *rec_pos,
 		 && block_data.rec_num != handle->rec_capacity)
 		 	*empty_block = block_t;
 
-		data += sizeof(Hash_block);
-		for (int i = 0; i < block_data.rec_num; i++, data += sizeof(Record)) {
-			if (memcmp(data + offset, value, size) == 0) {
-				found = true;
-				if (rec_pos != NULL) {
-					rec_pos->block_id = block_t;
-					rec_pos->pos = i;
-				}
-				if (rec != NULL)
-					memcpy(rec, data, sizeof(Record));
+		if (absent) {
+			CALL_BF(BF_UnpinBlock(block), error);
+			if (*empty_block >= 0)
 				break;
+			block_t = block_data.overf_block;
+			continue;
+		}
+
+		match_keys(handle, data, block_data.rec_num, value, size, mask);
+		data = HT_RECORDS(handle, data);
+
+		int i = match_next(mask, 0, block_data.rec_num);
+		if (i < block_data.rec_num) {
+			found = true;
+			if (rec_pos != NULL) {
+				rec_pos->block_id = block_t;
+				rec_pos->pos = i;
 			}
+			if (rec != NULL)
+				get_block_record(data, handle->layout, handle->rec_capacity, i, rec);
 		}
 		CALL_BF(BF_UnpinBlock(block), error);
 		if (found) {
@@ -539,7 +1234,377 @@ static int HT_FindEntry(Hash_file *handle, void *value, Record_pos *rec_pos,
 		return -1;
 }
 
-static void update_data(char *data, char *action, void *value) 
+static int HT_SplitBucket(Hash_file *handle, void *value) 
+{
+	attr_type type = get_attr_type(handle->attr);
+	int bucket = hash_key(type, value) % handle->buckets;
+	int old_block = handle->hash_table[bucket];
+	Record recs[handle->rec_capacity], moved_recs[handle->rec_capacity];
+	int old_ids[handle->rec_capacity], new_ids[handle->rec_capacity];
+	Hash_block old_data, new_data;
+	BF_Block *block, *new_block;
+	int new_id;
+
+	BF_Block_Init(&block);
+	BF_Block_Init(&new_block);
+	CALL_BF(BF_GetBlock(handle->file_desc, old_block, block), error);
+	char *data = BF_Block_GetData(block);
+	memcpy(&old_data, data, sizeof(Hash_block));
+
+	int depth = old_data.local_depth;
+	if (depth == handle->global_depth) {
+		if (handle->global_depth == MAX_GLOBAL_DEPTH) {
+			CALL_BF(BF_UnpinBlock(block), error);
+			BF_Block_Destroy(&block);
+			BF_Block_Destroy(&new_block);
+			return 0;
+		}
+		/* Nothing changes until both arrays have grown, so a failed doubling 
+		 * leaves the directory as it was */
+		int *hash_table = realloc(handle->hash_table, 2 * handle->buckets * sizeof(int));
+		if (hash_table == NULL)
+			goto unpin;
+		handle->hash_table = hash_table;
+
+		unsigned char *bloom = realloc(handle->bloom, 2 * handle->buckets * BLOOM_BUCKET_SIZE);
+		if (bloom == NULL)
+			goto unpin;
+		handle->bloom = bloom;
+
+		memcpy(
+			handle->hash_table + handle->buckets, 
+			handle->hash_table, 
+			handle->buckets * sizeof(int)
+		);
+		/* The keys of a bucket are split between its two halves, 
+		 * so both start from a copy of its filter */
+		memcpy(
+			BUCKET_BLOOM(handle, handle->buckets), 
+			handle->bloom, 
+			handle->buckets * BLOOM_BUCKET_SIZE
+		);
+		handle->buckets *= 2;
+		handle->global_depth++;
+	}
+
+	CALL_BF(BF_AllocateBlock(handle->file_desc, new_block), unpin);
+	CALL_BF(BF_GetBlockCounter(handle->file_desc, &new_id), unpin_both);
+	--new_id;
+
+	for (int i = 0; i < old_data.rec_num; ++i)
+		get_block_record(HT_RECORDS(handle, data), handle->layout, handle->rec_capacity, i, 
+		                                                                            &recs[i]);
+	new_data = (Hash_block) { .rec_num = 0, .overf_block = -1, .local_depth = depth + 1 };
+	int rec_num = old_data.rec_num;
+	old_data.rec_num = 0;
+	old_data.local_depth = depth + 1;
+	memcpy(data, &old_data, sizeof(Hash_block));
+	memcpy(BF_Block_GetData(new_block), &new_data, sizeof(Hash_block));
+
+	int moved_num = 0;
+	for (int i = 0; i < rec_num; ++i) {
+		size_t hash = hash_key(type, get_rec_member(&recs[i], handle->attr));
+		bool moved = (hash >> depth) & 1;
+		update_data(handle, moved ? BF_Block_GetData(new_block) : data, "insert", &recs[i]);
+		if (moved) {
+			moved_recs[moved_num] = recs[i];
+			old_ids[moved_num] = old_block;
+			new_ids[moved_num++] = new_id;
+		}
+	}
+	if (moved_num > 0 && update_indexes(handle, moved_recs, moved_num, old_ids, new_ids) < 0)
+		goto unpin_both;
+
+	for (int i = bucket & ((1 << depth) - 1); i < handle->buckets; i += 1 << depth)
+		if ((i >> depth) & 1)
+			handle->hash_table[i] = new_id;
+
+	BF_Block_SetDirty(block);
+	BF_Block_SetDirty(new_block);
+	CALL_BF(BF_UnpinBlock(new_block), unpin);
+	CALL_BF(BF_UnpinBlock(block), error);
+	BF_Block_Destroy(&block);
+	BF_Block_Destroy(&new_block);
+	return 1;
+
+	unpin_both:
+		BF_UnpinBlock(new_block);
+	unpin:
+		BF_UnpinBlock(block);
+	error:
+		BF_Block_Destroy(&block);
+		BF_Block_Destroy(&new_block);
+		return -1;
+}
+
+/* Moves recs from old_ids to new_ids in every index of the file, opening each 
+ * index once. A NULL array leaves that side out, for inserts and deletes */
+static int update_indexes(Hash_file *handle, Record *recs, int n, int *old_ids, 
+                                                                   int *new_ids) 
+{
+	for (rec_attr attr_ = NAME; attr_ <= CITY; ++attr_) {
+		if (!strcmp("", handle->index_files[attr_ - 1].filename))
+			continue;
+
+		pthread_mutex_lock(&file_map_lock);
+		Map_tuple tuple = hash_map_value(
+			file_map, 
+			handle->index_files[attr_ - 1].filename
+		);
+		pthread_mutex_unlock(&file_map_lock);
+
+		SHash_file *shandle = tuple != NULL
+			? (SHash_file*)map_tuple_value(tuple)
+			: SHT_OpenFile(handle->index_files[attr_ - 1].filename);
+
+		if (shandle == NULL)
+			return -1;
+
+		int code = 0;
+		if (old_ids != NULL)
+			code = SHT_DeleteBatch(shandle, recs, n, old_ids);
+
+		if (code == 0 && new_ids != NULL)
+			code = SHT_InsertBatch(shandle, recs, n, new_ids);
+
+		if (tuple == NULL && SHT_CloseFile(shandle) < 0)
+			return -1;
+
+		if (code < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* Merges the runs between consecutive bounds into out, 
+ * or passes the records to visit if out is NULL */
+static int merge_runs(FILE *runs, long *bounds, int runs_num, rec_attr attr, 
+                                                              FILE *out, 
+                                                              Record_visit visit, 
+                                                              void *arg) 
+{
+	Run_reader *readers = malloc(runs_num * sizeof(Run_reader));
+	int code = 0, offset = get_attr_offset(attr);
+
+	for (int i = 0; i < runs_num; ++i) {
+		readers[i] = (Run_reader) { .next = bounds[i], .end = bounds[i + 1] };
+		if (!read_run(runs, &readers[i]))
+			goto error;
+	}
+
+	while (!code) {
+		Run_reader *min = NULL;
+		for (int i = 0; i < runs_num; ++i) {
+			Run_reader *reader = &readers[i];
+			if (reader->pos < reader->size && (min == NULL 
+			 || compare_keys((char*)&reader->buffer[reader->pos] + offset, 
+			                 (char*)&min->buffer[min->pos] + offset, attr) < 0))
+				min = reader;
+		}
+		if (min == NULL)
+			break;
+
+		Record *rec = &min->buffer[min->pos++];
+		if (out != NULL && fwrite(rec, sizeof(Record), 1, out) != 1)
+			goto error;
+		if (out == NULL)
+			code = visit(rec, arg);
+
+		if (min->pos == min->size && !read_run(runs, min))
+			goto error;
+	}
+	free(readers);
+	return code;
+
+	error:
+		free(readers);
+		return -1;
+}
+
+static bool read_run(FILE *runs, Run_reader *reader) 
+{
+	long count = reader->end - reader->next;
+	reader->pos = 0;
+	reader->size = count < MERGE_RECORDS ? count : MERGE_RECORDS;
+	if (reader->size == 0)
+		return true;
+
+	if (fseek(runs, reader->next * sizeof(Record), SEEK_SET) < 0
+	 || fread(reader->buffer, sizeof(Record), reader->size, runs) != reader->size)
+		return false;
+
+	reader->next += reader->size;
+	return true;
+}
+
+static int compare_records(const void *a, const void *b, void *attr) 
+{
+	rec_attr attr_ = *(rec_attr*)attr;
+	return compare_keys(
+		get_rec_member((Record*)a, attr_), 
+		get_rec_member((Record*)b, attr_), 
+		attr_
+	);
+}
+
+/* Orders records by bucket and then by key, 
+ * so each bucket's records form a sorted run */
+static Bucket_entry *sort_by_bucket(Hash_file *handle, Record *recs, int n) 
+{
+	Bucket_entry *entries = malloc((n + 1) * sizeof(Bucket_entry));
+	for (int i = 0; i < n; ++i) {
+		void *value = get_rec_member(&recs[i], handle->attr);
+		entries[i] = (Bucket_entry) {
+			.bucket = hash_key(get_attr_type(handle->attr), value) % handle->buckets,
+			.block_id = -1,
+			.skip = false,
+			.rec = &recs[i]
+		};
+	}
+	qsort_r(entries, n, sizeof(Bucket_entry), compare_entries, handle);
+	return entries;
+}
+
+static int compare_entries(const void *a, const void *b, void *handle) 
+{
+	const Bucket_entry *a_ = a, *b_ = b;
+	rec_attr attr = ((Hash_file*)handle)->attr;
+
+	if (a_->bucket != b_->bucket)
+		return a_->bucket - b_->bucket;
+
+	int code = compare_keys(
+		get_rec_member(a_->rec, attr), 
+		get_rec_member(b_->rec, attr), 
+		attr
+	);
+	return code != 0 ? code : (a_->rec > b_->rec) - (a_->rec < b_->rec);
+}
+
+/* Marks repeated keys of the run and keys already in the bucket's chain, 
+ * walking the chain once instead of once per record. Blocks of the chain 
+ * with free slots are collected in room */
+static int dedupe_bucket(Hash_file *handle, Bucket_entry *entries, int count, 
+                                                                int **room, 
+                                                                int *room_num) 
+{
+	Hash_block block_data;
+	BF_Block *block;
+
+	for (int i = 1; i < count; ++i)
+		entries[i].skip = !compare_keys(
+			get_rec_member(entries[i - 1].rec, handle->attr),
+			get_rec_member(entries[i].rec, handle->attr),
+			handle->attr
+		);
+
+	BF_Block_Init(&block);
+	int block_t = handle->hash_table[entries[0].bucket];
+	while (block_t != -1) {
+		CALL_BF(BF_GetBlock(handle->file_desc, block_t, block), error);
+		char *data = BF_Block_GetData(block);
+		memcpy(&block_data, data, sizeof(Hash_block));
+		data = HT_RECORDS(handle, data);
+
+		if (block_data.rec_num < handle->rec_capacity) {
+			*room = realloc(*room, (*room_num + 1) * sizeof(int));
+			(*room)[(*room_num)++] = block_t;
+		}
+
+		for (int i = 0; i < block_data.rec_num; i++) {
+			void *key = get_block_member(data, handle->layout, handle->rec_capacity, i, 
+			                                                                       handle->attr);
+			int low = 0, high = count - 1;
+			while (low <= high) {
+				int mid = (low + high) / 2;
+				int code = compare_keys(
+					key, 
+					get_rec_member(entries[mid].rec, handle->attr), 
+					handle->attr
+				);
+				if (code == 0) {
+					while (mid > 0 && !compare_keys(key, 
+						get_rec_member(entries[mid - 1].rec, handle->attr), handle->attr))
+						mid--;
+					entries[mid].skip = true;
+					entries[mid].block_id = block_t;
+					break;
+				}
+				if (code < 0)
+					high = mid - 1;
+				else
+					low = mid + 1;
+			}
+		}
+		block_t = block_data.overf_block;
+		CALL_BF(BF_UnpinBlock(block), error);
+	}
+	BF_Block_Destroy(&block);
+	return 0;
+
+	error:
+		BF_Block_Destroy(&block);
+		return -1;
+}
+
+/* Writes the unmarked records of a run into the given blocks of the 
+ * bucket's chain and then prepends as many full blocks as still needed */
+static int append_records(Hash_file *handle, Bucket_entry *entries, int count, 
+                                                                 int *room, 
+                                                                 int room_num) 
+{
+	int bucket = entries[0].bucket;
+	int done = 0, rec_num = 0, block_t;
+	BF_Block *block;
+
+	while (done < count && entries[done].skip)
+		done++;
+
+	BF_Block_Init(&block);
+	for (int i = 0; done < count; ++i) {
+		if (i < room_num) {
+			block_t = room[i];
+			CALL_BF(BF_GetBlock(handle->file_desc, block_t, block), error);
+			memcpy(&rec_num, BF_Block_GetData(block), sizeof_field(Hash_block, rec_num));
+		} else {
+			Hash_block block_data = {
+				.rec_num = 0,
+				.overf_block = handle->hash_table[bucket]
+			};
+			CALL_BF(BF_AllocateBlock(handle->file_desc, block), error);
+			CALL_BF(BF_GetBlockCounter(handle->file_desc, &handle->hash_table[bucket]), unpin);
+			block_t = --handle->hash_table[bucket];
+			memcpy(BF_Block_GetData(block), &block_data, sizeof(Hash_block));
+			rec_num = 0;
+		}
+
+		for (; rec_num < handle->rec_capacity && done < count; rec_num++) {
+			void *value = get_rec_member(entries[done].rec, handle->attr);
+			bloom_add(BUCKET_BLOOM(handle, bucket), BLOOM_BUCKET_SIZE, 
+			          hash_key(get_attr_type(handle->attr), value));
+			update_data(handle, BF_Block_GetData(block), "insert", entries[done].rec);
+			entries[done].block_id = block_t;
+			handle->rec_count++;
+			while (++done < count && entries[done].skip);
+		}
+		BF_Block_SetDirty(block);
+		CALL_BF(BF_UnpinBlock(block), error);
+	}
+	BF_Block_Destroy(&block);
+
+	for (int i = 1; i < count; ++i)
+		if (entries[i].block_id < 0)
+			entries[i].block_id = entries[i - 1].block_id;
+	return 0;
+
+	unpin:
+		BF_UnpinBlock(block);
+	error:
+		BF_Block_Destroy(&block);
+		return -1;
+}
+
+static void update_data(Hash_file *handle, char *data, char *action, void *value) 
 {
 	int rec_num, new;
 	bool is_delete = !strcmp(action, "delete");
@@ -557,43 +1622,166 @@ static void update_data(char *data, char *action, void *value)
 		sizeof_field(Hash_block, rec_num)
 	);
 	
-	int offset = is_delete ? *(int*)value : rec_num;
-	data += offset * sizeof(Record) + sizeof(Hash_block);
+	unsigned char *fingerprints = HT_FINGERPRINTS(data);
+	data = HT_RECORDS(handle, data);
+	if (!is_delete) {
+		fingerprints[rec_num] = key_fingerprint(
+			get_attr_type(handle->attr), 
+			get_rec_member(value, handle->attr)
+		);
+		set_block_record(data, handle->layout, handle->rec_capacity, rec_num, value);
+	} else {
+		int pos = *(int*)value;
+		memmove(fingerprints + pos, fingerprints + pos + 1, rec_num - pos - 1);
+		remove_block_record(data, handle->layout, handle->rec_capacity, pos, rec_num);
+	}
+}
+
+/* Sets the mask bits of the records whose primary key equals value. 
+ * Only records with the key's fingerprint have their keys compared */
+static void match_keys(Hash_file *handle, char *data, int rec_num, void *value, 
+                                                                   int size, 
+                                                                   uint64_t *mask) 
+{
+	unsigned char fingerprint = key_fingerprint(get_attr_type(handle->attr), value);
+	char *records = HT_RECORDS(handle, data);
+
+	match_bytes(HT_FINGERPRINTS(data), rec_num, fingerprint, mask);
+	for (int i = match_next(mask, 0, rec_num); i < rec_num; i = match_next(mask, i + 1, rec_num)) {
+		void *key = get_block_member(records, handle->layout, handle->rec_capacity, i, 
+		                                                                          handle->attr);
+		if (memcmp(key, value, size) != 0)
+			mask[i / 64] &= ~((uint64_t)1 << i % 64);
+	}
+}
+
 
-	if (!is_delete)
-		memcpy(data, value, sizeof(Record));
+static size_t hash_filename(void *key) 
+{
+	return hash_key(STRING, key);
+}
+
+static bool read_only(Hash_file *handle) 
+{
+	if (handle->read_only)
+		fprintf(stderr, "Error! The file was opened read-only\n");
+	return handle->read_only;
+}
+
+/* Asks for the head blocks of the next READ_AHEAD buckets, every READ_AHEAD / 2 buckets. 
+ * Overflow blocks are only known once their predecessor is read */
+static void read_ahead(HT_Scan *scan) 
+{
+	Hash_file *handle = scan->handle;
+	int blocks[READ_AHEAD], n = 0;
+	for (int bucket = scan->bucket + 1; bucket < handle->buckets && n < READ_AHEAD; ++bucket) {
+		int head = __atomic_load_n(&handle->hash_table[bucket], __ATOMIC_RELAXED);
+		if (HT_BucketHead(handle, bucket) && head > 0)
+			blocks[n++] = head;
+	}
+	BF_Prefetch(handle->file_desc, blocks, n);
+}
+
+/* Takes the file latch, shared unless whole_file is set, and then the latch of the 
+ * value's bucket. Buckets share HT_LATCHES latches, picked by bucket number */
+static int latch_bucket(Hash_file *handle, void *value, bool write, bool whole_file) 
+{
+	if (whole_file) {
+		pthread_rwlock_wrlock(&handle->latch);
+		return -1;
+	}
+
+	pthread_rwlock_rdlock(&handle->latch);
+	int latch = bucket_latch(handle, value);
+	if (write)
+		pthread_rwlock_wrlock(&handle->bucket_latches[latch]);
 	else
-		memmove(
-			data,
-			data + sizeof(Record),
-			(rec_num - offset - 1) * sizeof(Record) 
-		);
+		pthread_rwlock_rdlock(&handle->bucket_latches[latch]);
+	return latch;
 }
 
+/* Extendible buckets may split, which changes the directory, and SHT cursors 
+ * read the blocks of indexed files under the shared file latch, so writers of 
+ * either latch the whole file. Indexes are only added under the exclusive file 
+ * latch, so they are looked up once the shared one is held */
+static int latch_writer(Hash_file *handle, void *value) 
+{
+	if (handle->mode != EXTENDIBLE_HASH) {
+		int latch = latch_bucket(handle, value, true, false);
+		if (!has_indexes(handle))
+			return latch;
+		unlatch_bucket(handle, latch);
+	}
+	return latch_bucket(handle, value, true, true);
+}
 
-static size_t hash_ints(const void *key) 
+static int bucket_latch(Hash_file *handle, void *value) 
 {
-    size_t value = *(int*)key;
-    value = ((value >> 16) ^ value) * 0x45d9f3b;
-    value = ((value >> 16) ^ value) * 0x45d9f3b;
-    value = ((value >> 16) ^ value);
-    return value;
+	return hash_key(get_attr_type(handle->attr), value) % handle->buckets % HT_LATCHES;
 }
 
-static size_t hash_strings(const void *key) 
+/* A thread would wait forever on a latch its own cursor holds, so its writes 
+ * that need one are refused. Writes with no value need the whole file. The 
+ * cursor holds the file latch shared, so the directory cannot change meanwhile */
+static bool latched_by_cursor(Hash_file *handle, void *value) 
 {
-    size_t hash = 5381;
-    size_t c;
-    char *s = (char*)key;
-    while ((c = *s++))
-        hash = ((hash << 5) + hash) + c;
-    return hash;
+	for (Cursor_latch *cursor = cursor_latches; cursor != NULL; cursor = cursor->next) {
+		if (cursor->handle != handle)
+			continue;
+		if (value == NULL || handle->mode == EXTENDIBLE_HASH || has_indexes(handle)
+		 || (cursor->latch != NULL && *cursor->latch == bucket_latch(handle, value))) {
+			fprintf(stderr, "Error! The file is latched by an open cursor of this thread\n");
+			return true;
+		}
+	}
+	return false;
 }
 
-size_t hash_key(attr_type type, const void *key) 
+static void hold_cursor(Cursor_latch *cursor) 
 {
-    return type == INT ? hash_ints(key) : hash_strings(key);
+	cursor->next = cursor_latches;
+	cursor_latches = cursor;
 }
 
+static void release_cursor(Cursor_latch *cursor) 
+{
+	Cursor_latch **link = &cursor_latches;
+	while (*link != cursor)
+		link = &(*link)->next;
+	*link = cursor->next;
+}
 
+/* Moves a reader holding the file latch to the latch of another bucket */
+static int switch_bucket(Hash_file *handle, int latch, int bucket) 
+{
+	int next = bucket % HT_LATCHES;
+	if (next == latch)
+		return latch;
+
+	if (latch != -1)
+		pthread_rwlock_unlock(&handle->bucket_latches[latch]);
+	pthread_rwlock_rdlock(&handle->bucket_latches[next]);
+	return next;
+}
 
+static void unlatch_bucket(Hash_file *handle, int latch) 
+{
+	if (latch != -1)
+		pthread_rwlock_unlock(&handle->bucket_latches[latch]);
+	pthread_rwlock_unlock(&handle->latch);
+}
+
+static bool has_indexes(Hash_file *handle) 
+{
+	for (int i = 0; i < INDEX_ATTR; ++i)
+		if (strcmp(handle->index_files[i].filename, ""))
+			return true;
+	return false;
+}
+
+static void destroy_latches(Hash_file *handle) 
+{
+	pthread_rwlock_destroy(&handle->latch);
+	for (int i = 0; i < HT_LATCHES; ++i)
+		pthread_rwlock_destroy(&handle->bucket_latches[i]);
+}
@@ -1,16 +1,48 @@
 #include "heap_file.h"
 
-#define RECORDS_CAPACITY (BF_BLOCK_SIZE - sizeof(int)) / sizeof(Record)
-
-
-static int HP_FindEntry(Heap_file *handle, void *value, Record_pos *rec_pos, int *empty_block);
-static void update_data(char *data, char *action, void *value);
+#define RECORDS_CAPACITY(block_size) ((block_size) - sizeof(int)) / sizeof(Record)
+#define HP_INFO_SIZE offsetof(Heap_file, free_map)
+#define MAP_SIZE(handle) ((handle)->last_block_id / 8 + 1)
+#define MAP_BLOCKS(handle) ((MAP_SIZE(handle) - 1) / (handle)->block_size + 1)
+#define BLOOM_BITS_PER_KEY 10
+#define BLOOM_MIN_SIZE 64
+#define BLOOM_KEYS(size) ((size) * 8 / BLOOM_BITS_PER_KEY)
+#define READ_AHEAD 16
+
+
+static Heap_file *HP_Open(const char *filename, bool key_index, bool mapped);
+static bool read_only(Heap_file *handle);
+static int HP_FindEntry(Heap_file *handle, void *value, Record_pos *rec_pos);
+static int HP_NewBlock(Heap_file *handle, BF_Block *block);
+static int HP_FreeBlock(Heap_file *handle);
+static void set_free(Heap_file *handle, int block_id, int rec_num);
+static int load_free_map(Heap_file *handle);
+static int write_tail(Heap_file *handle, int first_block, unsigned char *data, int size);
+static int load_bloom(Heap_file *handle);
+static int build_bloom(Heap_file *handle, int keys);
+static void add_key(Heap_file *handle, void *value);
+static int build_key_index(Heap_file *handle);
+static void index_insert(Heap_file *handle, void *value, int block_id, int pos);
+static void index_shift(Heap_file *handle, char *data, int pos);
+static int compare_int_keys(void *a, void *b);
+static size_t hash_int_keys(void *key);
+static size_t hash_string_keys(void *key);
+static int compare_records(const void *a, const void *b, void *attr);
+static int write_records(Heap_file *handle, Record **sorted, int n, int *room, 
+                                                                    int room_num);
+static void update_data(Heap_file *handle, char *data, char *action, void *value);
+static void read_ahead(HP_Scan *scan);
 
 
 int HP_CreateFile(const char *filename, rec_attr attr) 
+{
+	return HP_CreateFileEx(filename, attr, ROW_LAYOUT, BF_BLOCK_SIZE);
+}
+
+int HP_CreateFileEx(const char *filename, rec_attr attr, rec_layout layout, int block_size) 
 {
 	int fd;
-	CALL_BF(BF_CreateFile(filename), error);
+	CALL_BF(BF_CreateFileEx(filename, block_size), error);
 	CALL_BF(BF_OpenFile(filename, &fd), delete_file);
 
 	BF_Block *block;
@@ -19,16 +51,18 @@ int HP_CreateFile(const char *filename, rec_attr attr)
 	CALL_BF(BF_AllocateBlock(fd, block), bf_cleanup);
 
 	Heap_file handle = {
-		.rec_capacity = RECORDS_CAPACITY,
+		.block_size   = block_size,
+		.rec_capacity = RECORDS_CAPACITY(block_size),
 		.attr         = attr,
+		.layout       = layout,
 		.file_type    = "heap" 
 	};
 	
 	COPY(
 		&handle, 
 		BF_Block_GetData(block), 
-		sizeof(handle), 
-		BF_BLOCK_SIZE
+		HP_INFO_SIZE, 
+		block_size
 	);
 
 	BF_Block_SetDirty(block);
@@ -50,9 +84,25 @@ int HP_CreateFile(const char *filename, rec_attr attr)
 }
 
 Heap_file *HP_OpenFile(const char *filename) 
+{
+	return HP_OpenFileEx(filename, false);
+}
+
+Heap_file *HP_OpenFileEx(const char *filename, bool key_index) 
+{
+	return HP_Open(filename, key_index, false);
+}
+
+/* Blocks are read straight from the mapped file, which is never written */
+Heap_file *HP_OpenFileMapped(const char *filename) 
+{
+	return HP_Open(filename, false, true);
+}
+
+static Heap_file *HP_Open(const char *filename, bool key_index, bool mapped) 
 {
 	int fd;
-	CALL_BF(BF_OpenFile(filename, &fd), error);
+	CALL_BF(mapped ? BF_OpenFileMapped(filename, &fd) : BF_OpenFile(filename, &fd), error);
 
 	BF_Block *block;
 	BF_Block_Init(&block);
@@ -70,10 +120,31 @@ Heap_file *HP_OpenFile(const char *filename)
 	}
 
 	Heap_file *handle = malloc(sizeof(*handle));
-	memcpy(handle, data, sizeof(*handle));
+	memcpy(handle, data, HP_INFO_SIZE);
 	handle->file_desc = fd;
+	handle->key_index = NULL;
+	handle->read_only = mapped;
 	
 	BF_Block_Destroy(&block);
+	if (load_free_map(handle) < 0) {
+		free(handle);
+		CALL_BF(BF_CloseFile(fd), error);
+		goto error;
+	}
+	if (load_bloom(handle) < 0) {
+		free(handle->free_map);
+		free(handle->bloom);
+		free(handle);
+		CALL_BF(BF_CloseFile(fd), error);
+		goto error;
+	}
+	if (key_index && build_key_index(handle) < 0) {
+		free(handle->free_map);
+		free(handle->bloom);
+		free(handle);
+		CALL_BF(BF_CloseFile(fd), error);
+		goto error;
+	}
 	return handle;
 
 	bf_cleanup:
@@ -89,6 +160,17 @@ int HP_CloseFile(Heap_file *handle)
 	BF_Block *block;
 	BF_Block_Init(&block);
 
+	/* Files opened read-only are left as they were found */
+	if (handle->read_only)
+		goto close_file;
+
+	/* The map and then the filter live in the blocks after the last data block, 
+	 * which are handed out again as data blocks when the file grows */
+	if (write_tail(handle, handle->last_block_id + 1, handle->free_map, MAP_SIZE(handle)) < 0
+	 || write_tail(handle, handle->last_block_id + 1 + MAP_BLOCKS(handle), handle->bloom, 
+	                                                                       handle->bloom_size) < 0)
+		goto bf_cleanup;
+
 	CALL_BF(BF_GetBlock(handle->file_desc, 0, block), bf_cleanup);
 	char *data = BF_Block_GetData(block);
 
@@ -104,12 +186,29 @@ int HP_CloseFile(Heap_file *handle)
 		sizeof_field(Heap_file, rec_count)
 	);
 
+	memcpy(
+		data + offsetof(Heap_file, bloom_size),
+		&handle->bloom_size, 
+		sizeof_field(Heap_file, bloom_size)
+	);
+
+	memcpy(
+		data + offsetof(Heap_file, bloom_keys),
+		&handle->bloom_keys, 
+		sizeof_field(Heap_file, bloom_keys)
+	);
+
 
 	BF_Block_SetDirty(block);
 	CALL_BF(BF_UnpinBlock(block), bf_cleanup);
-	BF_Block_Destroy(&block);
 
+	close_file:
+	BF_Block_Destroy(&block);
 	CALL_BF(BF_CloseFile(handle->file_desc), error);
+	if (handle->key_index != NULL)
+		hash_map_destroy(handle->key_index);
+	free(handle->free_map);
+	free(handle->bloom);
 	free(handle);
 	return 0;
 
@@ -119,6 +218,10 @@ int HP_CloseFile(Heap_file *handle)
 		CALL_BF(BF_CloseFile(handle->file_desc), error);
 
 	error:
+		if (handle->key_index != NULL)
+			hash_map_destroy(handle->key_index);
+		free(handle->free_map);
+		free(handle->bloom);
 		free(handle);
 		return -1;
 }
@@ -127,24 +230,22 @@ int HP_CloseFile(Heap_file *handle)
 
 int HP_InsertEntry(Heap_file *handle, Record rec) 
 {
+	if (read_only(handle))
+		return -1;
+
 	BF_Block *block;
-	int empty_block = -1;
 	Record_pos rec_pos = { .block_id = -1 };
 	void *value = get_rec_member(&rec, handle->attr);
 
-	if (HP_FindEntry(handle, value, &rec_pos, &empty_block))
+	if (HP_FindEntry(handle, value, &rec_pos))
 		return rec_pos.block_id < 0 ? -1 : 0;
 
 	BF_Block_Init(&block);
+	int empty_block = HP_FreeBlock(handle);
 	if (empty_block < 0) {
-		CALL_BF(
-			BF_AllocateBlock(
-				handle->file_desc, 
-				block
-			), 
-			bf_cleanup
-		);
-		handle->last_block_id++;
+		if (HP_NewBlock(handle, block) < 0)
+			goto bf_cleanup;
+		empty_block = handle->last_block_id;
 	} else {
 		CALL_BF(
 			BF_GetBlock(
@@ -156,16 +257,24 @@ int HP_InsertEntry(Heap_file *handle, Record rec)
 		);
 	}
 	update_data(
+		handle,
 		BF_Block_GetData(block), 
 		"insert", 
 		&rec
 	);
+	set_free(handle, empty_block, *(int*)BF_Block_GetData(block));
+	index_insert(handle, value, empty_block, *(int*)BF_Block_GetData(block) - 1);
+	add_key(handle, value);
 	
 	BF_Block_SetDirty(block);
 	CALL_BF(BF_UnpinBlock(block), bf_cleanup);
 	BF_Block_Destroy(&block);
 
+	/* A filter holding more keys than it was sized for is rebuilt twice as large. 
+	 * Deleted keys stay in it, so it counts every key added since it was built */
 	handle->rec_count++;
+	if (handle->bloom_keys > BLOOM_KEYS(handle->bloom_size))
+		return build_bloom(handle, 2 * handle->rec_count);
 	return 0;
 
 	bf_cleanup:
@@ -173,13 +282,115 @@ int HP_InsertEntry(Heap_file *handle, Record rec)
 		return -1;
 }
 
+int HP_BulkLoad(Heap_file *handle, Record *recs, int n) 
+{
+	if (read_only(handle))
+		return -1;
+
+	int rec_num, *room = NULL, room_num = 0, kept = 0;
+	Record **sorted = malloc((n + 1) * sizeof(Record*));
+
+	for (int i = 0; i < n; ++i)
+		sorted[i] = &recs[i];
+	qsort_r(sorted, n, sizeof(Record*), compare_records, &handle->attr);
+
+	/* Repeated keys keep their first record, like consecutive inserts would */
+	for (int i = 0; i < n; ++i)
+		if (i == 0 || compare_keys(get_rec_member(sorted[kept - 1], handle->attr), 
+		                           get_rec_member(sorted[i], handle->attr), 
+		                           handle->attr))
+			sorted[kept++] = sorted[i];
+
+	bool *stored = calloc(kept + 1, sizeof(bool));
+	for (int i = 1; i <= handle->last_block_id; i++) {
+		if (handle->free_map[i / 8] & 1 << i % 8) {
+			room = realloc(room, (room_num + 1) * sizeof(int));
+			room[room_num++] = i;
+		}
+	}
+
+	for (int i = 0; handle->key_index != NULL && i < kept; ++i)
+		stored[i] = hash_map_value(
+			handle->key_index, 
+			get_rec_member(sorted[i], handle->attr)
+		) != NULL;
+
+	/* The scan is skipped when the filter has seen none of the keys */
+	bool probe = false;
+	for (int i = 0; handle->key_index == NULL && i < kept && !probe; ++i)
+		probe = bloom_test(
+			handle->bloom, 
+			handle->bloom_size, 
+			hash_key(get_attr_type(handle->attr), get_rec_member(sorted[i], handle->attr))
+		);
+
+	BF_Block *block;
+	BF_Block_Init(&block);
+
+	/* Without a key index one scan drops the keys already stored */
+	for (int i = 1; probe && i <= handle->last_block_id; i++) {
+		CALL_BF(BF_GetBlock(handle->file_desc, i, block), bf_cleanup);
+		char *data = BF_Block_GetData(block);
+		memcpy(&rec_num, data, sizeof(int));
+
+		data += sizeof(int);
+		for (int j = 0; j < rec_num; j++) {
+			void *key = get_block_member(data, handle->layout, handle->rec_capacity, j, 
+			                                                                       handle->attr);
+			int low = 0, high = kept - 1;
+			while (low <= high) {
+				int mid = (low + high) / 2;
+				int code = compare_keys(
+					key, 
+					get_rec_member(sorted[mid], handle->attr), 
+					handle->attr
+				);
+				if (code == 0) {
+					stored[mid] = true;
+					break;
+				}
+				if (code < 0)
+					high = mid - 1;
+				else
+					low = mid + 1;
+			}
+		}
+		CALL_BF(BF_UnpinBlock(block), bf_cleanup);
+	}
+	BF_Block_Destroy(&block);
+
+	int new_num = 0;
+	for (int i = 0; i < kept; ++i)
+		if (!stored[i])
+			sorted[new_num++] = sorted[i];
+
+	int code = write_records(handle, sorted, new_num, room, room_num);
+	if (code == 0 && handle->bloom_keys > BLOOM_KEYS(handle->bloom_size))
+		code = build_bloom(handle, 2 * handle->rec_count);
+
+	free(sorted);
+	free(stored);
+	free(room);
+	return code;
+
+	bf_cleanup:
+		BF_Block_Destroy(&block);
+		free(sorted);
+		free(stored);
+		free(room);
+		return -1;
+}
+
 int HP_DeleteEntry(Heap_file *handle, void *value) 
 {
+	if (read_only(handle))
+		return -1;
+
 	int code;
 	BF_Block *block;
 	Record_pos rec_pos = { .block_id = -1 };
 
-	if ((code = HP_FindEntry(handle, value, &rec_pos, NULL)) <= 0) 
+	if ((code = HP_FindEntry(handle, value, &rec_pos)) <= 0) 
 		return code;
 
 	BF_Block_Init(&block);
@@ -193,10 +404,15 @@ int HP_DeleteEntry(Heap_file *handle, void *value)
 	);
 
 	update_data(
+		handle,
 		BF_Block_GetData(block), 
 		"delete", 
 		&rec_pos.pos
 	);
+	set_free(handle, rec_pos.block_id, *(int*)BF_Block_GetData(block));
+	index_shift(handle, BF_Block_GetData(block), rec_pos.pos);
+	if (handle->key_index != NULL)
+		hash_map_delete(handle->key_index, value);
 	
 	BF_Block_SetDirty(block);
 	CALL_BF(BF_UnpinBlock(block), bf_cleanup);
@@ -216,56 +432,7 @@ int HP_DeleteEntry(Heap_file *handle, void *value)
 
 int HP_GetAllEntries(Heap_file *handle, rec_attr attr, void *value, Dl_list records) 
 {
-
-	if (handle->attr == attr) {
-		Record tmp = { .id = -1 };
-		int code = HP_GetEntry(handle, value, &tmp);
-
-		if (code < 0 || tmp.id < 0)
-			return code < 0 ? -1 : 0;
-
-		Record *rec = malloc(sizeof(*rec));
-		list_insert(records, memcpy(rec, &tmp, sizeof(*rec)));
-		return 0;
-	}
-
-	int rec_num = 0;
-	int offset = get_attr_offset(attr);
-	int size = get_attr_type(attr) == STRING 
-		? strlen(value) + 1
-		: get_attr_size(attr);
-
-
-	BF_Block *block;
-	BF_Block_Init(&block);
-	for (int i = 1; i <= handle->last_block_id; i++) {
-		CALL_BF(
-			BF_GetBlock(
-				handle->file_desc, 
-				i, 
-				block
-			), 
-			bf_cleanup
-		);
-		
-		char *data = BF_Block_GetData(block);
-		memcpy(&rec_num, data, sizeof(int));
-		data += sizeof(int);
-		for (int j = 0; j < rec_num; j++, data += sizeof(Record)) {
-			if (memcmp(data + offset, value, size) == 0) {
-				Record *tmp = malloc(sizeof(*tmp));
-				list_insert(records, memcpy(tmp, data, sizeof(*tmp)));
-			}
-		}
-		CALL_BF(BF_UnpinBlock(block), bf_cleanup);
-	}
-	BF_Block_Destroy(&block);
-	return 0;
-
-
-	bf_cleanup:
-		BF_Block_Destroy(&block);
-		return -1;
+	return HP_ForEach(handle, attr, value, list_record, records);
 }
 
 
@@ -274,7 +441,7 @@ int HP_GetEntry(Heap_file *handle, void *value, Record *rec)
 	Record_pos rec_pos = { .block_id = -1 };
 	int code;
 	
-	if ((code = HP_FindEntry(handle, value, &rec_pos, NULL)) <= 0)
+	if ((code = HP_FindEntry(handle, value, &rec_pos)) <= 0)
 		return (rec->id = -1, code);
 
 	BF_Block *block;
@@ -289,11 +456,13 @@ int HP_GetEntry(Heap_file *handle, void *value, Record *rec)
 		error
 	);
 
-	char *data = BF_Block_GetData(block)      + 
-				 rec_pos.pos * sizeof(Record) +
-				 sizeof(int);
-	
-	memcpy(rec, data, sizeof(Record));
+	get_block_record(
+		BF_Block_GetData(block) + sizeof(int), 
+		handle->layout, 
+		handle->rec_capacity, 
+		rec_pos.pos, 
+		rec
+	);
 
 	CALL_BF(BF_UnpinBlock(block), bf_cleanup);
 	BF_Block_Destroy(&block);
@@ -311,11 +480,136 @@ int HP_GetEntry(Heap_file *handle, void *value, Record *rec)
 
 
 
+HP_Scan *HP_Scan_Open(Heap_file *handle, rec_attr attr, void *value) 
+{
+	HP_Scan *scan = malloc(sizeof(*scan));
+	*scan = (HP_Scan) {
+		.handle = handle,
+		.attr = attr,
+		.all = value == NULL,
+		.block_id = 1,
+		.last_block = handle->last_block_id,
+		.mask = malloc(MATCH_WORDS(handle->rec_capacity) * sizeof(uint64_t))
+	};
+
+	if (value != NULL) {
+		scan->size = get_value_size(attr, value);
+		memcpy(scan->value, value, scan->size);
+	}
+
+	/* Primary key lookups start at the record's position, if there is one */
+	if (value != NULL && attr == handle->attr) {
+		Record_pos rec_pos = { .block_id = -1 };
+		int code = HP_FindEntry(handle, value, &rec_pos);
+		if (code < 0) {
+			free(scan->mask);
+			free(scan);
+			return NULL;
+		}
+		scan->block_id = code ? rec_pos.block_id : 1;
+		scan->last_block = code ? rec_pos.block_id : 0;
+		scan->pos = code ? rec_pos.pos : 0;
+	}
+
+	/* Scans over the whole file let the OS read ahead */
+	scan->sequential = scan->last_block > scan->block_id
+	                && BF_AdviseSequential(handle->file_desc, true) == BF_OK;
+	BF_Block_Init(&scan->block);
+	return scan;
+}
+
+int HP_Scan_Next(HP_Scan *scan, Record **rec) 
+{
+	int rec_num;
+	Heap_file *handle = scan->handle;
+
+	while (scan->block_id <= scan->last_block) {
+		bool fetched = !scan->pinned;
+		if (fetched) {
+			if (scan->sequential && scan->block_id % (READ_AHEAD / 2) == 1)
+				read_ahead(scan);
+			CALL_BF(BF_GetBlock(handle->file_desc, scan->block_id, scan->block), error);
+			scan->pinned = true;
+		}
+
+		char *data = BF_Block_GetData(scan->block);
+		memcpy(&rec_num, data, sizeof(int));
+		data += sizeof(int);
+
+		/* Compare the attribute of the whole block once, when it is pinned */
+		if (fetched && !scan->all)
+			match_records(
+				get_block_member(data, handle->layout, handle->rec_capacity, 0, scan->attr), 
+				rec_num, 
+				get_member_stride(handle->layout, scan->attr), 
+				0, scan->value, scan->size, scan->mask
+			);
+
+		if (!scan->all)
+			scan->pos = match_next(scan->mask, scan->pos, rec_num);
+		if (scan->pos < rec_num) {
+			/* Records of PAX blocks are put together in the cursor */
+			if (handle->layout == PAX_LAYOUT) {
+				get_block_record(data, handle->layout, handle->rec_capacity, scan->pos, &scan->rec);
+				*rec = &scan->rec;
+			} else {
+				*rec = (Record*)(data + scan->pos * sizeof(Record));
+			}
+			scan->pos++;
+			return 1;
+		}
+
+		scan->pinned = false;
+		scan->block_id++;
+		scan->pos = 0;
+		CALL_BF(BF_UnpinBlock(scan->block), error);
+	}
+	return 0;
+
+	error:
+		return -1;
+}
+
+int HP_Scan_Close(HP_Scan *scan) 
+{
+	int code = 0;
+	if (scan->pinned && BF_UnpinBlock(scan->block) != BF_OK)
+		code = -1;
+	if (scan->sequential && BF_AdviseSequential(scan->handle->file_desc, false) != BF_OK)
+		code = -1;
+
+	BF_Block_Destroy(&scan->block);
+	free(scan->mask);
+	free(scan);
+	return code;
+}
+
+
+int HP_ForEach(Heap_file *handle, rec_attr attr, void *value, 
+                                                 Record_visit visit, 
+                                                 void *arg) 
+{
+	int code, stop = 0;
+	Record *rec;
+	HP_Scan *scan = HP_Scan_Open(handle, attr, value);
+
+	if (scan == NULL)
+		return -1;
+
+	while ((code = HP_Scan_Next(scan, &rec)) > 0 && !(stop = visit(rec, arg)));
+
+	if (HP_Scan_Close(scan) < 0 || code < 0)
+		return -1;
+	return stop;
+}
+
+
 int HP_PrintFile(Heap_file *handle, FILE *stream) 
 {
 	BF_Block *block;
 	BF_Block_Init(&block);
 
+	CALL_BF(BF_AdviseSequential(handle->file_desc, true), bf_cleanup);
 	for (int i = 1; i <= handle->last_block_id; i++) {
 		CALL_BF(
 			BF_GetBlock(
@@ -323,7 +617,7 @@ int HP_PrintFile(Heap_file *handle, FILE *stream)
 				i, 
 				block
 			), 
-			bf_cleanup
+			unadvise
 		);
 		char *data = BF_Block_GetData(block);
 		
@@ -334,9 +628,9 @@ int HP_PrintFile(Heap_file *handle, FILE *stream)
 		if (rec_num > 0)
 			fprintf(stream, "Records in %d block\n", i);
 
-		for (int j = 0; j < rec_num; j++, data += sizeof(Record)) {
+		for (int j = 0; j < rec_num; j++) {
 			Record rec;
-			memcpy(&rec, data, sizeof(Record));
+			get_block_record(data, handle->layout, handle->rec_capacity, j, &rec);
 			fprintf(stream,
 				"Id: %d\n"
 				"Name: %s\n"
@@ -346,11 +640,14 @@ int HP_PrintFile(Heap_file *handle, FILE *stream)
 				rec.surname, rec.city
 			);
 		}
-		CALL_BF(BF_UnpinBlock(block), bf_cleanup);
+		CALL_BF(BF_UnpinBlock(block), unadvise);
 	}
+	CALL_BF(BF_AdviseSequential(handle->file_desc, false), bf_cleanup);
 	BF_Block_Destroy(&block);
 	return 0;
 
+	unadvise:
+		BF_AdviseSequential(handle->file_desc, false);
 	bf_cleanup:
 		BF_Block_Destroy(&block);
 		return -1;
@@ -359,20 +656,28 @@ int HP_PrintFile(Heap_file *handle, FILE *stream)
 
 
 
-static int HP_FindEntry(Heap_file *handle, void *value, 
-										   Record_pos *rec_pos, 
-										   int *empty_block) 
+static int HP_FindEntry(Heap_file *handle, void *value, Record_pos *rec_pos) 
 {
 	int rec_num = 0;
 	bool found = false;
+
+	if (handle->key_index != NULL) {
+		Record_pos *pos = map_tuple_value(hash_map_value(handle->key_index, value));
+		if (pos != NULL)
+			*rec_pos = *pos;
+		return pos != NULL;
+	}
+
+	/* Keys the filter has never seen are not in the file */
+	if (!bloom_test(handle->bloom, handle->bloom_size, 
+	                hash_key(get_attr_type(handle->attr), value)))
+		return 0;
 	
 	BF_Block *block;
 	BF_Block_Init(&block);
 
-	int offset = get_attr_offset(handle->attr);
-	int size = get_attr_type(handle->attr) == STRING
-		? strlen(value) + 1
-		: get_attr_size(handle->attr);
+	int size = get_value_size(handle->attr, value);
+	uint64_t mask[MATCH_WORDS(handle->rec_capacity)];
 
 	for (int i = 1; i <= handle->last_block_id; i++) {
 		CALL_BF(
@@ -385,19 +690,19 @@ static int HP_FindEntry(Heap_file *handle, void *value,
 		);
 		char *data = BF_Block_GetData(block);
 		memcpy(&rec_num, data, sizeof(int));
-		
-		if (empty_block != NULL && *empty_block < 0
-		 && rec_num != handle->rec_capacity)
-			*empty_block = i;
-			
 		data += sizeof(int);	
-		for (int j = 0; j < rec_num; j++, data += sizeof(Record)) {
-			if (memcmp(data + offset, value, size) == 0) {
-				found = true;
-				rec_pos->block_id = i;
-				rec_pos->pos = j;
-				break;
-			}
+		match_records(
+			get_block_member(data, handle->layout, handle->rec_capacity, 0, handle->attr), 
+			rec_num, 
+			get_member_stride(handle->layout, handle->attr), 
+			0, value, size, mask
+		);
+
+		int j = match_next(mask, 0, rec_num);
+		if (j < rec_num) {
+			found = true;
+			rec_pos->block_id = i;
+			rec_pos->pos = j;
 		}
 		CALL_BF(BF_UnpinBlock(block), bf_cleanup);
 
@@ -416,7 +721,319 @@ static int HP_FindEntry(Heap_file *handle, void *value,
 
 
 
-static void update_data(char *data, char *action, void *value) 
+/* Hands out the block after the last data block, 
+ * reusing blocks of the free space map when there are any */
+static int HP_NewBlock(Heap_file *handle, BF_Block *block) 
+{
+	int blocks_num, block_id = handle->last_block_id + 1;
+	CALL_BF(BF_GetBlockCounter(handle->file_desc, &blocks_num), error);
+
+	if (block_id < blocks_num) {
+		CALL_BF(BF_GetBlock(handle->file_desc, block_id, block), error);
+		memset(BF_Block_GetData(block), 0, handle->block_size);
+	} else {
+		CALL_BF(BF_AllocateBlock(handle->file_desc, block), error);
+	}
+
+	if (block_id / 8 + 1 > MAP_SIZE(handle)) {
+		handle->free_map = realloc(handle->free_map, block_id / 8 + 1);
+		handle->free_map[block_id / 8] = 0;
+	}
+	handle->last_block_id++;
+	set_free(handle, block_id, 0);
+	return 0;
+
+	error:
+		return -1;
+}
+
+static int HP_FreeBlock(Heap_file *handle) 
+{
+	for (int i = 0; i < MAP_SIZE(handle); ++i)
+		if (handle->free_map[i])
+			return i * 8 + __builtin_ctz(handle->free_map[i]);
+	return -1;
+}
+
+static void set_free(Heap_file *handle, int block_id, int rec_num) 
+{
+	if (rec_num < handle->rec_capacity)
+		handle->free_map[block_id / 8] |= 1 << block_id % 8;
+	else
+		handle->free_map[block_id / 8] &= ~(1 << block_id % 8);
+}
+
+/* Reads the map stored after the last data block, 
+ * or rebuilds it with a scan if the file has none */
+static int load_free_map(Heap_file *handle) 
+{
+	int blocks_num, rec_num;
+	BF_Block *block;
+	BF_Block_Init(&block);
+
+	handle->free_map = calloc(MAP_SIZE(handle), 1);
+	CALL_BF(BF_GetBlockCounter(handle->file_desc, &blocks_num), bf_cleanup);
+
+	if (blocks_num - handle->last_block_id - 1 >= MAP_BLOCKS(handle)) {
+		for (int i = 0; i < MAP_BLOCKS(handle); ++i) {
+			CALL_BF(BF_GetBlock(handle->file_desc, handle->last_block_id + 1 + i, block), bf_cleanup);
+			int size = MAP_SIZE(handle) - i * handle->block_size;
+			memcpy(
+				handle->free_map + i * handle->block_size,
+				BF_Block_GetData(block),
+				size < handle->block_size ? size : handle->block_size
+			);
+			CALL_BF(BF_UnpinBlock(block), bf_cleanup);
+		}
+	} else {
+		for (int i = 1; i <= handle->last_block_id; i++) {
+			CALL_BF(BF_GetBlock(handle->file_desc, i, block), bf_cleanup);
+			memcpy(&rec_num, BF_Block_GetData(block), sizeof(int));
+			set_free(handle, i, rec_num);
+			CALL_BF(BF_UnpinBlock(block), bf_cleanup);
+		}
+	}
+	BF_Block_Destroy(&block);
+	return 0;
+
+	bf_cleanup:
+		BF_Block_Destroy(&block);
+		free(handle->free_map);
+		return -1;
+}
+
+/* Writes size bytes to the blocks starting at first_block, 
+ * allocating the ones past the end of the file */
+static int write_tail(Heap_file *handle, int first_block, unsigned char *data, int size) 
+{
+	int blocks_num;
+	BF_Block *block;
+	BF_Block_Init(&block);
+
+	CALL_BF(BF_GetBlockCounter(handle->file_desc, &blocks_num), bf_cleanup);
+	for (int i = 0; i * handle->block_size < size; ++i) {
+		int block_id = first_block + i;
+		if (block_id < blocks_num)
+			CALL_BF(BF_GetBlock(handle->file_desc, block_id, block), bf_cleanup);
+		else
+			CALL_BF(BF_AllocateBlock(handle->file_desc, block), bf_cleanup);
+
+		int left = size - i * handle->block_size;
+		COPY(
+			data + i * handle->block_size,
+			BF_Block_GetData(block),
+			left < handle->block_size ? left : handle->block_size,
+			handle->block_size
+		);
+		BF_Block_SetDirty(block);
+		CALL_BF(BF_UnpinBlock(block), bf_cleanup);
+	}
+	BF_Block_Destroy(&block);
+	return 0;
+
+	bf_cleanup:
+		BF_Block_Destroy(&block);
+		return -1;
+}
+
+/* Reads the filter stored after the free space map, or rebuilds it with 
+ * a scan if the file has none or it is too small for the file's keys. 
+ * Files that did not count the filter's keys hold at least their records' keys */
+static int load_bloom(Heap_file *handle) 
+{
+	int blocks_num, first_block = handle->last_block_id + 1 + MAP_BLOCKS(handle);
+	CALL_BF(BF_GetBlockCounter(handle->file_desc, &blocks_num), error);
+
+	if (handle->bloom_keys < handle->rec_count)
+		handle->bloom_keys = handle->rec_count;
+	if (handle->bloom_size == 0 || handle->bloom_keys > BLOOM_KEYS(handle->bloom_size)
+	 || blocks_num - first_block < BLOOM_BLOCKS(handle->bloom_size, handle->block_size)) {
+		handle->bloom = NULL;
+		return build_bloom(handle, 2 * handle->rec_count);
+	}
+
+	handle->bloom = malloc(handle->bloom_size);
+	return bloom_load(handle->file_desc, first_block, handle->bloom, handle->bloom_size);
+
+	error:
+		return -1;
+}
+
+/* Replaces the filter with one sized for the given number of keys, 
+ * filled with a scan of the file */
+static int build_bloom(Heap_file *handle, int keys) 
+{
+	int rec_num, size = keys * BLOOM_BITS_PER_KEY / 8;
+	BF_Block *block;
+	BF_Block_Init(&block);
+
+	free(handle->bloom);
+	handle->bloom_size = size > BLOOM_MIN_SIZE ? size : BLOOM_MIN_SIZE;
+	handle->bloom = calloc(handle->bloom_size, 1);
+	handle->bloom_keys = 0;
+
+	for (int i = 1; handle->rec_count > 0 && i <= handle->last_block_id; i++) {
+		CALL_BF(BF_GetBlock(handle->file_desc, i, block), bf_cleanup);
+		char *data = BF_Block_GetData(block);
+		memcpy(&rec_num, data, sizeof(int));
+
+		data += sizeof(int);
+		for (int j = 0; j < rec_num; j++)
+			add_key(
+				handle, 
+				get_block_member(data, handle->layout, handle->rec_capacity, j, handle->attr)
+			);
+		CALL_BF(BF_UnpinBlock(block), bf_cleanup);
+	}
+	BF_Block_Destroy(&block);
+	return 0;
+
+	bf_cleanup:
+		BF_Block_Destroy(&block);
+		return -1;
+}
+
+static void add_key(Heap_file *handle, void *value) 
+{
+	handle->bloom_keys++;
+	bloom_add(handle->bloom, handle->bloom_size, hash_key(get_attr_type(handle->attr), value));
+}
+
+/* Maps every key of the file to the position of its record */
+static int build_key_index(Heap_file *handle) 
+{
+	int rec_num;
+	bool is_int = get_attr_type(handle->attr) == INT;
+
+	handle->key_index = hash_map_create(
+		handle->rec_count, 
+		is_int ? compare_int_keys : (Comparator)strcmp,
+		is_int ? hash_int_keys : hash_string_keys,
+		free, free
+	);
+
+	BF_Block *block;
+	BF_Block_Init(&block);
+	for (int i = 1; i <= handle->last_block_id; i++) {
+		CALL_BF(BF_GetBlock(handle->file_desc, i, block), bf_cleanup);
+		char *data = BF_Block_GetData(block);
+		memcpy(&rec_num, data, sizeof(int));
+
+		data += sizeof(int);
+		for (int j = 0; j < rec_num; j++)
+			index_insert(
+				handle, 
+				get_block_member(data, handle->layout, handle->rec_capacity, j, handle->attr), 
+				i, j
+			);
+		CALL_BF(BF_UnpinBlock(block), bf_cleanup);
+	}
+	BF_Block_Destroy(&block);
+	return 0;
+
+	bf_cleanup:
+		BF_Block_Destroy(&block);
+		hash_map_destroy(handle->key_index);
+		handle->key_index = NULL;
+		return -1;
+}
+
+static void index_insert(Heap_file *handle, void *value, int block_id, int pos) 
+{
+	if (handle->key_index == NULL)
+		return;
+
+	int size = get_attr_size(handle->attr);
+	char *key = calloc(size + 1, 1);
+	Record_pos *rec_pos = malloc(sizeof(*rec_pos));
+
+	memcpy(key, value, get_attr_type(handle->attr) == STRING ? strnlen(value, size) : size);
+	*rec_pos = (Record_pos) { .block_id = block_id, .pos = pos };
+	hash_map_insert(handle->key_index, key, rec_pos);
+}
+
+/* Records after a deleted one move one slot back in their block */
+static void index_shift(Heap_file *handle, char *data, int pos) 
+{
+	if (handle->key_index == NULL)
+		return;
+
+	int rec_num;
+	memcpy(&rec_num, data, sizeof(int));
+	data += sizeof(int);
+
+	for (int j = pos; j < rec_num; j++) {
+		void *key = get_block_member(data, handle->layout, handle->rec_capacity, j, handle->attr);
+		Record_pos *rec_pos = map_tuple_value(hash_map_value(handle->key_index, key));
+		rec_pos->pos--;
+	}
+}
+
+static int compare_int_keys(void *a, void *b) 
+{
+	return compare_keys(a, b, ID);
+}
+
+static size_t hash_int_keys(void *key) 
+{
+	return hash_key(INT, key);
+}
+
+static size_t hash_string_keys(void *key) 
+{
+	return hash_key(STRING, key);
+}
+
+static int compare_records(const void *a, const void *b, void *attr) 
+{
+	rec_attr attr_ = *(rec_attr*)attr;
+	Record *a_ = *(Record**)a, *b_ = *(Record**)b;
+
+	int code = compare_keys(
+		get_rec_member(a_, attr_), 
+		get_rec_member(b_, attr_), 
+		attr_
+	);
+	return code != 0 ? code : (a_ > b_) - (a_ < b_);
+}
+
+/* Fills the free slots of the room blocks and appends full blocks after them */
+static int write_records(Heap_file *handle, Record **sorted, int n, int *room, 
+                                                                    int room_num) 
+{
+	int done = 0, rec_num;
+	BF_Block *block;
+	BF_Block_Init(&block);
+
+	for (int i = 0; done < n; ++i) {
+		int block_id = i < room_num ? room[i] : handle->last_block_id + 1;
+		if (i < room_num)
+			CALL_BF(BF_GetBlock(handle->file_desc, block_id, block), bf_cleanup);
+		else if (HP_NewBlock(handle, block) < 0)
+			goto bf_cleanup;
+
+		char *data = BF_Block_GetData(block);
+		memcpy(&rec_num, data, sizeof(int));
+		for (; rec_num < handle->rec_capacity && done < n; rec_num++) {
+			update_data(handle, data, "insert", sorted[done]);
+			add_key(handle, get_rec_member(sorted[done], handle->attr));
+			index_insert(handle, get_rec_member(sorted[done++], handle->attr), block_id, rec_num);
+			handle->rec_count++;
+		}
+		set_free(handle, block_id, rec_num);
+
+		BF_Block_SetDirty(block);
+		CALL_BF(BF_UnpinBlock(block), bf_cleanup);
+	}
+	BF_Block_Destroy(&block);
+	return 0;
+
+	bf_cleanup:
+		BF_Block_Destroy(&block);
+		return -1;
+}
+
+static void update_data(Heap_file *handle, char *data, char *action, void *value) 
 {
 	int rec_num, new;
 	bool is_delete = !strcmp(action, "delete");
@@ -425,15 +1042,26 @@ static void update_data(char *data, char *action, void *value)
 	new = rec_num + (is_delete ? -1 : 1);
 	memcpy(data, &new, sizeof(int));
 
-	int offset = is_delete ? *(int*)value : rec_num;
-	data += sizeof(int) + offset * sizeof(Record);
-
+	data += sizeof(int);
 	if (!is_delete)
-		memcpy(data, value, sizeof(Record));
+		set_block_record(data, handle->layout, handle->rec_capacity, rec_num, value);
 	else
-		memmove(
-			data,
-			data + sizeof(Record),
-			(rec_num - offset - 1) * sizeof(Record)
-		);
+		remove_block_record(data, handle->layout, handle->rec_capacity, *(int*)value, rec_num);
+}
+
+static bool read_only(Heap_file *handle) 
+{
+	if (handle->read_only)
+		fprintf(stderr, "Error! The file was opened read-only\n");
+	return handle->read_only;
+}
+
+/* Asks for the next READ_AHEAD blocks of the scan, every READ_AHEAD / 2 blocks, 
+ * so reads are sent in batches. The ones already in the buffer pool are skipped */
+static void read_ahead(HP_Scan *scan) 
+{
+	int blocks[READ_AHEAD], n = 0;
+	for (int i = scan->block_id + 1; i <= scan->last_block && n < READ_AHEAD; ++i)
+		blocks[n++] = i;
+	BF_Prefetch(scan->handle->file_desc, blocks, n);
 }
@@ -1,19 +1,46 @@
 #include "shash_file.h"
 
-#define RECORDS_CAPACITY (BF_BLOCK_SIZE - sizeof(SHash_block)) / sizeof(SRecord)
-#define BUCKETS_PER_BLOCK (BF_BLOCK_SIZE / sizeof(int))
-#define SHT_INFO_SIZE (sizeof(SHash_file) - sizeof(int*))
+#define RECORDS_CAPACITY(block_size) ((block_size) - sizeof(SHash_block)) / (sizeof(SRecord) + 1)
+#define BUCKETS_PER_BLOCK(block_size) ((block_size) / sizeof(int))
+#define SHT_INFO_SIZE offsetof(SHash_file, hash_table)
+#define SPLIT_LOAD 80
+#define READ_AHEAD 16
+#define BUCKET_BLOOM(handle, bucket) ((handle)->bloom + (bucket) * BLOOM_BUCKET_SIZE)
+
+typedef struct {
+	int bucket;
+	SRecord srec;
+} Build_entry;
 
 static int SHT_FindEntry(SHash_file *handle, SRecord rec, Record_pos *rec_pos, 
 													      int *empty_block,
 													      int *counter);
 
-static int SHT_GetHTRecords(SHash_file *handle, Hash_file *ht_handle, 
-												int block_id, 
-												void *value, 
-												Dl_list records);
-
-static void update_data(char *data, char *action, void *value, bool is_dup);
+static int SHT_Insert(SHash_file *handle, Record record, int block_id);
+static int SHT_Delete(SHash_file *handle, void *value, int block_id);
+static int SHT_LoadBatch(SHash_file *handle, Record *recs, int n, int *block_ids);
+static int SHT_UnloadBatch(SHash_file *handle, Record *recs, int n, int *block_ids);
+static int SHT_SplitBucket(SHash_file *handle);
+static int write_chain(SHash_file *handle, SRecord *recs, int count, 
+                                                          int *head, 
+                                                          int *blocks, 
+                                                          int *blocks_num);
+static int SHT_Bucket(SHash_file *handle, void *value);
+static void add_keys(SHash_file *handle, int bucket, SRecord *recs, int count);
+static int compare_build_entries(const void *a, const void *b, void *handle);
+static int compare_srecords(SRecord *a, SRecord *b, rec_attr attr);
+static int fold_bucket(SHash_file *handle, Build_entry *entries, int count, 
+                                                                 SRecord *run, 
+                                                                 int *run_num);
+static int fill_room(SHash_file *handle, SRecord *recs, int count, 
+                                                        int *room, 
+                                                        int room_num);
+static void *srecord_key(SRecord *srec, rec_attr attr);
+static unsigned char srecord_fingerprint(SRecord *srec, rec_attr attr);
+static int collect_blocks(SHT_Scan *scan, int index_block);
+static int compare_block_ids(const void *a, const void *b);
+static void update_data(SHash_file *handle, char *data, char *action, void *value, 
+                                                                      bool is_dup);
 
 
 
@@ -21,6 +48,21 @@ int SHT_CreateFile(const char *sfilename, rec_attr attr,
 										  const char *filename,
 										  int buckets) 
 {
+	return SHT_CreateFileEx(sfilename, attr, filename, buckets, STATIC_HASH, BF_BLOCK_SIZE);
+}
+
+
+int SHT_CreateFileEx(const char *sfilename, rec_attr attr,
+											const char *filename,
+											int buckets,
+											hash_mode mode,
+											int block_size) 
+{
+	if (mode == EXTENDIBLE_HASH) {
+		fprintf(stderr, "Extendible hashing is not supported for secondary indexes\n");
+		return -1;
+	}
+
 	if (attr == ID) {
 		fprintf(stderr, "Not a proper attribute was chosen\n");
 		return -1;
@@ -36,7 +78,7 @@ int SHT_CreateFile(const char *sfilename, rec_attr attr,
 	}
 
     int fd;
-    CALL_BF(BF_CreateFile(sfilename), error);
+    CALL_BF(BF_CreateFileEx(sfilename, block_size), error);
     CALL_BF(BF_OpenFile(sfilename, &fd), delete_file);
 
 	int last_block = 0, _buckets = buckets;
@@ -49,8 +91,8 @@ int SHT_CreateFile(const char *sfilename, rec_attr attr,
     do {
         last_block++;
         CALL_BF(BF_AllocateBlock(fd, buckets_block), bf_cleanup);
-        _buckets -= BUCKETS_PER_BLOCK;
-        memset(BF_Block_GetData(buckets_block), -1, BF_BLOCK_SIZE);
+        _buckets -= BUCKETS_PER_BLOCK(block_size);
+        memset(BF_Block_GetData(buckets_block), -1, block_size);
         BF_Block_SetDirty(buckets_block);
         CALL_BF(BF_UnpinBlock(buckets_block), bf_cleanup);
     } while (_buckets > 0);
@@ -58,25 +100,32 @@ int SHT_CreateFile(const char *sfilename, rec_attr attr,
 
     SHash_file handle = {
         .buckets       = buckets,
-        .rec_capacity  = RECORDS_CAPACITY,
+        .block_size    = block_size,
+        .rec_capacity  = RECORDS_CAPACITY(block_size),
         .attr          = attr,
         .last_block_id = last_block,
+        .dir_block     = 1,
+        .bloom_block   = -1,
+        .bloom_blocks  = 0,
+        .init_buckets  = buckets,
+        .mode          = mode,
 		.file_type     = "sht"
     };
 
 	
+	pthread_mutex_lock(&file_map_lock);
 	Map_tuple tuple = hash_map_value(file_map, (void*)filename);
+	pthread_mutex_unlock(&file_map_lock);
 	Hash_file *ht_handle = tuple != NULL
 		? (Hash_file*)map_tuple_value(tuple) 
 		: HT_OpenFile(filename);
 	
-	if (ht_handle == NULL)
+	if (ht_handle == NULL || HT_AddIndex(ht_handle, attr, sfilename) < 0)
 		goto bf_cleanup;
 
-	COPY(sfilename, ht_handle->index_files[attr - 1].filename, strlen(sfilename), MAX_FILENAME + 1);
     COPY(sfilename, handle.filename, strlen(sfilename), MAX_FILENAME + 1);
 	COPY(ht_handle->filename, handle.index_filename, strlen(ht_handle->filename), MAX_FILENAME + 1);
-    COPY(&handle, BF_Block_GetData(block), SHT_INFO_SIZE, BF_BLOCK_SIZE);
+    COPY(&handle, BF_Block_GetData(block), SHT_INFO_SIZE, block_size);
 
 	if (tuple == NULL && HT_CloseFile(ht_handle) < 0)
 		goto bf_cleanup;
@@ -129,24 +178,32 @@ SHash_file *SHT_OpenFile(const char *sfilename)
     SHash_file *handle = malloc(sizeof(*handle));
     memcpy(handle, BF_Block_GetData(block), SHT_INFO_SIZE);
     handle->file_desc = fd;
+    pthread_rwlock_init(&handle->latch, NULL);
 
 
     handle->hash_table = malloc(sizeof(int) * handle->buckets);
     int buckets = handle->buckets;
-    for (int i = 1; i <= handle->last_block_id; ++i) {
+    for (int i = handle->dir_block; i <= handle->last_block_id; ++i) {
 	    CALL_BF(BF_GetBlock(fd, i, buckets_block), bf_cleanup);
         memcpy(
-            handle->hash_table + (i - 1) * BUCKETS_PER_BLOCK, 
+            handle->hash_table + (i - handle->dir_block) * BUCKETS_PER_BLOCK(handle->block_size), 
             BF_Block_GetData(buckets_block), 
-            buckets >= BUCKETS_PER_BLOCK 
-                ? BF_BLOCK_SIZE 
+            buckets >= BUCKETS_PER_BLOCK(handle->block_size) 
+                ? handle->block_size 
                 : buckets * sizeof(int)
         );
-        buckets -= BUCKETS_PER_BLOCK;
+        buckets -= BUCKETS_PER_BLOCK(handle->block_size);
 		CALL_BF(BF_UnpinBlock(buckets_block), bf_cleanup);
     }
+
+	handle->bloom = calloc(handle->buckets, BLOOM_BUCKET_SIZE);
+	if (handle->bloom_block > 0 && bloom_load(fd, handle->bloom_block, handle->bloom, 
+	                                          handle->buckets * BLOOM_BUCKET_SIZE) < 0)
+		goto bf_cleanup;
 	
+	pthread_mutex_lock(&file_map_lock);
 	hash_map_insert(file_map, strdup(handle->filename), handle);
+	pthread_mutex_unlock(&file_map_lock);
     BF_Block_Destroy(&buckets_block);
 	BF_Block_Destroy(&block);
 
@@ -166,38 +223,53 @@ int SHT_CloseFile(SHash_file *handle)
 	BF_Block *block;
     BF_Block_Init(&block);
 
-    CALL_BF(BF_GetBlock(handle->file_desc, 0, block), bf_cleanup);
-    char *data = BF_Block_GetData(block);
+    /* Split buckets can outgrow the directory blocks, 
+     * in which case it is moved to the end of the file. 
+     * Its old blocks, like those of a filter that grew, stay unused, 
+     * since the file keeps no list of free blocks */
+    int dir_blocks = (handle->buckets - 1) / BUCKETS_PER_BLOCK(handle->block_size) + 1;
+    if (dir_blocks > handle->last_block_id - handle->dir_block + 1) {
+        CALL_BF(BF_GetBlockCounter(handle->file_desc, &handle->dir_block), bf_cleanup);
+        for (int i = 0; i < dir_blocks; ++i) {
+            CALL_BF(BF_AllocateBlock(handle->file_desc, block), bf_cleanup);
+            CALL_BF(BF_UnpinBlock(block), bf_cleanup);
+        }
+        handle->last_block_id = handle->dir_block + dir_blocks - 1;
+    }
 
-    memcpy(
-		data + offsetof(SHash_file, rec_count),
-        &handle->rec_count,
-        sizeof_field(SHash_file, rec_count)
-    );
+    if (bloom_store(handle->file_desc, &handle->bloom_block, &handle->bloom_blocks, 
+                                       handle->bloom, 
+                                       handle->buckets * BLOOM_BUCKET_SIZE) < 0)
+        goto bf_cleanup;
 
+    CALL_BF(BF_GetBlock(handle->file_desc, 0, block), bf_cleanup);
+    memcpy(BF_Block_GetData(block), handle, SHT_INFO_SIZE);
     BF_Block_SetDirty(block);
     CALL_BF(BF_UnpinBlock(block), bf_cleanup);
 
-    for (int i = 1; i <= handle->last_block_id; ++i) {
+    int buckets = handle->buckets;
+    for (int i = handle->dir_block; i <= handle->last_block_id; ++i) {
         CALL_BF(BF_GetBlock(handle->file_desc, i, block), bf_cleanup);
         memcpy(
             BF_Block_GetData(block),
-            handle->hash_table + (i - 1) * BUCKETS_PER_BLOCK,
-            i != handle->last_block_id 
-                ? BF_BLOCK_SIZE 
-                : sizeof(int) * handle->buckets
+            handle->hash_table + (i - handle->dir_block) * BUCKETS_PER_BLOCK(handle->block_size),
+            buckets >= BUCKETS_PER_BLOCK(handle->block_size)
+                ? handle->block_size 
+                : sizeof(int) * buckets
         );
-        handle->buckets -= BUCKETS_PER_BLOCK;
+        buckets -= BUCKETS_PER_BLOCK(handle->block_size);
         BF_Block_SetDirty(block);
         CALL_BF(BF_UnpinBlock(block), bf_cleanup);
     }
 
-
-
     BF_Block_Destroy(&block);
     CALL_BF(BF_CloseFile(handle->file_desc), error);
+	pthread_mutex_lock(&file_map_lock);
 	hash_map_delete(file_map, handle->filename);
+	pthread_mutex_unlock(&file_map_lock);
+    pthread_rwlock_destroy(&handle->latch);
     free(handle->hash_table);
+    free(handle->bloom);
     free(handle);
 	
     return 0;
@@ -207,13 +279,33 @@ int SHT_CloseFile(SHash_file *handle)
 		CALL_BF(BF_CloseFile(handle->file_desc), error);
 
 	error:
+		pthread_rwlock_destroy(&handle->latch);
 		free(handle->hash_table);
+		free(handle->bloom);
 		free(handle);
 		return -1;
 }
 
 
+/* Writers latch the whole index, since inserts may split a bucket of a linear 
+ * index and move the entries of its chain */
 int SHT_InsertEntry(SHash_file *handle, Record record, int block_id) 
+{
+	pthread_rwlock_wrlock(&handle->latch);
+	int code = SHT_Insert(handle, record, block_id);
+	pthread_rwlock_unlock(&handle->latch);
+	return code;
+}
+
+int SHT_DeleteEntry(SHash_file *handle, void *value, int block_id) 
+{
+	pthread_rwlock_wrlock(&handle->latch);
+	int code = SHT_Delete(handle, value, block_id);
+	pthread_rwlock_unlock(&handle->latch);
+	return code;
+}
+
+static int SHT_Insert(SHash_file *handle, Record record, int block_id) 
 {
 	int empty_block = -1;
 	Record_pos tmp_pos = { .block_id = -1 };
@@ -238,9 +330,9 @@ int SHT_InsertEntry(SHash_file *handle, Record record, int block_id)
 		CALL_BF(
 			BF_GetBlock(
 				handle->file_desc,
-				empty_block < 0
-					? tmp_pos.block_id
-					: empty_block,
+				tmp_pos.block_id < 0
+					? empty_block
+					: tmp_pos.block_id,
 				block
 			),
 			error
@@ -249,7 +341,7 @@ int SHT_InsertEntry(SHash_file *handle, Record record, int block_id)
 
 	char *data = BF_Block_GetData(block);
 	if (empty_block < 0 && tmp_pos.block_id < 0) {
-		int bucket = hash_key(get_attr_type(handle->attr), value) % handle->buckets;
+		int bucket = SHT_Bucket(handle, value);
 		SHash_block block_data = { 
 			.overf_block = handle->hash_table[bucket],
 			.rec_num = 0
@@ -265,6 +357,7 @@ int SHT_InsertEntry(SHash_file *handle, Record record, int block_id)
 		memcpy(data, &block_data, sizeof(SHash_block));
 	}
 	update_data(
+		handle,
 		data, 
 		"insert",
 		tmp_pos.block_id < 0
@@ -272,12 +365,17 @@ int SHT_InsertEntry(SHash_file *handle, Record record, int block_id)
 			: (void*)&tmp_pos.pos,
 		tmp_pos.block_id > 0
 	);
+	add_keys(handle, SHT_Bucket(handle, value), &srec, 1);
 
 	BF_Block_SetDirty(block);
 	CALL_BF(BF_UnpinBlock(block), error);
 	BF_Block_Destroy(&block);
 	handle->rec_count += tmp_pos.block_id < 0;
 
+	if (handle->mode == LINEAR_HASH && 100 * handle->rec_count 
+	  > SPLIT_LOAD * handle->buckets * handle->rec_capacity)
+		return SHT_SplitBucket(handle);
+
 	return 0;
 
 	unpin:
@@ -288,7 +386,7 @@ int SHT_InsertEntry(SHash_file *handle, Record record, int block_id)
 		return -1;
 }
 
-int SHT_DeleteEntry(SHash_file *handle, void *value, int block_id) 
+static int SHT_Delete(SHash_file *handle, void *value, int block_id) 
 {
 	int counter, code;
 	Record_pos rec_pos = { .block_id = -1 };
@@ -310,6 +408,7 @@ int SHT_DeleteEntry(SHash_file *handle, void *value, int block_id)
 	);
 
 	update_data(
+		handle,
 		BF_Block_GetData(block),
 		"delete",
 		&rec_pos.pos,
@@ -331,69 +430,440 @@ int SHT_DeleteEntry(SHash_file *handle, void *value, int block_id)
 
 int SHT_GetEntries(SHash_file *handle, void *value, Dl_list records) 
 {
-	int bucket = hash_key(get_attr_type(handle->attr), value) % handle->buckets;
-	int size = get_attr_type(handle->attr) == STRING 
-		? strlen(value) + 1 
-		: get_attr_size(handle->attr);
+	return SHT_ForEach(handle, value, list_record, records);
+}
 
-	BF_Block *block;
-	BF_Block_Init(&block);
 
+SHT_Scan *SHT_Scan_Open(SHash_file *handle, void *value) 
+{
+	pthread_mutex_lock(&file_map_lock);
 	Map_tuple tuple = hash_map_value(file_map, handle->index_filename);
+	pthread_mutex_unlock(&file_map_lock);
 	Hash_file *ht_handle = tuple != NULL 
 		? (Hash_file*)map_tuple_value(tuple) 
 		: HT_OpenFile(handle->index_filename);
-	
+
 	if (ht_handle == NULL)
-		goto  error;
+		return NULL;
 
-	int block_t = handle->hash_table[bucket];
-	while (block_t != -1) {
-		CALL_BF(
-			BF_GetBlock(
-				handle->file_desc,
-				block_t,
-				block
-			),
-			error
-		);
+	SHT_Scan *scan = malloc(sizeof(*scan));
+	*scan = (SHT_Scan) {
+		.handle = handle,
+		.ht_handle = ht_handle,
+		.close_ht = tuple == NULL,
+		.size = get_value_size(handle->attr, value),
+		.fingerprint = key_fingerprint(get_attr_type(handle->attr), value),
+		.block_id = -1,
+		.mask = malloc(MATCH_WORDS(ht_handle->rec_capacity) * sizeof(uint64_t))
+	};
+	memcpy(scan->value, value, scan->size);
+	BF_Block_Init(&scan->block);
+
+	/* The primary file stays latched until the scan is closed, so its records 
+	 * do not move under the block ids taken from the index */
+	HT_LatchCursor(ht_handle, &scan->held);
+
+	pthread_rwlock_rdlock(&handle->latch);
+	int bucket = SHT_Bucket(handle, value);
+	size_t hash = hash_key(get_attr_type(handle->attr), value);
+	int index_block = bloom_test(BUCKET_BLOOM(handle, bucket), BLOOM_BUCKET_SIZE, hash)
+		? handle->hash_table[bucket]
+		: -1;
+	scan->blocks_num = collect_blocks(scan, index_block);
+	pthread_rwlock_unlock(&handle->latch);
+
+	if (scan->blocks_num < 0) {
+		SHT_Scan_Close(scan);
+		return NULL;
+	}
+	return scan;
+}
 
-		char *data = BF_Block_GetData(block);
-		SHash_block block_data;
-		memcpy(&block_data, data, sizeof(SHash_block));
-		data += sizeof(SHash_block);
-		for (int i = 0; i < block_data.rec_num; i++, data += sizeof(SRecord)) {
-			SRecord srec;
-			memcpy(&srec, data, sizeof(SRecord));
-			void *value_ = get_attr_type(handle->attr) == STRING
-				? (void*)srec.key.skey
-				: (void*)&srec.key.ikey;
-
-			
-			if (memcmp(value_, value, size) == 0) {
-				int code = SHT_GetHTRecords(handle, ht_handle, 
-											srec.block_id, value, 
-											records);
-				if (code < 0)
-					goto unpin;
+/* The primary blocks of the value are visited once each, in ascending order, 
+ * with the next READ_AHEAD of them prefetched every READ_AHEAD / 2 blocks */
+int SHT_Scan_Next(SHT_Scan *scan, Record **rec) 
+{
+	Hash_file *ht_handle = scan->ht_handle;
+	rec_attr attr = scan->handle->attr;
+	Hash_block block_data;
+
+	while (true) {
+		if (scan->block_id != -1) {
+			bool fetched = !scan->pinned;
+			if (fetched) {
+				CALL_BF(BF_GetBlock(ht_handle->file_desc, scan->block_id, scan->block), error);
+				scan->pinned = true;
 			}
+			char *data = BF_Block_GetData(scan->block);
+			memcpy(&block_data, data, sizeof(Hash_block));
+			data = HT_RECORDS(ht_handle, data);
+
+			if (fetched)
+				match_records(
+					get_block_member(data, ht_handle->layout, ht_handle->rec_capacity, 0, attr), 
+					block_data.rec_num, 
+					get_member_stride(ht_handle->layout, attr), 
+					0, scan->value, scan->size, scan->mask
+				);
+
+			scan->pos = match_next(scan->mask, scan->pos, block_data.rec_num);
+			if (scan->pos < block_data.rec_num) {
+				if (ht_handle->layout == PAX_LAYOUT) {
+					get_block_record(data, ht_handle->layout, ht_handle->rec_capacity, scan->pos, 
+					                                                                   &scan->rec);
+					*rec = &scan->rec;
+				} else {
+					*rec = (Record*)(data + scan->pos * sizeof(Record));
+				}
+				scan->pos++;
+				return 1;
+			}
+			scan->pinned = false;
+			scan->block_id = -1;
+			CALL_BF(BF_UnpinBlock(scan->block), error);
 		}
-		block_t = block_data.overf_block;
-		CALL_BF(BF_UnpinBlock(block), error);	
+
+		if (scan->next == scan->blocks_num)
+			return 0;
+
+		if (scan->next % (READ_AHEAD / 2) == 0) {
+			int ahead = scan->blocks_num - scan->next - 1;
+			BF_Prefetch(ht_handle->file_desc, scan->block_ids + scan->next + 1, 
+			                                  ahead < READ_AHEAD ? ahead : READ_AHEAD);
+		}
+		scan->block_id = scan->block_ids[scan->next++];
+		scan->pos = 0;
 	}
-	
-	if (tuple == NULL && HT_CloseFile(ht_handle) < 0)
+
+	error:
+		return -1;
+}
+
+int SHT_Scan_Close(SHT_Scan *scan) 
+{
+	int code = 0;
+	if (scan->pinned && BF_UnpinBlock(scan->block) != BF_OK)
+		code = -1;
+	HT_UnlatchCursor(&scan->held);
+	if (scan->close_ht && HT_CloseFile(scan->ht_handle) < 0)
+		code = -1;
+
+	BF_Block_Destroy(&scan->block);
+	free(scan->block_ids);
+	free(scan->mask);
+	free(scan);
+	return code;
+}
+
+int SHT_ForEach(SHash_file *handle, void *value, Record_visit visit, void *arg) 
+{
+	int code, stop = 0;
+	Record *rec;
+	SHT_Scan *scan = SHT_Scan_Open(handle, value);
+
+	if (scan == NULL)
+		return -1;
+
+	while ((code = SHT_Scan_Next(scan, &rec)) > 0 && !(stop = visit(rec, arg)));
+
+	if (SHT_Scan_Close(scan) < 0 || code < 0)
+		return -1;
+	return stop;
+}
+
+
+
+int SHT_Build(const char *sfilename, rec_attr attr, const char *filename) 
+{
+	pthread_mutex_lock(&file_map_lock);
+	Map_tuple tuple = hash_map_value(file_map, (void*)filename);
+	pthread_mutex_unlock(&file_map_lock);
+	Hash_file *ht_handle = tuple != NULL
+		? (Hash_file*)map_tuple_value(tuple) 
+		: HT_OpenFile(filename);
+
+	if (ht_handle == NULL)
+		return -1;
+
+	SHash_file *handle = NULL;
+	Build_entry *entries = NULL;
+	SRecord *run = NULL;
+	int count = 0, capacity = 0;
+	Hash_block block_data;
+	BF_Block *block;
+	BF_Block_Init(&block);
+
+	if (SHT_CreateFileEx(sfilename, attr, filename, ht_handle->buckets, STATIC_HASH, 
+	                                                                    ht_handle->block_size) < 0
+	 || (handle = SHT_OpenFile(sfilename)) == NULL)
 		goto error;
 
+	/* One pass over the primary file collects a (key, block) pair per record, 
+	 * under its shared latch so that no writer moves records during the pass */
+	pthread_rwlock_rdlock(&ht_handle->latch);
+	for (int i = 0; i < ht_handle->buckets; ++i) {
+		int block_t = HT_BucketHead(ht_handle, i) ? ht_handle->hash_table[i] : -1;
+		while (block_t != -1) {
+			CALL_BF(BF_GetBlock(ht_handle->file_desc, block_t, block), unlatch);
+			char *data = BF_Block_GetData(block);
+			memcpy(&block_data, data, sizeof(Hash_block));
+			data = HT_RECORDS(ht_handle, data);
+
+			if (count + block_data.rec_num > capacity) {
+				capacity = 2 * capacity + block_data.rec_num;
+				entries = realloc(entries, capacity * sizeof(Build_entry));
+			}
+			for (int j = 0; j < block_data.rec_num; j++) {
+				void *value = get_block_member(data, ht_handle->layout, ht_handle->rec_capacity, j, 
+				                                                                                attr);
+				entries[count++] = (Build_entry) {
+					.bucket = SHT_Bucket(handle, value),
+					.srec = create_srecord(value, block_t, attr)
+				};
+			}
+			block_t = block_data.overf_block;
+			CALL_BF(BF_UnpinBlock(block), unlatch);
+		}
+	}
+	pthread_rwlock_unlock(&ht_handle->latch);
+
+	qsort_r(entries, count, sizeof(Build_entry), compare_build_entries, handle);
+
+	/* Equal pairs are adjacent after sorting and fold into one counter */
+	run = malloc((count + 1) * sizeof(SRecord));
+	for (int start = 0, end; start < count; start = end) {
+		int run_num = 0, zero = 0;
+		end = start + fold_bucket(handle, entries + start, count - start, run, &run_num);
+
+		int bucket = entries[start].bucket;
+		if (write_chain(handle, run, run_num, &handle->hash_table[bucket], NULL, &zero) < 0)
+			goto error;
+		add_keys(handle, bucket, run, run_num);
+		handle->rec_count += run_num;
+	}
+
 	BF_Block_Destroy(&block);
-	return 0;
+	free(entries);
+	free(run);
+	if (SHT_CloseFile(handle) < 0)
+		handle = NULL;
+	if (tuple == NULL && HT_CloseFile(ht_handle) < 0)
+		return -1;
+	return handle == NULL ? -1 : 0;
 
-	unpin:
-		BF_UnpinBlock(block);
+	unlatch:
+		pthread_rwlock_unlock(&ht_handle->latch);
+	error:
+		BF_Block_Destroy(&block);
+		free(entries);
+		free(run);
+		if (handle != NULL)
+			SHT_CloseFile(handle);
 		if (tuple == NULL)
 			HT_CloseFile(ht_handle);
+		return -1;
+}
+
+
+int SHT_InsertBatch(SHash_file *handle, Record *recs, int n, int *block_ids) 
+{
+	pthread_rwlock_wrlock(&handle->latch);
+	int code = SHT_LoadBatch(handle, recs, n, block_ids);
+	pthread_rwlock_unlock(&handle->latch);
+	return code;
+}
+
+int SHT_DeleteBatch(SHash_file *handle, Record *recs, int n, int *block_ids) 
+{
+	pthread_rwlock_wrlock(&handle->latch);
+	int code = SHT_UnloadBatch(handle, recs, n, block_ids);
+	pthread_rwlock_unlock(&handle->latch);
+	return code;
+}
+
+static int SHT_LoadBatch(SHash_file *handle, Record *recs, int n, int *block_ids) 
+{
+	Build_entry *entries = malloc((n + 1) * sizeof(Build_entry));
+	SRecord *run = malloc((n + 1) * sizeof(SRecord));
+	int *room = NULL, count = 0;
+	SHash_block block_data;
+	BF_Block *block;
+	BF_Block_Init(&block);
+
+	for (int i = 0; i < n; ++i) {
+		if (block_ids[i] < 0)
+			continue;
+		void *value = get_rec_member(&recs[i], handle->attr);
+		entries[count++] = (Build_entry) {
+			.bucket = SHT_Bucket(handle, value),
+			.srec = create_srecord(value, block_ids[i], handle->attr)
+		};
+	}
+	qsort_r(entries, count, sizeof(Build_entry), compare_build_entries, handle);
+
+	for (int start = 0, end; start < count; start = end) {
+		int run_num = 0, room_num = 0, zero = 0;
+		end = start + fold_bucket(handle, entries + start, count - start, run, &run_num);
+		int bucket = entries[start].bucket;
+
+		/* A single walk over the chain bumps the counters of stored pairs */
+		int block_t = handle->hash_table[bucket];
+		while (block_t != -1) {
+			bool dirty = false;
+			CALL_BF(BF_GetBlock(handle->file_desc, block_t, block), error);
+			char *data = BF_Block_GetData(block);
+			memcpy(&block_data, data, sizeof(SHash_block));
+			data = SHT_RECORDS(handle, data);
+
+			if (block_data.rec_num < handle->rec_capacity) {
+				room = realloc(room, (room_num + 1) * sizeof(int));
+				room[room_num++] = block_t;
+			}
+
+			for (int i = 0; i < block_data.rec_num; i++, data += sizeof(SRecord)) {
+				SRecord srec;
+				memcpy(&srec, data, sizeof(SRecord));
+
+				int low = 0, high = run_num - 1;
+				while (low <= high) {
+					int mid = (low + high) / 2;
+					int code = compare_srecords(&srec, &run[mid], handle->attr);
+					if (code == 0) {
+						srec.counter += run[mid].counter;
+						run[mid].counter = 0;
+						memcpy(data, &srec, sizeof(SRecord));
+						dirty = true;
+						break;
+					}
+					if (code < 0)
+						high = mid - 1;
+					else
+						low = mid + 1;
+				}
+			}
+			if (dirty)
+				BF_Block_SetDirty(block);
+			block_t = block_data.overf_block;
+			CALL_BF(BF_UnpinBlock(block), error);
+		}
+
+		int new_num = 0;
+		for (int i = 0; i < run_num; ++i)
+			if (run[i].counter > 0)
+				run[new_num++] = run[i];
+
+		int done = fill_room(handle, run, new_num, room, room_num);
+		if (done < 0 || write_chain(handle, run + done, new_num - done, 
+		                            &handle->hash_table[bucket], NULL, &zero) < 0)
+			goto error;
+		add_keys(handle, bucket, run, new_num);
+		handle->rec_count += new_num;
+	}
+
+	BF_Block_Destroy(&block);
+	free(entries);
+	free(run);
+	free(room);
+
+	while (handle->mode == LINEAR_HASH && 100 * handle->rec_count 
+	     > SPLIT_LOAD * handle->buckets * handle->rec_capacity)
+		if (SHT_SplitBucket(handle) < 0)
+			return -1;
+
+	return 0;
+
+	error:
+		BF_Block_Destroy(&block);
+		free(entries);
+		free(run);
+		free(room);
+		return -1;
+}
+
+
+static int SHT_UnloadBatch(SHash_file *handle, Record *recs, int n, int *block_ids) 
+{
+	Build_entry *entries = malloc((n + 1) * sizeof(Build_entry));
+	SRecord *run = malloc((n + 1) * sizeof(SRecord));
+	int count = 0;
+	SHash_block block_data;
+	BF_Block *block;
+	BF_Block_Init(&block);
+
+	for (int i = 0; i < n; ++i) {
+		if (block_ids[i] < 0)
+			continue;
+		void *value = get_rec_member(&recs[i], handle->attr);
+		entries[count++] = (Build_entry) {
+			.bucket = SHT_Bucket(handle, value),
+			.srec = create_srecord(value, block_ids[i], handle->attr)
+		};
+	}
+	qsort_r(entries, count, sizeof(Build_entry), compare_build_entries, handle);
+
+	for (int start = 0, end; start < count; start = end) {
+		int run_num = 0;
+		end = start + fold_bucket(handle, entries + start, count - start, run, &run_num);
+
+		/* A single walk over the chain drops the counters of stored pairs 
+		 * and packs each block over the entries that reach zero */
+		int block_t = handle->hash_table[entries[start].bucket];
+		while (block_t != -1) {
+			CALL_BF(BF_GetBlock(handle->file_desc, block_t, block), error);
+			char *data = BF_Block_GetData(block);
+			memcpy(&block_data, data, sizeof(SHash_block));
+			unsigned char *fingerprints = SHT_FINGERPRINTS(data);
+			char *records = SHT_RECORDS(handle, data);
+			int kept = 0;
+			bool dirty = false;
+
+			for (int i = 0; i < block_data.rec_num; i++) {
+				SRecord srec;
+				memcpy(&srec, records + i * sizeof(SRecord), sizeof(SRecord));
+
+				int low = 0, high = run_num - 1;
+				while (low <= high) {
+					int mid = (low + high) / 2;
+					int code = compare_srecords(&srec, &run[mid], handle->attr);
+					if (code == 0) {
+						int taken = srec.counter < run[mid].counter 
+							? srec.counter 
+							: run[mid].counter;
+						srec.counter -= taken;
+						run[mid].counter -= taken;
+						dirty = true;
+						break;
+					}
+					if (code < 0)
+						high = mid - 1;
+					else
+						low = mid + 1;
+				}
+				if (srec.counter == 0)
+					continue;
+				memcpy(records + kept * sizeof(SRecord), &srec, sizeof(SRecord));
+				fingerprints[kept++] = fingerprints[i];
+			}
+
+			handle->rec_count -= block_data.rec_num - kept;
+			block_data.rec_num = kept;
+			memcpy(data, &block_data, sizeof(SHash_block));
+			if (dirty)
+				BF_Block_SetDirty(block);
+			block_t = block_data.overf_block;
+			CALL_BF(BF_UnpinBlock(block), error);
+		}
+	}
+
+	BF_Block_Destroy(&block);
+	free(entries);
+	free(run);
+	return 0;
+
 	error:
 		BF_Block_Destroy(&block);
+		free(entries);
+		free(run);
 		return -1;
 }
 
@@ -407,14 +877,24 @@ static int SHT_FindEntry(SHash_file *handle, SRecord rec, Record_pos *rec_pos,
 		? (void*)&rec.key.ikey 
 		: (void*)rec.key.skey;
 
-	int size = get_attr_type(handle->attr) == STRING 
-		? strlen(value) + 1 
-		: get_attr_size(handle->attr);
+	int size = get_value_size(handle->attr, value);
 
-	int bucket = hash_key(get_attr_type(handle->attr), value) % handle->buckets;
+	int bucket = SHT_Bucket(handle, value);
 	int block_t = handle->hash_table[bucket];
 	bool found = false;
 	SHash_block block_data;
+	unsigned char fingerprint = key_fingerprint(get_attr_type(handle->attr), value);
+	uint64_t mask[MATCH_WORDS(handle->rec_capacity)];
+
+	/* Keys missing from the bucket's filter are not in its chain, 
+	 * so inserts only look for room, without comparing keys */
+	bool absent = !bloom_test(
+		BUCKET_BLOOM(handle, bucket), 
+		BLOOM_BUCKET_SIZE, 
+		hash_key(get_attr_type(handle->attr), value)
+	);
+	if (absent && empty_block == NULL)
+		return 0;
 
 	BF_Block_Init(&block);
 	while (block_t != -1) {
@@ -428,15 +908,27 @@ static int SHT_FindEntry(SHash_file *handle, SRecord rec, Record_pos *rec_pos,
 		);
 		char *data = BF_Block_GetData(block);
 		memcpy(&block_data, data, sizeof(SHash_block));
-		data += sizeof(SHash_block);
 
 		if (empty_block != NULL && *empty_block < 0
 		 && block_data.rec_num != handle->rec_capacity)
 		 	*empty_block = block_t;
 
-		for (int i = 0; i < block_data.rec_num; i++, data += sizeof(SRecord)) {
+		if (absent) {
+			CALL_BF(BF_UnpinBlock(block), error);
+			if (*empty_block >= 0)
+				break;
+			block_t = block_data.overf_block;
+			continue;
+		}
+
+		/* Only entries with the value's fingerprint have their keys compared */
+		match_bytes(SHT_FINGERPRINTS(data), block_data.rec_num, fingerprint, mask);
+		data = SHT_RECORDS(handle, data);
+
+		for (int i = match_next(mask, 0, block_data.rec_num); i < block_data.rec_num; 
+		         i = match_next(mask, i + 1, block_data.rec_num)) {
 			SRecord rec_;
-			memcpy(&rec_, data, sizeof(SRecord));
+			memcpy(&rec_, data + i * sizeof(SRecord), sizeof(SRecord));
 			void *value_ = get_attr_type(handle->attr) == STRING
 				? (void*)rec_.key.skey
 				: (void*)&rec_.key.ikey;
@@ -468,42 +960,305 @@ static int SHT_FindEntry(SHash_file *handle, SRecord rec, Record_pos *rec_pos,
 		return -1;
 }
 
-static int SHT_GetHTRecords(SHash_file *handle, Hash_file *ht_handle, 
-												int block_id, void *value, 
-												Dl_list records) 
+/* Splits the bucket under the split pointer into itself and a new bucket 
+ * at the end of the directory, reusing the blocks of the old chain */
+static int SHT_SplitBucket(SHash_file *handle) 
 {
+	int round = handle->init_buckets << handle->level;
+	int old_bucket = handle->next;
+	int old_head = -1, new_head = -1;
+	int count = 0, blocks_num = 0;
+	SRecord *recs = NULL, *moved = NULL;
+	int *blocks = NULL;
+	SHash_block block_data;
 	BF_Block *block;
+
+	/* The directory grows before any block is rewritten, so a failed 
+	 * allocation leaves the index as it was */
+	int *hash_table = realloc(handle->hash_table, (handle->buckets + 1) * sizeof(int));
+	if (hash_table == NULL)
+		return -1;
+	handle->hash_table = hash_table;
+
+	unsigned char *bloom = realloc(handle->bloom, (handle->buckets + 1) * BLOOM_BUCKET_SIZE);
+	if (bloom == NULL)
+		return -1;
+	handle->bloom = bloom;
+
 	BF_Block_Init(&block);
-	CALL_BF(BF_GetBlock(ht_handle->file_desc, block_id, block), error);
-	char *data = BF_Block_GetData(block);
-	Hash_block block_data;
-	memcpy(&block_data, data, sizeof(Hash_block));
-	data += sizeof(Hash_block);
-	
-	int offset = get_attr_offset(handle->attr);
-	int size = get_attr_type(handle->attr) == STRING 
-		? strlen(value) + 1
-		: get_attr_size(handle->attr);
-
-	for (int j = 0; j < block_data.rec_num; j++, data += sizeof(Record)) {
-		if (memcmp(data + offset, value, size) == 0) {
-			Record *rec = malloc(sizeof(*rec));
-			list_insert(records, memcpy(rec, data, sizeof(*rec)));
-		}
+	int block_t = handle->hash_table[old_bucket];
+	while (block_t != -1) {
+		CALL_BF(BF_GetBlock(handle->file_desc, block_t, block), error);
+		char *data = BF_Block_GetData(block);
+		memcpy(&block_data, data, sizeof(SHash_block));
+
+		blocks = realloc(blocks, (blocks_num + 1) * sizeof(int));
+		recs = realloc(recs, (count + block_data.rec_num) * sizeof(SRecord));
+		blocks[blocks_num++] = block_t;
+		memcpy(
+			recs + count, 
+			SHT_RECORDS(handle, data), 
+			block_data.rec_num * sizeof(SRecord)
+		);
+		count += block_data.rec_num;
+		block_t = block_data.overf_block;
+		CALL_BF(BF_UnpinBlock(block), error);
 	}
-	CALL_BF(BF_UnpinBlock(block), error);
 
+	int stay = 0;
+	moved = malloc((count + 1) * sizeof(SRecord));
+	for (int i = 0; i < count; ++i) {
+		void *value = get_attr_type(handle->attr) == INT
+			? (void*)&recs[i].key.ikey
+			: (void*)recs[i].key.skey;
+
+		if (hash_key(get_attr_type(handle->attr), value) % (2 * round) == old_bucket)
+			recs[stay++] = recs[i];
+		else
+			moved[i - stay] = recs[i];
+	}
+
+	if (write_chain(handle, recs, stay, &old_head, blocks, &blocks_num) < 0
+	 || write_chain(handle, moved, count - stay, &new_head, blocks, &blocks_num) < 0)
+		goto error;
+
+	/* Blocks left over from the old chain stay in it as empty blocks */
+	for (; blocks_num > 0; blocks_num--) {
+		block_data = (SHash_block) { .rec_num = 0, .overf_block = old_head };
+		old_head = blocks[blocks_num - 1];
+		CALL_BF(BF_GetBlock(handle->file_desc, old_head, block), error);
+		memcpy(BF_Block_GetData(block), &block_data, sizeof(SHash_block));
+		BF_Block_SetDirty(block);
+		CALL_BF(BF_UnpinBlock(block), error);
+	}
+
+	handle->hash_table[old_bucket] = old_head;
+	handle->hash_table[handle->buckets] = new_head;
+
+	/* Both halves get filters with only their own keys */
+	memset(BUCKET_BLOOM(handle, old_bucket), 0, BLOOM_BUCKET_SIZE);
+	memset(BUCKET_BLOOM(handle, handle->buckets), 0, BLOOM_BUCKET_SIZE);
+	add_keys(handle, old_bucket, recs, stay);
+	add_keys(handle, handle->buckets++, moved, count - stay);
+	if (++handle->next == round) {
+		handle->next = 0;
+		handle->level++;
+	}
+
+	BF_Block_Destroy(&block);
+	free(recs);
+	free(moved);
+	free(blocks);
+	return 0;
+
+	error:
+		BF_Block_Destroy(&block);
+		free(recs);
+		free(moved);
+		free(blocks);
+		return -1;
+}
+
+/* Packs recs into a chain in front of *head, taking blocks from the end 
+ * of blocks and allocating new ones once it runs out */
+static int write_chain(SHash_file *handle, SRecord *recs, int count, 
+                                                          int *head, 
+                                                          int *blocks, 
+                                                          int *blocks_num) 
+{
+	BF_Block *block;
+	BF_Block_Init(&block);
+
+	for (int end = count; end > 0; end -= handle->rec_capacity) {
+		int start = end > handle->rec_capacity ? end - handle->rec_capacity : 0;
+		int block_t;
+
+		if (*blocks_num > 0) {
+			block_t = blocks[--(*blocks_num)];
+			CALL_BF(BF_GetBlock(handle->file_desc, block_t, block), error);
+		} else {
+			CALL_BF(BF_AllocateBlock(handle->file_desc, block), error);
+			CALL_BF(BF_GetBlockCounter(handle->file_desc, &block_t), unpin);
+			--block_t;
+		}
+
+		SHash_block block_data = {
+			.rec_num = end - start,
+			.overf_block = *head
+		};
+		char *data = BF_Block_GetData(block);
+		memcpy(data, &block_data, sizeof(SHash_block));
+		memcpy(
+			SHT_RECORDS(handle, data), 
+			recs + start, 
+			(end - start) * sizeof(SRecord)
+		);
+		for (int i = start; i < end; ++i)
+			SHT_FINGERPRINTS(data)[i - start] = srecord_fingerprint(&recs[i], handle->attr);
+		*head = block_t;
+
+		BF_Block_SetDirty(block);
+		CALL_BF(BF_UnpinBlock(block), error);
+	}
 	BF_Block_Destroy(&block);
 	return 0;
 
+	unpin:
+		BF_UnpinBlock(block);
+	error:
+		BF_Block_Destroy(&block);
+		return -1;
+}
+
+/* Folds the equal pairs at the front of entries that share a bucket into 
+ * run and returns how many entries it consumed */
+static int fold_bucket(SHash_file *handle, Build_entry *entries, int count, 
+                                                                 SRecord *run, 
+                                                                 int *run_num) 
+{
+	int end;
+	for (end = 0; end < count && entries[end].bucket == entries[0].bucket; ++end) {
+		if (*run_num > 0 && !compare_srecords(&run[*run_num - 1], &entries[end].srec, handle->attr))
+			run[*run_num - 1].counter += entries[end].srec.counter;
+		else
+			run[(*run_num)++] = entries[end].srec;
+	}
+	return end;
+}
+
+/* Copies recs into the free slots of the room blocks and returns how many 
+ * of them were placed */
+static int fill_room(SHash_file *handle, SRecord *recs, int count, 
+                                                        int *room, 
+                                                        int room_num) 
+{
+	int done = 0;
+	BF_Block *block;
+	BF_Block_Init(&block);
+
+	for (int i = 0; i < room_num && done < count; ++i) {
+		CALL_BF(BF_GetBlock(handle->file_desc, room[i], block), error);
+		char *data = BF_Block_GetData(block);
+		while (done < count && *(int*)(data + offsetof(SHash_block, rec_num)) 
+		                     < handle->rec_capacity)
+			update_data(handle, data, "insert", &recs[done++], false);
+
+		BF_Block_SetDirty(block);
+		CALL_BF(BF_UnpinBlock(block), error);
+	}
+	BF_Block_Destroy(&block);
+	return done;
+
 	error:
 		BF_Block_Destroy(&block);
 		return -1;
+}
+
+static int SHT_Bucket(SHash_file *handle, void *value) 
+{
+	size_t hash = hash_key(get_attr_type(handle->attr), value);
+	if (handle->mode != LINEAR_HASH)
+		return hash % handle->buckets;
+
+	int round = handle->init_buckets << handle->level;
+	return hash % round < handle->next
+		? hash % (2 * round)
+		: hash % round;
+}
+
+static void add_keys(SHash_file *handle, int bucket, SRecord *recs, int count) 
+{
+	for (int i = 0; i < count; ++i)
+		bloom_add(
+			BUCKET_BLOOM(handle, bucket), 
+			BLOOM_BUCKET_SIZE, 
+			hash_key(get_attr_type(handle->attr), srecord_key(&recs[i], handle->attr))
+		);
+}
+
+static int compare_build_entries(const void *a, const void *b, void *handle) 
+{
+	const Build_entry *a_ = a, *b_ = b;
+	rec_attr attr = ((SHash_file*)handle)->attr;
+
+	if (a_->bucket != b_->bucket)
+		return a_->bucket - b_->bucket;
+
+	return compare_srecords((SRecord*)&a_->srec, (SRecord*)&b_->srec, attr);
+}
+
+static int compare_srecords(SRecord *a, SRecord *b, rec_attr attr) 
+{
+	int code = compare_keys(srecord_key(a, attr), srecord_key(b, attr), attr);
+	return code != 0 ? code : a->block_id - b->block_id;
+}
+
+/* Gathers the primary blocks of the index entries with the scan's value, 
+ * sorted and without duplicates */
+static int collect_blocks(SHT_Scan *scan, int index_block) 
+{
+	SHash_block index_data;
+	BF_Block *index;
+	BF_Block_Init(&index);
+
+	int count = 0;
+	while (index_block != -1) {
+		CALL_BF(BF_GetBlock(scan->handle->file_desc, index_block, index), error);
+		char *data = BF_Block_GetData(index);
+		memcpy(&index_data, data, sizeof(SHash_block));
+		unsigned char *fingerprints = SHT_FINGERPRINTS(data);
+		data = SHT_RECORDS(scan->handle, data);
+
+		/* Only entries with the value's fingerprint have their keys compared */
+		for (int i = 0; i < index_data.rec_num; ++i) {
+			SRecord srec;
+			if (fingerprints[i] != scan->fingerprint)
+				continue;
+			memcpy(&srec, data + i * sizeof(SRecord), sizeof(SRecord));
+			if (memcmp(srecord_key(&srec, scan->handle->attr), scan->value, scan->size) == 0) {
+				scan->block_ids = realloc(scan->block_ids, (count + 1) * sizeof(int));
+				scan->block_ids[count++] = srec.block_id;
+			}
+		}
+		index_block = index_data.overf_block;
+		CALL_BF(BF_UnpinBlock(index), error);
+	}
+	BF_Block_Destroy(&index);
+
+	if (count == 0)
+		return 0;
+
+	qsort(scan->block_ids, count, sizeof(int), compare_block_ids);
+	int unique = 0;
+	for (int i = 0; i < count; ++i)
+		if (unique == 0 || scan->block_ids[i] != scan->block_ids[unique - 1])
+			scan->block_ids[unique++] = scan->block_ids[i];
+	return unique;
+
+	error:
+		BF_Block_Destroy(&index);
+		return -1;
+}
 
+static int compare_block_ids(const void *a, const void *b) 
+{
+	return *(const int*)a - *(const int*)b;
+}
+
+static void *srecord_key(SRecord *srec, rec_attr attr) 
+{
+	return get_attr_type(attr) == INT
+		? (void*)&srec->key.ikey
+		: (void*)srec->key.skey;
 }
 
+static unsigned char srecord_fingerprint(SRecord *srec, rec_attr attr) 
+{
+	return key_fingerprint(get_attr_type(attr), srecord_key(srec, attr));
+}
 
-static void update_data(char *data, char *action, void *value, bool is_dup) 
+static void update_data(SHash_file *handle, char *data, char *action, void *value, 
+                                                                      bool is_dup) 
 {
 	int rec_num, new;
 	bool is_delete = strcmp(action, "delete") == 0;
@@ -527,7 +1282,8 @@ static void update_data(char *data, char *action, void *value, bool is_dup)
 
 	write_data: {
 		int offset = is_dup || is_delete ? *(int*)value : rec_num;
-		data += offset * sizeof(SRecord) + sizeof(SHash_block);
+		unsigned char *fingerprints = SHT_FINGERPRINTS(data);
+		data = SHT_RECORDS(handle, data) + offset * sizeof(SRecord);
 	
 		if (is_dup) {
 			SRecord rec;
@@ -536,7 +1292,13 @@ static void update_data(char *data, char *action, void *value, bool is_dup)
 			memcpy(data, &rec, sizeof(SRecord));
 		} else if (!is_delete) {
 			memcpy(data, value, sizeof(SRecord));
+			fingerprints[offset] = srecord_fingerprint(value, handle->attr);
 		} else {
+			memmove(
+				fingerprints + offset, 
+				fingerprints + offset + 1, 
+				rec_num - offset - 1
+			);
 			memmove(
 				data,
 				data + sizeof(SRecord),
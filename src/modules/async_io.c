@@ -0,0 +1,376 @@
+#include "common.h"
+#include "async_io.h"
+
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+
+typedef struct {
+	bool used;
+	int tag;
+	int fd;
+	struct iovec iov;
+	off_t offset;
+	ssize_t bytes;
+} Slot;
+
+typedef struct {
+	int fd;
+	void *sq_ring;
+	void *cq_ring;
+	size_t sq_size;
+	size_t cq_size;
+	size_t sqes_size;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned queued;
+} Ring;
+
+typedef struct {
+	pthread_t threads[ASYNC_THREADS];
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t done;
+	int queue[ASYNC_DEPTH];
+	int completed[ASYNC_DEPTH];
+	int queued;
+	int queue_head;
+	int completed_num;
+	bool stop;
+} Pool;
+
+
+static bool ring_init();
+static void ring_close();
+static bool ring_submit(int slot);
+static void ring_flush();
+static int ring_reap(Async_read *done, int max, bool wait);
+static bool pool_init();
+static void pool_close();
+static bool pool_submit(int slot);
+static int pool_reap(Async_read *done, int max, bool wait);
+static void *pool_worker(void *arg);
+static int finish_slot(int slot, ssize_t bytes, Async_read *done);
+
+static async_backend active = ASYNC_AUTO;
+static Slot slots[ASYNC_DEPTH];
+static int pending = 0;
+static Ring ring = { .fd = -1 };
+static Pool pool;
+static int failed[ASYNC_DEPTH];
+static int failed_num = 0;
+
+
+
+/* io_uring is tried first; kernels or sandboxes without it get worker threads */
+int async_init(async_backend backend) 
+{
+	if (active != ASYNC_AUTO)
+		return 0;
+
+	memset(slots, 0, sizeof(slots));
+	pending = failed_num = 0;
+	if (backend != ASYNC_THREAD_POOL && ring_init())
+		active = ASYNC_IO_URING;
+	else if (backend != ASYNC_IO_URING && pool_init())
+		active = ASYNC_THREAD_POOL;
+	return active == ASYNC_AUTO ? -1 : 0;
+}
+
+/* Queues a read of size bytes at offset into buf, reported later with the tag. 
+ * Fails when ASYNC_DEPTH reads are already pending */
+bool async_submit(int tag, int fd, void *buf, size_t size, off_t offset) 
+{
+	int slot;
+	for (slot = 0; slot < ASYNC_DEPTH && slots[slot].used; ++slot);
+	if (active == ASYNC_AUTO || slot == ASYNC_DEPTH)
+		return false;
+
+	slots[slot] = (Slot) { 
+		.used = true, 
+		.tag = tag, 
+		.fd = fd, 
+		.iov = { .iov_base = buf, .iov_len = size }, 
+		.offset = offset 
+	};
+	if (!(active == ASYNC_IO_URING ? ring_submit(slot) : pool_submit(slot))) {
+		slots[slot].used = false;
+		return false;
+	}
+	pending++;
+	return true;
+}
+
+/* Starts the queued reads at once. Reads the kernel does not take fail with EAGAIN */
+void async_flush() 
+{
+	if (active == ASYNC_IO_URING)
+		ring_flush();
+}
+
+/* Returns up to max finished reads, waiting for one if wait is set and any is pending. 
+ * Failed reads have the negated errno as bytes */
+int async_reap(Async_read *done, int max, bool wait) 
+{
+	if (active == ASYNC_AUTO || pending == 0)
+		return 0;
+
+	int count = 0;
+	while (failed_num > 0 && count < max)
+		count += finish_slot(failed[--failed_num], -EAGAIN, &done[count]);
+	if (count > 0)
+		return count;
+
+	wait = wait && max > 0;
+	return active == ASYNC_IO_URING ? ring_reap(done, max, wait) : pool_reap(done, max, wait);
+}
+
+/* Waits until a finished read can be reaped, without reaping it. Needs no lock as 
+ * long as one thread waits at a time and no other thread reaps meanwhile */
+void async_wait() 
+{
+	if (active == ASYNC_IO_URING) {
+		unsigned head = __atomic_load_n(ring.cq_head, __ATOMIC_RELAXED);
+		if (head == __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE))
+			while (syscall(__NR_io_uring_enter, ring.fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 
+			    && errno == EINTR);
+	} else if (active == ASYNC_THREAD_POOL) {
+		pthread_mutex_lock(&pool.lock);
+		while (pool.completed_num == 0)
+			pthread_cond_wait(&pool.done, &pool.lock);
+		pthread_mutex_unlock(&pool.lock);
+	}
+}
+
+int async_pending() 
+{
+	return pending;
+}
+
+/* Waits for the pending reads, whose results are dropped */
+void async_close() 
+{
+	Async_read done[ASYNC_DEPTH];
+	async_flush();
+	while (pending > 0)
+		async_reap(done, ASYNC_DEPTH, true);
+
+	if (active == ASYNC_IO_URING)
+		ring_close();
+	else if (active == ASYNC_THREAD_POOL)
+		pool_close();
+	active = ASYNC_AUTO;
+}
+
+
+static bool ring_init() 
+{
+	struct io_uring_params params = { 0 };
+	int fd = syscall(__NR_io_uring_setup, ASYNC_DEPTH, &params);
+	if (fd < 0)
+		return false;
+
+	ring.fd = fd;
+	ring.sq_size   = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring.cq_size   = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring.sq_ring = mmap(NULL, ring.sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, 
+	                                                                fd, IORING_OFF_SQ_RING);
+	ring.cq_ring = mmap(NULL, ring.cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, 
+	                                                                fd, IORING_OFF_CQ_RING);
+	ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, 
+	                                                               fd, IORING_OFF_SQES);
+	if (ring.sq_ring == MAP_FAILED || ring.cq_ring == MAP_FAILED || ring.sqes == MAP_FAILED) {
+		ring_close();
+		return false;
+	}
+
+	char *sq = ring.sq_ring, *cq = ring.cq_ring;
+	ring.sq_head  = (unsigned*)(sq + params.sq_off.head);
+	ring.sq_tail  = (unsigned*)(sq + params.sq_off.tail);
+	ring.sq_mask  = (unsigned*)(sq + params.sq_off.ring_mask);
+	ring.sq_array = (unsigned*)(sq + params.sq_off.array);
+	ring.cq_head  = (unsigned*)(cq + params.cq_off.head);
+	ring.cq_tail  = (unsigned*)(cq + params.cq_off.tail);
+	ring.cq_mask  = (unsigned*)(cq + params.cq_off.ring_mask);
+	ring.cqes     = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+	return true;
+}
+
+static void ring_close() 
+{
+	if (ring.sq_ring != NULL && ring.sq_ring != MAP_FAILED)
+		munmap(ring.sq_ring, ring.sq_size);
+	if (ring.cq_ring != NULL && ring.cq_ring != MAP_FAILED)
+		munmap(ring.cq_ring, ring.cq_size);
+	if (ring.sqes != NULL && ring.sqes != MAP_FAILED)
+		munmap(ring.sqes, ring.sqes_size);
+	close(ring.fd);
+	ring = (Ring) { .fd = -1 };
+}
+
+/* Readv needs no newer kernel than io_uring itself */
+static bool ring_submit(int slot) 
+{
+	unsigned tail = *ring.sq_tail, index = tail & *ring.sq_mask;
+	if (tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) > *ring.sq_mask)
+		return false;
+
+	struct io_uring_sqe *sqe = &ring.sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode    = IORING_OP_READV;
+	sqe->fd        = slots[slot].fd;
+	sqe->addr      = (unsigned long)&slots[slot].iov;
+	sqe->len       = 1;
+	sqe->off       = slots[slot].offset;
+	sqe->user_data = slot;
+	ring.sq_array[index] = index;
+	__atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring.queued++;
+	return true;
+}
+
+static void ring_flush() 
+{
+	int code;
+	while (ring.queued > 0) {
+		while ((code = syscall(__NR_io_uring_enter, ring.fd, ring.queued, 0, 0, NULL, 0)) < 0 
+		    && errno == EINTR);
+		if (code <= 0)
+			break;
+		ring.queued -= code;
+	}
+
+	/* The entries that were not consumed are taken back */
+	unsigned tail = *ring.sq_tail;
+	for (; ring.queued > 0; --ring.queued) {
+		struct io_uring_sqe *sqe = &ring.sqes[--tail & *ring.sq_mask];
+		failed[failed_num++] = sqe->user_data;
+	}
+	__atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+}
+
+static int ring_reap(Async_read *done, int max, bool wait) 
+{
+	unsigned head = *ring.cq_head;
+	if (wait && head == __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE))
+		while (syscall(__NR_io_uring_enter, ring.fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 
+		    && errno == EINTR);
+
+	int count = 0;
+	unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail && count < max; ++head) {
+		struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+		count += finish_slot(cqe->user_data, cqe->res, &done[count]);
+	}
+	__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+	return count;
+}
+
+
+static bool pool_init() 
+{
+	memset(&pool, 0, sizeof(pool));
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.work, NULL);
+	pthread_cond_init(&pool.done, NULL);
+
+	for (int i = 0; i < ASYNC_THREADS; ++i) {
+		if (pthread_create(&pool.threads[i], NULL, pool_worker, NULL) != 0) {
+			for (int j = i; j < ASYNC_THREADS; ++j)
+				pool.threads[j] = pthread_self();
+			pool_close();
+			return false;
+		}
+	}
+	return true;
+}
+
+static void pool_close() 
+{
+	pthread_mutex_lock(&pool.lock);
+	pool.stop = true;
+	pthread_cond_broadcast(&pool.work);
+	pthread_mutex_unlock(&pool.lock);
+
+	for (int i = 0; i < ASYNC_THREADS; ++i) {
+		if (!pthread_equal(pool.threads[i], pthread_self()))
+			pthread_join(pool.threads[i], NULL);
+	}
+	pthread_cond_destroy(&pool.work);
+	pthread_cond_destroy(&pool.done);
+	pthread_mutex_destroy(&pool.lock);
+}
+
+static bool pool_submit(int slot) 
+{
+	pthread_mutex_lock(&pool.lock);
+	pool.queue[(pool.queue_head + pool.queued++) % ASYNC_DEPTH] = slot;
+	pthread_cond_signal(&pool.work);
+	pthread_mutex_unlock(&pool.lock);
+	return true;
+}
+
+static int pool_reap(Async_read *done, int max, bool wait) 
+{
+	int count = 0;
+	pthread_mutex_lock(&pool.lock);
+	while (wait && pool.completed_num == 0)
+		pthread_cond_wait(&pool.done, &pool.lock);
+
+	while (pool.completed_num > 0 && count < max) {
+		int slot = pool.completed[--pool.completed_num];
+		count += finish_slot(slot, slots[slot].bytes, &done[count]);
+	}
+	pthread_mutex_unlock(&pool.lock);
+	return count;
+}
+
+/* Workers only touch the slots they dequeue and the queues, under the lock */
+static void *pool_worker(void *arg) 
+{
+	pthread_mutex_lock(&pool.lock);
+	while (true) {
+		while (!pool.stop && pool.queued == 0)
+			pthread_cond_wait(&pool.work, &pool.lock);
+		if (pool.stop)
+			break;
+
+		int slot = pool.queue[pool.queue_head];
+		pool.queue_head = (pool.queue_head + 1) % ASYNC_DEPTH;
+		pool.queued--;
+		pthread_mutex_unlock(&pool.lock);
+
+		Slot *read = &slots[slot];
+		ssize_t bytes = preadv(read->fd, &read->iov, 1, read->offset);
+		if (bytes == -1)
+			bytes = -errno;
+
+		pthread_mutex_lock(&pool.lock);
+		read->bytes = bytes;
+		pool.completed[pool.completed_num++] = slot;
+		pthread_cond_signal(&pool.done);
+	}
+	pthread_mutex_unlock(&pool.lock);
+	return NULL;
+}
+
+
+static int finish_slot(int slot, ssize_t bytes, Async_read *done) 
+{
+	*done = (Async_read) { .tag = slots[slot].tag, .bytes = bytes };
+	slots[slot].used = false;
+	pending--;
+	return 1;
+}
@@ -0,0 +1,1280 @@
+#include "common.h"
+#include "async_io.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
+
+#define BF_MAGIC "BF-FILE"
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+/* Every BF call holds the pool lock until it returns, except while it waits for a block 
+ * read or write, which other threads wait for on frame_ready if they need the block */
+#define LOCK_POOL pthread_mutex_t *pool_guard __attribute__((cleanup(unlock_pool))) = lock_pool()
+
+
+struct BF_Block {
+	int frame;
+	int file;
+	int block_num;
+	bool pinned;
+	char *data;
+};
+
+typedef struct {
+	char magic[8];
+	int block_size;
+} BF_Header;
+
+/* Lists of frames, one or more per replacement policy */
+typedef enum {
+	NO_LIST,
+	RECENT,
+	A1_IN, A1_OUT, AM,
+	T1, T2, B1, B2,
+	CLOCK,
+	LISTS
+} List_id;
+
+typedef struct {
+	int head;
+	int tail;
+	int size;
+} List;
+
+/* The first frames_num entries hold blocks, the rest remember evicted ones */
+typedef struct {
+	int file;
+	int block_num;
+	int pins;
+	bool dirty;
+	int size;
+	char *data;
+	int chain;
+	int prev;
+	int next;
+	List_id list;
+	bool hot;
+	bool test;
+	bool ref;
+	bool loading;
+	bool prefetched;
+	int evicted_file;
+	int evicted_block;
+} Frame;
+
+typedef struct {
+	bool open;
+	int fd;
+	int block_size;
+	off_t offset;
+	int blocks;
+	bool mapped;
+	char *map;
+	size_t map_size;
+	int sequential_scans;
+} File;
+
+
+static bool valid_file(int file_desc);
+static BF_ErrorCode open_file(const char *filename, bool mapped, int *file_desc);
+static BF_ErrorCode close_file(int file_desc);
+static bool valid_block_size(int block_size);
+static off_t block_offset(const File *file, int block_num);
+static int *table_slot(int file, int block_num);
+static int find_frame(int file, int block_num);
+static void table_remove(int i);
+static void list_push(List_id id, int i);
+static void list_remove(int i);
+static void ring_insert(int i);
+static void ring_remove(int i);
+static void ring_replace(int i, int g);
+static int first_unpinned(List_id id, bool from_tail);
+static void touch_frame(int i);
+static List_id forget_ghost(int file, int block_num);
+static void drop_ghost(int g);
+static void remember(List_id id, int i);
+static void arc_trim();
+static int clock_cold();
+static bool clock_hot();
+static void clock_test();
+static void end_test(int i);
+static int victim_frame(List_id ghost);
+static void evict_frame(int i);
+static void place_frame(int i, List_id ghost);
+static void free_frame(int i);
+static BF_ErrorCode flush_frame(Frame *frame);
+static BF_ErrorCode load_block(int file, int block_num, BF_Block *block, bool fresh);
+static BF_ErrorCode claim_frame(int file, int block_num, bool fresh, int *frame_index);
+static BF_ErrorCode write_evicted(int i);
+static BF_ErrorCode read_frame(int i);
+static int busy_frame(int file, int block_num);
+static int find_evicted(int file, int block_num);
+static void wait_frame(int i);
+static void wait_file(int file_desc);
+static void discard_frame(int i);
+static void finish_reads(bool wait);
+static void finish_read(int i, ssize_t bytes);
+static void unmark_prefetched(int i);
+static BF_ErrorCode advise_blocks(File *file, const int *block_nums, int n);
+static void release_pin(BF_Block *block);
+static pthread_mutex_t *lock_pool();
+static void unlock_pool(pthread_mutex_t **lock);
+
+static Frame *frames = NULL;
+static File *files = NULL;
+static int *table = NULL;
+static int frames_num, files_num, table_size;
+static int free_head, ghost_head;
+static List lists[LISTS];
+static int arc_target, cold_target, hot_count;
+static int prefetched_count;
+static int evicted_count;
+static bool reaping;
+static int hand_hot, hand_cold, hand_test;
+static bool arc_forget;
+static bool active = false;
+static ReplacementAlgorithm policy;
+static BF_Stats stats;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t frame_ready = PTHREAD_COND_INITIALIZER;
+
+
+
+void BF_Block_Init(BF_Block **block) 
+{
+	*block = malloc(sizeof(**block));
+	(*block)->frame  = -1;
+	(*block)->pinned = false;
+	(*block)->data   = NULL;
+}
+
+void BF_Block_Destroy(BF_Block **block) 
+{
+	LOCK_POOL;
+	release_pin(*block);
+	free(*block);
+	*block = NULL;
+}
+
+/* Blocks of mapped files have no frame and are never written */
+void BF_Block_SetDirty(BF_Block *block) 
+{
+	LOCK_POOL;
+	if (block->frame >= 0)
+		frames[block->frame].dirty = true;
+}
+
+char *BF_Block_GetData(const BF_Block *block) 
+{
+	return block->data;
+}
+
+int BF_Block_GetNum(const BF_Block *block) 
+{
+	return block->block_num;
+}
+
+BF_ErrorCode BF_Init(const ReplacementAlgorithm repl_alg) 
+{
+	return BF_InitEx(repl_alg, BF_BUFFER_SIZE, BF_MAX_OPEN_FILES);
+}
+
+/* Frames are found through a hash table on (file, block) and kept in the 
+ * lists of the policy, so neither lookups nor evictions grow with the pool. 
+ * Evicted blocks are remembered in as many extra entries as there are frames */
+BF_ErrorCode BF_InitEx(const ReplacementAlgorithm repl_alg, int frames_count, int max_files) 
+{
+	LOCK_POOL;
+	if (active)
+		return BF_ACTIVE_ERROR;
+	if (frames_count <= 0 || max_files <= 0 || repl_alg < LRU || repl_alg > CLOCK_PRO)
+		return BF_ERROR;
+
+	for (table_size = 1; table_size < 2 * frames_count; table_size *= 2);
+	frames = malloc(2 * frames_count * sizeof(Frame));
+	files  = calloc(max_files, sizeof(File));
+	table  = malloc(table_size * sizeof(int));
+	if (frames == NULL || files == NULL || table == NULL) {
+		free(frames);
+		free(files);
+		free(table);
+		return BF_ERROR;
+	}
+
+	frames_num = frames_count;
+	files_num  = max_files;
+	free_head  = ghost_head = -1;
+	memset(table, -1, table_size * sizeof(int));
+	for (int i = 2 * frames_num - 1; i >= 0; --i) {
+		frames[i] = (Frame) { .file = -1, .chain = -1, .evicted_file = -1 };
+		free_frame(i);
+	}
+	for (int id = 0; id < LISTS; ++id)
+		lists[id] = (List) { .head = -1, .tail = -1 };
+
+	arc_target  = 0;
+	arc_forget  = false;
+	cold_target = 1;
+	hot_count   = 0;
+	prefetched_count = 0;
+	evicted_count    = 0;
+	reaping     = false;
+	hand_hot    = hand_cold = hand_test = -1;
+
+	policy = repl_alg;
+	stats  = (BF_Stats) { 0 };
+	active = true;
+	return BF_OK;
+}
+
+BF_ErrorCode BF_CreateFile(const char *filename) 
+{
+	return BF_CreateFileEx(filename, BF_BLOCK_SIZE);
+}
+
+/* The block size is kept in a header of BF_BLOCK_SIZE bytes in front of block 0 */
+BF_ErrorCode BF_CreateFileEx(const char *filename, int block_size) 
+{
+	if (!valid_block_size(block_size))
+		return BF_INVALID_BLOCK_SIZE_ERROR;
+
+	int fd = open(filename, O_CREAT | O_EXCL | O_WRONLY, 0644);
+	if (fd == -1)
+		return errno == EEXIST ? BF_FILE_ALREADY_EXISTS : BF_ERROR;
+
+	char data[BF_BLOCK_SIZE] = { 0 };
+	BF_Header header = { .magic = BF_MAGIC, .block_size = block_size };
+	memcpy(data, &header, sizeof(header));
+
+	bool written = write(fd, data, sizeof(data)) == sizeof(data);
+	if (close(fd) == -1 || !written)
+		return BF_ERROR;
+	return BF_OK;
+}
+
+BF_ErrorCode BF_OpenFile(const char *filename, int *file_desc) 
+{
+	LOCK_POOL;
+	return open_file(filename, false, file_desc);
+}
+
+BF_ErrorCode BF_OpenFileMapped(const char *filename, int *file_desc) 
+{
+	LOCK_POOL;
+	return open_file(filename, true, file_desc);
+}
+
+/* Files with pinned blocks stay open, as with the original BF library. 
+ * Prefetches still in flight hold pins of their own, so they are waited for first */
+BF_ErrorCode BF_CloseFile(const int file_desc) 
+{
+	LOCK_POOL;
+	if (valid_file(file_desc))
+		wait_file(file_desc);
+	if (!valid_file(file_desc))
+		return BF_INVALID_FILE_ERROR;
+
+	for (int i = 0; i < frames_num; ++i) {
+		if (frames[i].file == file_desc && frames[i].pins > 0)
+			return BF_AVAILABLE_PIN_BLOCKS_ERROR;
+	}
+	return close_file(file_desc);
+}
+
+BF_ErrorCode BF_GetBlockCounter(const int file_desc, int *blocks_num) 
+{
+	LOCK_POOL;
+	if (!valid_file(file_desc))
+		return BF_INVALID_FILE_ERROR;
+
+	*blocks_num = files[file_desc].blocks;
+	return BF_OK;
+}
+
+BF_ErrorCode BF_GetBlockSize(const int file_desc, int *block_size) 
+{
+	LOCK_POOL;
+	if (!valid_file(file_desc))
+		return BF_INVALID_FILE_ERROR;
+
+	*block_size = files[file_desc].block_size;
+	return BF_OK;
+}
+
+BF_ErrorCode BF_AllocateBlock(const int file_desc, BF_Block *block) 
+{
+	LOCK_POOL;
+	if (!valid_file(file_desc))
+		return BF_INVALID_FILE_ERROR;
+	if (files[file_desc].mapped)
+		return BF_READ_ONLY_ERROR;
+
+	/* The number is taken before the pool lock can be dropped, so allocations 
+	 * running together get blocks of their own */
+	int block_num = files[file_desc].blocks++;
+	BF_ErrorCode code = load_block(file_desc, block_num, block, true);
+	if (code != BF_OK && files[file_desc].blocks == block_num + 1)
+		files[file_desc].blocks--;
+	return code;
+}
+
+BF_ErrorCode BF_GetBlock(const int file_desc, const int block_num, BF_Block *block) 
+{
+	LOCK_POOL;
+	if (!valid_file(file_desc))
+		return BF_INVALID_FILE_ERROR;
+	if (block_num < 0 || block_num >= files[file_desc].blocks)
+		return BF_INVALID_BLOCK_NUMBER_ERROR;
+
+	File *file = &files[file_desc];
+	if (!file->mapped)
+		return load_block(file_desc, block_num, block, false);
+
+	release_pin(block);
+	block->frame     = -1;
+	block->file      = file_desc;
+	block->block_num = block_num;
+	block->data      = file->map + block_offset(file, block_num);
+	return BF_OK;
+}
+
+/* At most half the pool is given to blocks in flight, so prefetching cannot 
+ * take every frame. Mapped files only ask the OS to read the pages in */
+BF_ErrorCode BF_Prefetch(const int file_desc, const int *block_nums, const int n) 
+{
+	LOCK_POOL;
+	if (!valid_file(file_desc))
+		return BF_INVALID_FILE_ERROR;
+
+	File *file = &files[file_desc];
+	for (int k = 0; k < n; ++k)
+		if (block_nums[k] < 0 || block_nums[k] >= file->blocks)
+			return BF_INVALID_BLOCK_NUMBER_ERROR;
+
+	/* The kernel already reads ahead of sequential scans over mapped files */
+	if (file->mapped)
+		return file->sequential_scans > 0 || n == 0 ? BF_OK : advise_blocks(file, block_nums, n);
+
+	finish_reads(false);
+	for (int k = 0; k < n; ++k) {
+		int i = find_frame(file_desc, block_nums[k]);
+		if ((i != -1 && i < frames_num) || find_evicted(file_desc, block_nums[k]) != -1)
+			continue;
+
+		/* Blocks read ahead take at most half of the pool, so they are not 
+		 * evicted by the blocks read after them before being used */
+		if (async_pending() >= ASYNC_DEPTH || prefetched_count >= frames_num / 2)
+			break;
+		if (async_init(ASYNC_AUTO) < 0 || claim_frame(file_desc, block_nums[k], false, &i) != BF_OK)
+			break;
+
+		/* The frame stays pinned while the read is in flight */
+		Frame *frame = &frames[i];
+		frame->pins++;
+		if (write_evicted(i) != BF_OK)
+			break;
+
+		off_t offset = block_offset(file, block_nums[k]);
+		if (!async_submit(i, file->fd, frame->data, file->block_size, offset)) {
+			discard_frame(i);
+			break;
+		}
+		frame->loading    = true;
+		frame->prefetched = true;
+		prefetched_count++;
+		stats.reads++;
+		stats.prefetches++;
+	}
+	async_flush();
+	return BF_OK;
+}
+
+BF_ErrorCode BF_UnpinBlock(BF_Block *block) 
+{
+	LOCK_POOL;
+	if (block->data == NULL)
+		return BF_ERROR;
+
+	release_pin(block);
+	return BF_OK;
+}
+
+void BF_GetStats(BF_Stats *bf_stats) 
+{
+	LOCK_POOL;
+	*bf_stats = stats;
+}
+
+BF_ErrorCode BF_AdviseSequential(const int file_desc, const bool sequential) 
+{
+	LOCK_POOL;
+	if (!valid_file(file_desc))
+		return BF_INVALID_FILE_ERROR;
+
+	/* Pool reads go through the page cache, which reads ahead further on sequential files. 
+	 * Scans of the same file may overlap, so the advice lasts until the last of them ends */
+	File *file = &files[file_desc];
+	if (!sequential && file->sequential_scans == 0)
+		return BF_OK;
+	file->sequential_scans += sequential ? 1 : -1;
+	if (file->sequential_scans != (sequential ? 1 : 0))
+		return BF_OK;
+
+	int code = 0;
+	if (file->map != NULL)
+		code = madvise(file->map, file->map_size, sequential ? MADV_SEQUENTIAL : MADV_NORMAL);
+	else if (!file->mapped)
+		code = posix_fadvise(file->fd, 0, 0, sequential ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_NORMAL);
+	if (code != 0 && sequential)
+		file->sequential_scans--;
+	return code == 0 ? BF_OK : BF_ERROR;
+}
+
+void BF_PrintError(BF_ErrorCode err) 
+{
+	static const char *messages[] = {
+		[BF_OK]                         = "No error",
+		[BF_OPEN_FILES_LIMIT_ERROR]     = "Too many open files",
+		[BF_INVALID_FILE_ERROR]         = "Invalid file descriptor",
+		[BF_ACTIVE_ERROR]               = "BF level is already active",
+		[BF_FILE_ALREADY_EXISTS]        = "File already exists",
+		[BF_FULL_MEMORY_ERROR]          = "All buffer frames are pinned",
+		[BF_INVALID_BLOCK_NUMBER_ERROR] = "Block does not exist in the file",
+		[BF_AVAILABLE_PIN_BLOCKS_ERROR] = "File has pinned blocks",
+		[BF_ERROR]                      = "BF error",
+		[BF_INVALID_BLOCK_SIZE_ERROR]   = "Invalid block size",
+		[BF_READ_ONLY_ERROR]            = "File is open read-only"
+	};
+
+	if (err >= 0 && err < array_size(messages))
+		fprintf(stderr, "BF error %d: %s\n", err, messages[err]);
+	else
+		fprintf(stderr, "BF error %d\n", err);
+}
+
+BF_ErrorCode BF_Close() 
+{
+	LOCK_POOL;
+	if (!active)
+		return BF_OK;
+
+	/* Files are closed even if blocks were left pinned, which is reported */
+	BF_ErrorCode code = BF_OK;
+	for (int i = 0; i < files_num; ++i) {
+		for (int j = 0; files[i].open && j < frames_num; ++j) {
+			if (frames[j].file == i && frames[j].pins > 0)
+				code = BF_AVAILABLE_PIN_BLOCKS_ERROR;
+		}
+		if (files[i].open && close_file(i) != BF_OK)
+			code = BF_ERROR;
+	}
+	for (int i = 0; i < frames_num; ++i)
+		free(frames[i].data);
+
+	async_close();
+	free(frames);
+	free(files);
+	free(table);
+	frames = NULL;
+	files  = NULL;
+	table  = NULL;
+	active = false;
+	return code;
+}
+
+
+static bool valid_file(int file_desc) 
+{
+	return active && file_desc >= 0 && file_desc < files_num && files[file_desc].open;
+}
+
+/* Mapped files are mapped whole, so their blocks are fixed when they open */
+static BF_ErrorCode open_file(const char *filename, bool mapped, int *file_desc) 
+{
+	if (!active)
+		return BF_ERROR;
+
+	int i;
+	for (i = 0; i < files_num && files[i].open; ++i);
+	if (i == files_num)
+		return BF_OPEN_FILES_LIMIT_ERROR;
+
+	int fd = open(filename, mapped ? O_RDONLY : O_RDWR);
+	if (fd == -1)
+		return BF_ERROR;
+
+	struct stat st;
+	BF_Header header = { 0 };
+	if (fstat(fd, &st) == -1 || pread(fd, &header, sizeof(header), 0) == -1) {
+		close(fd);
+		return BF_ERROR;
+	}
+
+	/* Files without a header hold blocks of BF_BLOCK_SIZE from the start */
+	File *file = &files[i];
+	*file = (File) { .open = true, .fd = fd, .block_size = BF_BLOCK_SIZE, .mapped = mapped };
+	if (!memcmp(header.magic, BF_MAGIC, sizeof(header.magic))
+	 && valid_block_size(header.block_size)) {
+		file->block_size = header.block_size;
+		file->offset     = BF_BLOCK_SIZE;
+	}
+	file->blocks = st.st_size > file->offset
+		? (st.st_size - file->offset) / file->block_size
+		: 0;
+
+	if (mapped && file->blocks > 0) {
+		file->map_size = block_offset(file, file->blocks);
+		file->map = mmap(NULL, file->map_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (file->map == MAP_FAILED) {
+			file->open = false;
+			close(fd);
+			return BF_ERROR;
+		}
+	}
+
+	*file_desc = i;
+	return BF_OK;
+}
+
+/* Writes and drops the file's cached blocks, whether pinned or not */
+static BF_ErrorCode close_file(int file_desc) 
+{
+	wait_file(file_desc);
+	BF_ErrorCode code = BF_OK;
+	for (int i = 0; i < frames_num; ++i) {
+		if (frames[i].file != file_desc)
+			continue;
+		if (flush_frame(&frames[i]) != BF_OK)
+			code = BF_ERROR;
+		discard_frame(i);
+	}
+	for (int g = frames_num; g < 2 * frames_num; ++g) {
+		if (frames[g].list != NO_LIST && frames[g].file == file_desc)
+			drop_ghost(g);
+	}
+
+	File *file = &files[file_desc];
+	if (file->map != NULL && munmap(file->map, file->map_size) == -1)
+		code = BF_ERROR;
+	if (close(file->fd) == -1)
+		code = BF_ERROR;
+	file->open = false;
+	return code;
+}
+
+static bool valid_block_size(int block_size) 
+{
+	return block_size >= BF_BLOCK_SIZE
+	    && block_size <= BF_MAX_BLOCK_SIZE
+	    && !(block_size & (block_size - 1));
+}
+
+static off_t block_offset(const File *file, int block_num) 
+{
+	return file->offset + (off_t)block_num * file->block_size;
+}
+
+static int *table_slot(int file, int block_num) 
+{
+	unsigned hash = (unsigned)file * 0x9e3779b1u ^ (unsigned)block_num * 0x85ebca77u;
+	return &table[(hash ^ hash >> 16) & (table_size - 1)];
+}
+
+static int find_frame(int file, int block_num) 
+{
+	int i = *table_slot(file, block_num);
+	while (i != -1 && (frames[i].file != file || frames[i].block_num != block_num))
+		i = frames[i].chain;
+	return i;
+}
+
+static void table_remove(int i) 
+{
+	int *slot = table_slot(frames[i].file, frames[i].block_num);
+	while (*slot != i)
+		slot = &frames[*slot].chain;
+	*slot = frames[i].chain;
+	frames[i].chain = -1;
+}
+
+/* Lists run from the first frame to be evicted to the last */
+static void list_push(List_id id, int i) 
+{
+	List *list = &lists[id];
+	frames[i].list = id;
+	frames[i].prev = list->tail;
+	frames[i].next = -1;
+	if (list->tail != -1)
+		frames[list->tail].next = i;
+	else
+		list->head = i;
+	list->tail = i;
+	list->size++;
+}
+
+static void list_remove(int i) 
+{
+	Frame *frame = &frames[i];
+	if (frame->list == CLOCK) {
+		if (frame->hot)
+			hot_count--;
+		ring_remove(i);
+	} else if (frame->list != NO_LIST) {
+		List *list = &lists[frame->list];
+		if (frame->prev != -1)
+			frames[frame->prev].next = frame->next;
+		else
+			list->head = frame->next;
+		if (frame->next != -1)
+			frames[frame->next].prev = frame->prev;
+		else
+			list->tail = frame->prev;
+		list->size--;
+	}
+	frame->list = NO_LIST;
+	frame->hot  = frame->test = frame->ref = false;
+}
+
+/* CLOCK-Pro keeps one ring whose head is just behind the hot hand */
+static void ring_insert(int i) 
+{
+	frames[i].list = CLOCK;
+	if (hand_hot == -1) {
+		frames[i].prev = frames[i].next = i;
+		hand_hot = hand_cold = hand_test = i;
+	} else {
+		frames[i].next = hand_hot;
+		frames[i].prev = frames[hand_hot].prev;
+		frames[frames[i].prev].next = i;
+		frames[hand_hot].prev = i;
+	}
+	lists[CLOCK].size++;
+}
+
+static void ring_remove(int i) 
+{
+	int next = frames[i].next != i ? frames[i].next : -1;
+	if (next != -1) {
+		frames[frames[i].prev].next = next;
+		frames[next].prev = frames[i].prev;
+	}
+	if (hand_hot == i)
+		hand_hot = next;
+	if (hand_cold == i)
+		hand_cold = next;
+	if (hand_test == i)
+		hand_test = next;
+	lists[CLOCK].size--;
+}
+
+/* Puts the entry g in the place of i, leaving the hands where they were */
+static void ring_replace(int i, int g) 
+{
+	Frame *frame = &frames[g];
+	frame->list = CLOCK;
+	if (frames[i].next == i) {
+		frame->prev = frame->next = g;
+	} else {
+		frame->prev = frames[i].prev;
+		frame->next = frames[i].next;
+		frames[frame->prev].next = g;
+		frames[frame->next].prev = g;
+	}
+	if (hand_hot == i)
+		hand_hot = g;
+	if (hand_cold == i)
+		hand_cold = g;
+	if (hand_test == i)
+		hand_test = g;
+	frames[i].list = NO_LIST;
+}
+
+/* Prefetched blocks that were not requested yet are only taken if nothing else is left */
+static int first_unpinned(List_id id, bool from_tail) 
+{
+	int spare = -1;
+	for (int i = from_tail ? lists[id].tail : lists[id].head; i != -1; 
+	         i = from_tail ? frames[i].prev : frames[i].next) {
+		if (frames[i].pins > 0)
+			continue;
+		if (!frames[i].prefetched)
+			return i;
+		if (spare == -1)
+			spare = i;
+	}
+	return spare;
+}
+
+/* 2Q moves a block to AM on its second request, so blocks a scan reads once 
+ * leave through A1_IN without touching the ones in AM */
+static void touch_frame(int i) 
+{
+	switch (policy) {
+	case TWO_Q:
+		list_remove(i);
+		list_push(AM, i);
+		return;
+	case ARC:
+		list_remove(i);
+		list_push(T2, i);
+		return;
+	case CLOCK_PRO:
+		frames[i].ref = true;
+		return;
+	default:
+		list_remove(i);
+		list_push(RECENT, i);
+	}
+}
+
+/* A request for a remembered block tells ARC and CLOCK-Pro which side to grow */
+static List_id forget_ghost(int file, int block_num) 
+{
+	int g = find_frame(file, block_num);
+	if (g < frames_num)
+		return NO_LIST;
+
+	List_id list = frames[g].list;
+	int b1 = lists[B1].size, b2 = lists[B2].size;
+	if (list == B1)
+		arc_target = min(frames_num, arc_target + max(b2 / b1, 1));
+	else if (list == B2)
+		arc_target = max(0, arc_target - max(b1 / b2, 1));
+	else if (list == CLOCK && cold_target < frames_num - 1)
+		cold_target++;
+
+	drop_ghost(g);
+	return list;
+}
+
+static void drop_ghost(int g) 
+{
+	list_remove(g);
+	table_remove(g);
+	free_frame(g);
+}
+
+static void remember(List_id id, int i) 
+{
+	int g = ghost_head;
+	if (g == -1)
+		return;
+
+	int *slot = table_slot(frames[i].file, frames[i].block_num);
+	ghost_head       = frames[g].next;
+	frames[g].file      = frames[i].file;
+	frames[g].block_num = frames[i].block_num;
+	frames[g].chain     = *slot;
+	*slot = g;
+	if (id == CLOCK) {
+		ring_replace(i, g);
+		frames[g].test = true;
+	} else {
+		list_push(id, g);
+	}
+}
+
+/* Keeps T1 with B1 within the pool and all four lists within twice of it */
+static void arc_trim() 
+{
+	int t1 = lists[T1].size, b1 = lists[B1].size;
+	int total = t1 + b1 + lists[T2].size + lists[B2].size;
+
+	arc_forget = false;
+	if (t1 + b1 >= frames_num) {
+		if (t1 < frames_num && lists[B1].head != -1)
+			drop_ghost(lists[B1].head);
+		else
+			arc_forget = true;
+	} else if (total >= 2 * frames_num && lists[B2].head != -1) {
+		drop_ghost(lists[B2].head);
+	}
+}
+
+/* Evicts the first unreferenced cold block. Referenced ones start a test 
+ * period, or turn hot if they were already in one */
+static int clock_cold() 
+{
+	for (int round = 0; round < 2; ++round) {
+		for (int steps = 2 * lists[CLOCK].size; steps > 0 && hand_cold != -1; --steps) {
+			int i = hand_cold;
+			hand_cold = frames[i].next;
+			if (i >= frames_num || frames[i].hot || frames[i].pins > 0)
+				continue;
+			if (!frames[i].ref)
+				return i;
+
+			frames[i].ref = false;
+			if (frames[i].test) {
+				frames[i].test = false;
+				frames[i].hot  = true;
+				hot_count++;
+			} else {
+				frames[i].test = true;
+			}
+			ring_remove(i);
+			ring_insert(i);
+		}
+		if (!clock_hot())
+			break;
+	}
+	return -1;
+}
+
+/* Turns the first unreferenced hot block cold, ending the test periods it passes */
+static bool clock_hot() 
+{
+	for (int steps = 2 * lists[CLOCK].size; steps > 0 && hand_hot != -1; --steps) {
+		int i = hand_hot;
+		hand_hot = frames[i].next;
+		if (!frames[i].hot) {
+			if (frames[i].test)
+				end_test(i);
+		} else if (frames[i].ref) {
+			frames[i].ref = false;
+		} else if (frames[i].pins == 0) {
+			frames[i].hot = false;
+			hot_count--;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Forgets the first remembered block the test hand reaches */
+static void clock_test() 
+{
+	for (int steps = lists[CLOCK].size; steps > 0 && hand_test != -1; --steps) {
+		int i = hand_test;
+		hand_test = frames[i].next;
+		if (frames[i].hot || !frames[i].test)
+			continue;
+
+		end_test(i);
+		if (i >= frames_num)
+			return;
+	}
+}
+
+/* A remembered block whose test period ends without a request is forgotten */
+static void end_test(int i) 
+{
+	frames[i].test = false;
+	if (i < frames_num)
+		return;
+
+	drop_ghost(i);
+	if (cold_target > 1)
+		cold_target--;
+}
+
+static int victim_frame(List_id ghost) 
+{
+	int i;
+	switch (policy) {
+	case MRU:
+		return first_unpinned(RECENT, true);
+	case TWO_Q:
+		if (lists[A1_IN].size > max(frames_num / 4, 1) && (i = first_unpinned(A1_IN, false)) != -1)
+			return i;
+		if ((i = first_unpinned(AM, false)) != -1)
+			return i;
+		return first_unpinned(A1_IN, false);
+	case ARC: {
+		int t1 = lists[T1].size;
+		bool from_t1 = arc_forget || (t1 > 0 && (t1 > arc_target || (ghost == B2 && t1 == arc_target)));
+		if ((i = first_unpinned(from_t1 ? T1 : T2, false)) != -1)
+			return i;
+		return first_unpinned(from_t1 ? T2 : T1, false);
+	}
+	case CLOCK_PRO:
+		return clock_cold();
+	default:
+		return first_unpinned(RECENT, false);
+	}
+}
+
+/* Takes the block out of its frame, remembering it where the policy asks to */
+static void evict_frame(int i) 
+{
+	unmark_prefetched(i);
+	switch (frames[i].list) {
+	case A1_IN:
+		if (lists[A1_OUT].size >= max(frames_num / 2, 1))
+			drop_ghost(lists[A1_OUT].head);
+		list_remove(i);
+		table_remove(i);
+		remember(A1_OUT, i);
+		break;
+	case T1:
+	case T2: {
+		List_id ghost = frames[i].list == T1 ? B1 : B2;
+		list_remove(i);
+		table_remove(i);
+		if (ghost == B2 || !arc_forget)
+			remember(ghost, i);
+		arc_forget = false;
+		break;
+	}
+	case CLOCK:
+		if (frames[i].test && ghost_head == -1)
+			clock_test();
+		table_remove(i);
+		if (frames[i].test && ghost_head != -1)
+			remember(CLOCK, i);
+		else
+			ring_remove(i);
+		frames[i].list = NO_LIST;
+		frames[i].test = frames[i].ref = false;
+		break;
+	default:
+		list_remove(i);
+		table_remove(i);
+	}
+}
+
+/* New blocks start in A1_IN, T1 or cold, unless they were remembered */
+static void place_frame(int i, List_id ghost) 
+{
+	switch (policy) {
+	case TWO_Q:
+		list_push(ghost == A1_OUT ? AM : A1_IN, i);
+		return;
+	case ARC:
+		list_push(ghost == NO_LIST ? T1 : T2, i);
+		return;
+	case CLOCK_PRO:
+		ring_insert(i);
+		if (ghost == CLOCK) {
+			frames[i].hot = true;
+			hot_count++;
+		} else {
+			frames[i].test = true;
+		}
+		while (hot_count > max(frames_num - cold_target, 1) && clock_hot());
+		return;
+	default:
+		list_push(RECENT, i);
+	}
+}
+
+/* Free frames and free entries for evicted blocks are chained through next */
+static void free_frame(int i) 
+{
+	int *head = i < frames_num ? &free_head : &ghost_head;
+	frames[i].file = -1;
+	frames[i].next = *head;
+	*head = i;
+}
+
+static BF_ErrorCode flush_frame(Frame *frame) 
+{
+	if (frame->file == -1 || !frame->dirty)
+		return BF_OK;
+
+	File *file = &files[frame->file];
+	ssize_t written = pwrite(
+		file->fd,
+		frame->data,
+		file->block_size,
+		block_offset(file, frame->block_num)
+	);
+	if (written != file->block_size)
+		return BF_ERROR;
+
+	frame->dirty = false;
+	stats.writes++;
+	return BF_OK;
+}
+
+/* Pins the block to a frame, reading it from the file unless it is new */
+static BF_ErrorCode load_block(int file, int block_num, BF_Block *block, bool fresh) 
+{
+	/* A block struct holds one pin, so fetching into it drops the previous one */
+	release_pin(block);
+
+	for (int j; (j = busy_frame(file, block_num)) != -1; )
+		wait_frame(j);
+
+	int i = find_frame(file, block_num);
+	if (i != -1 && i < frames_num) {
+		/* The first request of a prefetched block counts as its first use */
+		stats.hits++;
+		if (frames[i].prefetched)
+			unmark_prefetched(i);
+		else
+			touch_frame(i);
+		frames[i].pins++;
+	} else {
+		BF_ErrorCode code = claim_frame(file, block_num, fresh, &i);
+		if (code != BF_OK)
+			return code;
+
+		frames[i].pins++;
+		if ((code = write_evicted(i)) != BF_OK)
+			return code;
+		if (fresh) {
+			memset(frames[i].data, 0, files[file].block_size);
+		} else if ((code = read_frame(i)) != BF_OK) {
+			discard_frame(i);
+			return code;
+		}
+	}
+
+	block->frame     = i;
+	block->file      = file;
+	block->block_num = block_num;
+	block->pinned    = true;
+	block->data      = frames[i].data;
+	return BF_OK;
+}
+
+/* Gives the block a frame of its own, evicting another block if none is free */
+static BF_ErrorCode claim_frame(int file, int block_num, bool fresh, int *frame_index) 
+{
+	List_id ghost = forget_ghost(file, block_num);
+	if (policy == ARC && ghost == NO_LIST)
+		arc_trim();
+
+	int i = free_head;
+	if (i == -1 && (i = victim_frame(ghost)) == -1)
+		return BF_FULL_MEMORY_ERROR;
+
+	/* The buffer grows before the victim leaves it, so a failure loses nothing */
+	Frame *frame = &frames[i];
+	int size = files[file].block_size;
+	if (frame->size < size) {
+		char *data = realloc(frame->data, size);
+		if (data == NULL)
+			return BF_ERROR;
+		frame->data = data;
+		frame->size = size;
+	}
+
+	/* A dirty victim is written out by the caller, through write_evicted */
+	if (i == free_head) {
+		free_head = frame->next;
+	} else {
+		if (frame->dirty) {
+			frame->evicted_file  = frame->file;
+			frame->evicted_block = frame->block_num;
+			evicted_count++;
+		}
+		evict_frame(i);
+	}
+
+	int *slot = table_slot(file, block_num);
+	frame->file      = file;
+	frame->block_num = block_num;
+	frame->dirty     = fresh;
+	frame->chain     = *slot;
+	*slot = i;
+	place_frame(i, ghost);
+
+	*frame_index = i;
+	return BF_OK;
+}
+
+/* Writes out the dirty block frame i was taken from, with the pool lock dropped. 
+ * If the write fails, the block goes back to the frame still dirty, in place of the new one */
+static BF_ErrorCode write_evicted(int i) 
+{
+	Frame *frame = &frames[i];
+	if (frame->evicted_file == -1)
+		return BF_OK;
+
+	File *file = &files[frame->evicted_file];
+	int fd = file->fd, size = file->block_size;
+	off_t offset = block_offset(file, frame->evicted_block);
+	frame->loading = true;
+	pthread_mutex_unlock(&pool_lock);
+	ssize_t written = pwrite(fd, frame->data, size, offset);
+	pthread_mutex_lock(&pool_lock);
+	frame->loading = false;
+	evicted_count--;
+	pthread_cond_broadcast(&frame_ready);
+
+	if (written == size) {
+		frame->evicted_file = -1;
+		stats.writes++;
+		return BF_OK;
+	}
+
+	list_remove(i);
+	table_remove(i);
+	int *slot = table_slot(frame->evicted_file, frame->evicted_block);
+	frame->file      = frame->evicted_file;
+	frame->block_num = frame->evicted_block;
+	frame->dirty     = true;
+	frame->pins      = 0;
+	frame->chain     = *slot;
+	*slot = i;
+	frame->evicted_file = -1;
+	place_frame(i, NO_LIST);
+	return BF_ERROR;
+}
+
+/* Reads the block of frame i from its file, with the pool lock dropped */
+static BF_ErrorCode read_frame(int i) 
+{
+	Frame *frame = &frames[i];
+	File *file = &files[frame->file];
+	int fd = file->fd, size = file->block_size;
+	off_t offset = block_offset(file, frame->block_num);
+	frame->loading = true;
+	pthread_mutex_unlock(&pool_lock);
+	ssize_t bytes = pread(fd, frame->data, size, offset);
+	pthread_mutex_lock(&pool_lock);
+	frame->loading = false;
+	pthread_cond_broadcast(&frame_ready);
+
+	if (bytes == -1)
+		return BF_ERROR;
+	memset(frame->data + bytes, 0, size - bytes);
+	stats.reads++;
+	return BF_OK;
+}
+
+/* The frame whose read or write must end before the block can be used, or -1 */
+static int busy_frame(int file, int block_num) 
+{
+	int i = find_frame(file, block_num);
+	if (i != -1 && i < frames_num)
+		return frames[i].loading ? i : -1;
+	return find_evicted(file, block_num);
+}
+
+/* The frame the block is being written out of, or -1 */
+static int find_evicted(int file, int block_num) 
+{
+	for (int i = 0; evicted_count > 0 && i < frames_num; ++i) {
+		if (frames[i].evicted_file == file && frames[i].evicted_block == block_num)
+			return i;
+	}
+	return -1;
+}
+
+/* Prefetched frames are waited for by reaping their reads, the rest until they are woken */
+static void wait_frame(int i) 
+{
+	if (frames[i].prefetched)
+		finish_reads(true);
+	else
+		pthread_cond_wait(&frame_ready, &pool_lock);
+}
+
+/* Waits until no read or write is in flight on the file */
+static void wait_file(int file_desc) 
+{
+	for (int i = 0; i < frames_num; ++i) {
+		if (frames[i].loading && (frames[i].file == file_desc || frames[i].evicted_file == file_desc)) {
+			wait_frame(i);
+			i = -1;
+		}
+	}
+}
+
+static void discard_frame(int i) 
+{
+	list_remove(i);
+	table_remove(i);
+	frames[i].pins       = 0;
+	frames[i].loading = false;
+	unmark_prefetched(i);
+	free_frame(i);
+}
+
+/* Handles the finished prefetches. With wait set and none finished, waits for one 
+ * with the pool lock dropped. Only one thread waits on the reads at a time, and 
+ * nobody else reaps meanwhile; the others wait until it wakes them */
+static void finish_reads(bool wait) 
+{
+	if (reaping) {
+		if (wait)
+			pthread_cond_wait(&frame_ready, &pool_lock);
+		return;
+	}
+
+	Async_read done[ASYNC_DEPTH];
+	int count = async_reap(done, ASYNC_DEPTH, false);
+	if (count == 0 && wait && async_pending() > 0) {
+		reaping = true;
+		pthread_mutex_unlock(&pool_lock);
+		async_wait();
+		pthread_mutex_lock(&pool_lock);
+		reaping = false;
+		count = async_reap(done, ASYNC_DEPTH, false);
+	}
+	for (int k = 0; k < count; ++k)
+		finish_read(done[k].tag, done[k].bytes);
+	if (wait || count > 0)
+		pthread_cond_broadcast(&frame_ready);
+}
+
+/* A failed prefetch leaves no trace, the block is read again when requested */
+static void finish_read(int i, ssize_t bytes) 
+{
+	Frame *frame = &frames[i];
+	frame->loading = false;
+	frame->pins--;
+	if (bytes < 0) {
+		discard_frame(i);
+		return;
+	}
+
+	int size = files[frame->file].block_size;
+	memset(frame->data + bytes, 0, size - bytes);
+}
+
+static void unmark_prefetched(int i) 
+{
+	if (frames[i].prefetched) {
+		frames[i].prefetched = false;
+		prefetched_count--;
+	}
+}
+
+/* A single advice covers the pages of all the blocks */
+static BF_ErrorCode advise_blocks(File *file, const int *block_nums, int n) 
+{
+	int first = block_nums[0], last = block_nums[0];
+	for (int k = 1; k < n; ++k) {
+		first = min(first, block_nums[k]);
+		last  = max(last, block_nums[k]);
+	}
+
+	long page = sysconf(_SC_PAGESIZE);
+	off_t start = block_offset(file, first) / page * page;
+	off_t end   = block_offset(file, last) + file->block_size;
+	return madvise(file->map + start, end - start, MADV_WILLNEED) == 0 ? BF_OK : BF_ERROR;
+}
+
+/* The frame may hold another block by now, if the file was closed in between */
+static void release_pin(BF_Block *block) 
+{
+	if (!block->pinned)
+		return;
+
+	block->pinned = false;
+	if (!active || block->frame >= frames_num)
+		return;
+
+	Frame *frame = &frames[block->frame];
+	if (frame->file == block->file && frame->block_num == block->block_num && frame->pins > 0)
+		frame->pins--;
+}
+
+static pthread_mutex_t *lock_pool() 
+{
+	pthread_mutex_lock(&pool_lock);
+	return &pool_lock;
+}
+
+static void unlock_pool(pthread_mutex_t **lock) 
+{
+	pthread_mutex_unlock(*lock);
+}
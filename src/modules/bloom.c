@@ -0,0 +1,110 @@
+#include "common.h"
+#include "bloom.h"
+
+#include <stdint.h>
+
+static uint64_t bloom_mix(uint64_t hash);
+static size_t bloom_bit(uint64_t hash, int i, size_t bits);
+
+
+/* The bits of a key are picked with double hashing, 
+ * from a hash that is mixed again so they do not follow the bucket */
+void bloom_add(unsigned char *filter, size_t size, size_t hash) 
+{
+	hash = bloom_mix(hash);
+	for (int i = 0; i < BLOOM_HASHES; i++) {
+		size_t bit = bloom_bit(hash, i, size * 8);
+		filter[bit / 8] |= 1 << bit % 8;
+	}
+}
+
+bool bloom_test(const unsigned char *filter, size_t size, size_t hash) 
+{
+	hash = bloom_mix(hash);
+	for (int i = 0; i < BLOOM_HASHES; i++) {
+		size_t bit = bloom_bit(hash, i, size * 8);
+		if (!(filter[bit / 8] & 1 << bit % 8))
+			return false;
+	}
+	return true;
+}
+
+int bloom_load(int fd, int first_block, unsigned char *filter, size_t size) 
+{
+	int block_size;
+	BF_Block *block;
+	BF_Block_Init(&block);
+
+	CALL_BF(BF_GetBlockSize(fd, &block_size), error);
+	for (int i = 0; i < BLOOM_BLOCKS(size, block_size); ++i) {
+		size_t left = size - i * block_size;
+		CALL_BF(BF_GetBlock(fd, first_block + i, block), error);
+		memcpy(
+			filter + i * block_size, 
+			BF_Block_GetData(block), 
+			left < block_size ? left : block_size
+		);
+		CALL_BF(BF_UnpinBlock(block), error);
+	}
+	BF_Block_Destroy(&block);
+	return 0;
+
+	error:
+		BF_Block_Destroy(&block);
+		return -1;
+}
+
+/* Writes the filter to the blocks starting at first_block, moving it to 
+ * fresh blocks at the end of the file once it outgrows them. 
+ * The blocks it moves from are not freed */
+int bloom_store(int fd, int *first_block, int *blocks, const unsigned char *filter, 
+                                                       size_t size) 
+{
+	int block_size;
+	BF_Block *block;
+	BF_Block_Init(&block);
+
+	CALL_BF(BF_GetBlockSize(fd, &block_size), error);
+	if (BLOOM_BLOCKS(size, block_size) > *blocks) {
+		CALL_BF(BF_GetBlockCounter(fd, first_block), error);
+		for (int i = 0; i < BLOOM_BLOCKS(size, block_size); ++i) {
+			CALL_BF(BF_AllocateBlock(fd, block), error);
+			CALL_BF(BF_UnpinBlock(block), error);
+		}
+		*blocks = BLOOM_BLOCKS(size, block_size);
+	}
+
+	for (int i = 0; i < BLOOM_BLOCKS(size, block_size); ++i) {
+		size_t left = size - i * block_size;
+		CALL_BF(BF_GetBlock(fd, *first_block + i, block), error);
+		COPY(
+			filter + i * block_size, 
+			BF_Block_GetData(block), 
+			left < block_size ? left : block_size, 
+			block_size
+		);
+		BF_Block_SetDirty(block);
+		CALL_BF(BF_UnpinBlock(block), error);
+	}
+	BF_Block_Destroy(&block);
+	return 0;
+
+	error:
+		BF_Block_Destroy(&block);
+		return -1;
+}
+
+
+static uint64_t bloom_mix(uint64_t hash) 
+{
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+static size_t bloom_bit(uint64_t hash, int i, size_t bits) 
+{
+	uint32_t h1 = hash, h2 = hash >> 32 | 1;
+	return (h1 + (uint64_t)i * h2) % bits;
+}
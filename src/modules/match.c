@@ -0,0 +1,302 @@
+#include "common.h"
+#include "match.h"
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MATCH_X86
+#endif
+
+#define SET_BIT(mask, i) ((mask)[(i) / 64] |= (uint64_t)1 << (i) % 64)
+
+
+typedef void (*Match_kernel)(const char *data, int count, int stride,
+                                                          const char *value,
+                                                          int size,
+                                                          uint64_t *mask);
+typedef void (*Byte_kernel)(const unsigned char *bytes, int count, unsigned char byte, 
+                                                                   uint64_t *mask);
+
+static void match_scalar(const char *data, int count, int stride,
+                                                      const char *value,
+                                                      int size,
+                                                      uint64_t *mask);
+static void bytes_scalar(const unsigned char *bytes, int count, unsigned char byte, 
+                                                                uint64_t *mask);
+static void select_auto(void);
+static match_level select_kernels(match_level level);
+#ifdef MATCH_X86
+static void match_sse42(const char *data, int count, int stride,
+                                                     const char *value,
+                                                     int size,
+                                                     uint64_t *mask);
+static void match_avx2(const char *data, int count, int stride,
+                                                    const char *value,
+                                                    int size,
+                                                    uint64_t *mask);
+static void bytes_sse42(const unsigned char *bytes, int count, unsigned char byte, 
+                                                               uint64_t *mask);
+static void bytes_avx2(const unsigned char *bytes, int count, unsigned char byte, 
+                                                              uint64_t *mask);
+#endif
+
+static Match_kernel kernel = NULL;
+static Byte_kernel byte_kernel = NULL;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+
+
+
+
+/* Kernels are picked once for all threads before the first match, 
+ * so match_select should only be called before threads share files */
+match_level match_select(match_level level)
+{
+	pthread_once(&kernels_once, select_auto);
+	return select_kernels(level);
+}
+
+void match_records(const char *data, int count, int stride,
+                                                int offset,
+                                                const void *value,
+                                                int size,
+                                                uint64_t *mask)
+{
+	char value_[MATCH_MAX_SIZE] = { 0 };
+	pthread_once(&kernels_once, select_auto);
+
+	memset(mask, 0, MATCH_WORDS(count) * sizeof(uint64_t));
+	if (count <= 0 || size <= 0)
+		return;
+
+	/* Kernels may load whole vectors from the value, 
+	 * so values longer than the buffer are compared one record at a time */
+	if (size > MATCH_MAX_SIZE) {
+		match_scalar(data + offset, count, stride, value, size, mask);
+		return;
+	}
+	memcpy(value_, value, size);
+	kernel(data + offset, count, stride, value_, size, mask);
+}
+
+void match_bytes(const unsigned char *bytes, int count, unsigned char byte, uint64_t *mask) 
+{
+	pthread_once(&kernels_once, select_auto);
+
+	memset(mask, 0, MATCH_WORDS(count) * sizeof(uint64_t));
+	if (count > 0)
+		byte_kernel(bytes, count, byte, mask);
+}
+
+int match_next(const uint64_t *mask, int pos, int count)
+{
+	while (pos < count) {
+		uint64_t word = mask[pos / 64] >> pos % 64;
+		if (word != 0) {
+			pos += __builtin_ctzll(word);
+			return pos < count ? pos : count;
+		}
+		pos = (pos / 64 + 1) * 64;
+	}
+	return count;
+}
+
+
+static void select_auto(void)
+{
+	select_kernels(MATCH_AUTO);
+}
+
+static match_level select_kernels(match_level level)
+{
+#ifdef MATCH_X86
+	__builtin_cpu_init();
+	if ((level == MATCH_AUTO || level == MATCH_AVX2)
+	 && __builtin_cpu_supports("avx2")) {
+		kernel = match_avx2;
+		byte_kernel = bytes_avx2;
+		return MATCH_AVX2;
+	}
+	if (level != MATCH_SCALAR && __builtin_cpu_supports("sse4.2")) {
+		kernel = match_sse42;
+		byte_kernel = bytes_sse42;
+		return MATCH_SSE42;
+	}
+#endif
+	kernel = match_scalar;
+	byte_kernel = bytes_scalar;
+	return MATCH_SCALAR;
+}
+
+
+static void match_scalar(const char *data, int count, int stride,
+                                                      const char *value,
+                                                      int size,
+                                                      uint64_t *mask)
+{
+	for (int i = 0; i < count; i++, data += stride) {
+		if (memcmp(data, value, size) == 0)
+			SET_BIT(mask, i);
+	}
+}
+
+static void bytes_scalar(const unsigned char *bytes, int count, unsigned char byte, 
+                                                                uint64_t *mask)
+{
+	for (int i = 0; i < count; i++) {
+		if (bytes[i] == byte)
+			SET_BIT(mask, i);
+	}
+}
+
+#ifdef MATCH_X86
+
+static const char key_mask[32] = {
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+/*
+ * Vector loads read whole chunks past the end of the key, so the last
+ * records of the array are compared with memcmp instead.
+ */
+static int vector_records(int count, int stride, int size, int width)
+{
+	int end = (count - 1) * stride + size;
+	int load = (size + width - 1) / width * width;
+	int safe = (end - load) / stride + 1;
+
+	if (end < load)
+		return 0;
+	return safe < count ? safe : count;
+}
+
+__attribute__((target("sse4.2")))
+static void match_sse42(const char *data, int count, int stride,
+                                                     const char *value,
+                                                     int size,
+                                                     uint64_t *mask)
+{
+	__m128i key[MATCH_MAX_SIZE / 16], len[MATCH_MAX_SIZE / 16];
+	int chunks = (size + 15) / 16;
+	int safe = vector_records(count, stride, size, 16);
+
+	/* Only the bytes of the key take part in the compare */
+	for (int c = 0; c < chunks; c++) {
+		int bytes = size - 16 * c < 16 ? size - 16 * c : 16;
+		key[c] = _mm_loadu_si128((const __m128i*)(value + 16 * c));
+		len[c] = _mm_loadu_si128((const __m128i*)(key_mask + 16 - bytes));
+	}
+
+	for (int i = 0; i < safe; i++) {
+		const char *rec = data + i * stride;
+		bool equal = true;
+		for (int c = 0; c < chunks && equal; c++) {
+			__m128i chunk = _mm_loadu_si128((const __m128i*)(rec + 16 * c));
+			equal = _mm_testz_si128(_mm_xor_si128(chunk, key[c]), len[c]);
+		}
+		if (equal)
+			SET_BIT(mask, i);
+	}
+
+	for (int i = safe; i < count; i++) {
+		if (memcmp(data + i * stride, value, size) == 0)
+			SET_BIT(mask, i);
+	}
+}
+
+__attribute__((target("avx2")))
+static void match_avx2(const char *data, int count, int stride,
+                                                    const char *value,
+                                                    int size,
+                                                    uint64_t *mask)
+{
+	int i = 0;
+
+	if (size == sizeof(int)) {
+		/* Gather the keys of 8 records and compare them at once */
+		__m256i index = _mm256_mullo_epi32(
+			_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+			_mm256_set1_epi32(stride)
+		);
+		int ikey;
+		memcpy(&ikey, value, sizeof(int));
+		__m256i key = _mm256_set1_epi32(ikey);
+
+		/* Keys stored next to each other (PAX blocks) are loaded directly */
+		for (; i + 8 <= count; i += 8) {
+			__m256i keys = stride == sizeof(int)
+				? _mm256_loadu_si256((const __m256i*)(data + i * stride))
+				: _mm256_i32gather_epi32((const int*)(data + i * stride), index, 1);
+			uint64_t bits = _mm256_movemask_ps(
+				_mm256_castsi256_ps(_mm256_cmpeq_epi32(keys, key))
+			);
+			mask[i / 64] |= bits << i % 64;
+		}
+	} else {
+		__m256i key[MATCH_MAX_SIZE / 32];
+		int chunks = (size + 31) / 32;
+		int safe = vector_records(count, stride, size, 32);
+
+		for (int c = 0; c < chunks; c++)
+			key[c] = _mm256_loadu_si256((const __m256i*)(value + 32 * c));
+
+		for (; i < safe; i++) {
+			const char *rec = data + i * stride;
+			bool equal = true;
+			for (int c = 0; c < chunks && equal; c++) {
+				int len = size - 32 * c < 32 ? size - 32 * c : 32;
+				uint32_t need = len == 32 ? UINT32_MAX : ((uint32_t)1 << len) - 1;
+				__m256i chunk = _mm256_loadu_si256((const __m256i*)(rec + 32 * c));
+				uint32_t eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, key[c]));
+				equal = (eq & need) == need;
+			}
+			if (equal)
+				SET_BIT(mask, i);
+		}
+	}
+
+	for (; i < count; i++) {
+		if (memcmp(data + i * stride, value, size) == 0)
+			SET_BIT(mask, i);
+	}
+}
+
+__attribute__((target("sse4.2")))
+static void bytes_sse42(const unsigned char *bytes, int count, unsigned char byte, 
+                                                               uint64_t *mask)
+{
+	__m128i key = _mm_set1_epi8(byte);
+	int i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i*)(bytes + i));
+		uint64_t bits = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, key));
+		mask[i / 64] |= bits << i % 64;
+	}
+
+	for (; i < count; i++) {
+		if (bytes[i] == byte)
+			SET_BIT(mask, i);
+	}
+}
+
+__attribute__((target("avx2")))
+static void bytes_avx2(const unsigned char *bytes, int count, unsigned char byte, 
+                                                              uint64_t *mask)
+{
+	__m256i key = _mm256_set1_epi8(byte);
+	int i = 0;
+
+	for (; i + 32 <= count; i += 32) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i*)(bytes + i));
+		uint64_t bits = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, key));
+		mask[i / 64] |= bits << i % 64;
+	}
+
+	for (; i < count; i++) {
+		if (bytes[i] == byte)
+			SET_BIT(mask, i);
+	}
+}
+
+#endif
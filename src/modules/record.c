@@ -1,5 +1,6 @@
 #include "record.h"
 #include "common.h"
+#include "dl_list.h"
 
 const char *names[] = {
 	"Yannis",
@@ -108,6 +109,14 @@ void print_record(Record *rec)
 	);
 }
 
+/* Visitor that appends a copy of every record to a list */
+int list_record(Record *rec, void *records) 
+{
+	Record *tmp = malloc(sizeof(*tmp));
+	list_insert(records, memcpy(tmp, rec, sizeof(*tmp)));
+	return 0;
+}
+
 
 int get_attr_offset(rec_attr attr) 
 {
@@ -128,6 +137,18 @@ int get_attr_size(rec_attr attr)
 		sizeof_field(Record, city);
 }
 
+/* Strings as long as the attribute are cut to its size without their terminator, 
+ * so they still match no stored value */
+int get_value_size(rec_attr attr, const void *value) 
+{
+	int size = get_attr_size(attr);
+	if (get_attr_type(attr) == INT)
+		return size;
+
+	int len = strnlen(value, size);
+	return len < size ? len + 1 : size;
+}
+
 attr_type get_attr_type(rec_attr attr) 
 {
 	return
@@ -146,3 +167,112 @@ void *get_rec_member(Record *rec, rec_attr attr)
 		(void*)rec->city;
 	
 }
+
+int compare_keys(const void *a, const void *b, rec_attr attr) 
+{
+	if (get_attr_type(attr) == STRING)
+		return strncmp(a, b, get_attr_size(attr));
+
+	int a_, b_;
+	memcpy(&a_, a, sizeof(int));
+	memcpy(&b_, b, sizeof(int));
+	return (a_ > b_) - (a_ < b_);
+}
+
+
+static size_t hash_ints(const void *key) 
+{
+    size_t value = *(int*)key;
+    value = ((value >> 16) ^ value) * 0x45d9f3b;
+    value = ((value >> 16) ^ value) * 0x45d9f3b;
+    value = ((value >> 16) ^ value);
+    return value;
+}
+
+static size_t hash_strings(const void *key) 
+{
+    size_t hash = 5381;
+    size_t c;
+    char *s = (char*)key;
+    while ((c = *s++))
+        hash = ((hash << 5) + hash) + c;
+    return hash;
+}
+
+size_t hash_key(attr_type type, const void *key) 
+{
+    return type == INT ? hash_ints(key) : hash_strings(key);
+}
+
+/* One byte of the hash, above the bits that pick the bucket */
+unsigned char key_fingerprint(attr_type type, const void *key) 
+{
+    return hash_key(type, key) >> 24;
+}
+
+
+/* Row blocks store whole records one after the other. 
+ * PAX blocks store the values of each attribute together, 
+ * with room for capacity values per attribute */
+void *get_block_member(char *data, rec_layout layout, int capacity, int pos, rec_attr attr) 
+{
+	int base = layout == PAX_LAYOUT
+		? capacity * get_attr_offset(attr)
+		: get_attr_offset(attr);
+	return data + base + pos * get_member_stride(layout, attr);
+}
+
+int get_member_stride(rec_layout layout, rec_attr attr) 
+{
+	return layout == PAX_LAYOUT ? get_attr_size(attr) : sizeof(Record);
+}
+
+void get_block_record(char *data, rec_layout layout, int capacity, int pos, Record *rec) 
+{
+	if (layout == ROW_LAYOUT) {
+		memcpy(rec, data + pos * sizeof(Record), sizeof(Record));
+		return;
+	}
+	for (rec_attr attr = ID; attr <= CITY; attr++)
+		memcpy(
+			get_rec_member(rec, attr), 
+			get_block_member(data, layout, capacity, pos, attr), 
+			get_attr_size(attr)
+		);
+}
+
+void set_block_record(char *data, rec_layout layout, int capacity, int pos, Record *rec) 
+{
+	if (layout == ROW_LAYOUT) {
+		memcpy(data + pos * sizeof(Record), rec, sizeof(Record));
+		return;
+	}
+	for (rec_attr attr = ID; attr <= CITY; attr++)
+		memcpy(
+			get_block_member(data, layout, capacity, pos, attr), 
+			get_rec_member(rec, attr), 
+			get_attr_size(attr)
+		);
+}
+
+/* Records after pos move one slot back */
+void remove_block_record(char *data, rec_layout layout, int capacity, int pos, 
+                                                                      int rec_num) 
+{
+	if (layout == ROW_LAYOUT) {
+		memmove(
+			data + pos * sizeof(Record), 
+			data + (pos + 1) * sizeof(Record), 
+			(rec_num - pos - 1) * sizeof(Record)
+		);
+		return;
+	}
+	for (rec_attr attr = ID; attr <= CITY; attr++) {
+		char *member = get_block_member(data, layout, capacity, pos, attr);
+		memmove(
+			member, 
+			member + get_attr_size(attr), 
+			(rec_num - pos - 1) * get_attr_size(attr)
+		);
+	}
+}
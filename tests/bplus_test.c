@@ -0,0 +1,208 @@
+#include "bplus_file.h"
+#include "common.h"
+#include "acutest.h"
+#include "dl_list.h"
+
+
+#define FILENAME "data1.db"
+#define RECORDS_NUM 2000
+#define TO_DELETE 200
+
+
+static int compare_records(Record *a, Record *b)
+{
+    return a->id == b->id
+        && !strcmp(a->name, b->name)
+        && !strcmp(a->surname, b->surname)
+        && !strcmp(a->city, b->city);
+}
+
+
+static int *shuffled_numbers(int size)
+{
+    int *array = malloc(size * sizeof(int));
+    for (int i = 0; i < size; ++i)
+        array[i] = i;
+
+    for (int i = size - 1; i > 0; --i) {
+        int j = rand() % (i + 1);
+        int tmp = array[i];
+        array[i] = array[j];
+        array[j] = tmp;
+    }
+    return array;
+}
+
+
+void test_create()
+{
+    TEST_ASSERT(BF_Init(LRU) == BF_OK);
+    TEST_ASSERT(BPT_CreateFile(FILENAME, ID) == 0);
+    TEST_ASSERT(BPT_CreateFile(FILENAME, ID) == -1);
+
+    BPlus_file *handle = BPT_OpenFile(FILENAME);
+
+    TEST_ASSERT(handle != NULL);
+    TEST_ASSERT(strcmp(handle->file_type, "bpt") == 0);
+    TEST_ASSERT(handle->height == 1);
+    TEST_ASSERT(handle->rec_count == 0);
+    TEST_ASSERT(handle->attr == ID);
+
+    TEST_ASSERT(BPT_CloseFile(handle) == 0);
+    TEST_ASSERT(BF_Close() == BF_OK);
+    TEST_ASSERT(remove(FILENAME) == 0);
+}
+
+
+void test_insert()
+{
+    srand(time(NULL) * getpid());
+
+    BPlus_file *handle;
+    Record find, *rec = malloc(RECORDS_NUM * sizeof(*rec));
+    int *ids = shuffled_numbers(RECORDS_NUM);
+
+    TEST_ASSERT(BF_Init(LRU) == BF_OK);
+    TEST_ASSERT(BPT_CreateFile(FILENAME, ID) == 0);
+    TEST_ASSERT((handle = BPT_OpenFile(FILENAME)) != NULL);
+
+    for (int i = 0; i < RECORDS_NUM; ++i) {
+        rec[ids[i]] = random_record();
+        rec[ids[i]].id = ids[i];
+        TEST_ASSERT(INSERTED(handle, BPT_InsertEntry(handle, rec[ids[i]])));
+    }
+    TEST_ASSERT(!INSERTED(handle, BPT_InsertEntry(handle, rec[0])));
+    TEST_ASSERT(handle->height > 2);
+
+    TEST_ASSERT(BPT_CloseFile(handle) == 0);
+    TEST_ASSERT((handle = BPT_OpenFile(FILENAME)) != NULL);
+    TEST_ASSERT(handle->rec_count == RECORDS_NUM);
+
+    for (int i = 0; i < RECORDS_NUM; ++i) {
+        TEST_ASSERT(BPT_GetEntry(handle, &i, &find) == 0);
+        TEST_ASSERT(compare_records(&find, &rec[i]));
+    }
+    int id = RECORDS_NUM;
+    TEST_ASSERT(BPT_GetEntry(handle, &id, &find) == 0);
+    TEST_ASSERT(find.id == -1);
+
+    /* Leaves are chained in key order */
+    Dl_list list = list_create(free);
+    TEST_ASSERT(BPT_GetRange(handle, NULL, NULL, list) == 0);
+    TEST_ASSERT(list_size(list) == RECORDS_NUM);
+
+    int i = 0;
+    for (Dl_list_node node = list_first(list); node != NULL; node = list_next(node))
+        TEST_ASSERT(compare_records(list_value(node), &rec[i++]));
+
+    list_destroy(list);
+    free(rec);
+    free(ids);
+
+    TEST_ASSERT(BPT_CloseFile(handle) == 0);
+    TEST_ASSERT(BF_Close() == BF_OK);
+    TEST_ASSERT(remove(FILENAME) == 0);
+}
+
+
+void test_delete()
+{
+    srand(time(NULL) * getpid());
+
+    BPlus_file *handle;
+    Record find;
+    int *ids = shuffled_numbers(RECORDS_NUM);
+
+    TEST_ASSERT(BF_Init(LRU) == BF_OK);
+    TEST_ASSERT(BPT_CreateFile(FILENAME, ID) == 0);
+    TEST_ASSERT((handle = BPT_OpenFile(FILENAME)) != NULL);
+
+    for (int i = 0; i < RECORDS_NUM; ++i) {
+        Record rec = random_record();
+        rec.id = ids[i];
+        TEST_ASSERT(INSERTED(handle, BPT_InsertEntry(handle, rec)));
+    }
+
+    for (int i = 0; i < TO_DELETE; ++i) {
+        TEST_ASSERT(DELETED(handle, BPT_DeleteEntry(handle, &ids[i])));
+        TEST_ASSERT(!DELETED(handle, BPT_DeleteEntry(handle, &ids[i])));
+        TEST_ASSERT(BPT_GetEntry(handle, &ids[i], &find) == 0);
+        TEST_ASSERT(find.id == -1);
+    }
+    TEST_ASSERT(handle->rec_count == RECORDS_NUM - TO_DELETE);
+    TEST_ASSERT(GET_NUM_ENTRIES(BPT_GetRange(handle, NULL, NULL, TMP_LIST))
+        == RECORDS_NUM - TO_DELETE);
+
+    for (int i = 0; i < TO_DELETE; ++i) {
+        Record rec = random_record();
+        rec.id = ids[i];
+        TEST_ASSERT(INSERTED(handle, BPT_InsertEntry(handle, rec)));
+        TEST_ASSERT(BPT_GetEntry(handle, &ids[i], &find) == 0);
+        TEST_ASSERT(compare_records(&find, &rec));
+    }
+    TEST_ASSERT(handle->rec_count == RECORDS_NUM);
+
+    free(ids);
+    TEST_ASSERT(BPT_CloseFile(handle) == 0);
+    TEST_ASSERT(BF_Close() == BF_OK);
+    TEST_ASSERT(remove(FILENAME) == 0);
+}
+
+
+void test_range()
+{
+    srand(time(NULL) * getpid());
+
+    BPlus_file *handle;
+    int *ids = shuffled_numbers(RECORDS_NUM);
+
+    TEST_ASSERT(BF_Init(LRU) == BF_OK);
+    TEST_ASSERT(BPT_CreateFile(FILENAME, ID) == 0);
+    TEST_ASSERT((handle = BPT_OpenFile(FILENAME)) != NULL);
+
+    for (int i = 0; i < RECORDS_NUM; ++i) {
+        Record rec = random_record();
+        rec.id = 2 * ids[i];
+        TEST_ASSERT(INSERTED(handle, BPT_InsertEntry(handle, rec)));
+    }
+
+    for (int i = 0; i < 20; ++i) {
+        int low = rand() % (2 * RECORDS_NUM) - 10;
+        int high = low + rand() % 200;
+
+        Dl_list list = list_create(free);
+        TEST_ASSERT(BPT_GetRange(handle, &low, &high, list) == 0);
+
+        int expected = 0;
+        for (int id = low; id <= high; ++id)
+            expected += id >= 0 && id < 2 * RECORDS_NUM && id % 2 == 0;
+        TEST_ASSERT(list_size(list) == expected);
+
+        int last = low - 1;
+        for (Dl_list_node node = list_first(list); node != NULL; node = list_next(node)) {
+            Record *rec = list_value(node);
+            TEST_ASSERT(rec->id > last && rec->id <= high);
+            last = rec->id;
+        }
+        list_destroy(list);
+    }
+
+    int low = RECORDS_NUM;
+    TEST_ASSERT(GET_NUM_ENTRIES(BPT_GetRange(handle, &low, NULL, TMP_LIST)) == RECORDS_NUM / 2);
+    TEST_ASSERT(GET_NUM_ENTRIES(BPT_GetRange(handle, NULL, &low, TMP_LIST)) == RECORDS_NUM / 2 + 1);
+
+    free(ids);
+    TEST_ASSERT(BPT_CloseFile(handle) == 0);
+    TEST_ASSERT(BF_Close() == BF_OK);
+    TEST_ASSERT(remove(FILENAME) == 0);
+}
+
+
+TEST_LIST = {
+    { "test_create", test_create },
+    { "test_insert", test_insert },
+    { "test_delete", test_delete },
+    { "test_range",  test_range  },
+
+    { NULL, NULL }
+};
@@ -1,5 +1,6 @@
 #include "acutest.h"
 #include "hash_file.h"
+#include "shash_file.h"
 #include "dl_list.h"
 
 #define RECORDS_NUM 3000
@@ -8,6 +9,7 @@
 
 #define FILENAME "data.db"
 #define FILENAME2 "data1.db"
+#define INDEXNAME "data2.db"
 
 
 const rec_attr attr[] = {
@@ -147,7 +149,7 @@ void test_insert()
 			memcpy(&block_handle, data, sizeof(Hash_block));
 
 			rec_count += block_handle.rec_num;
-			data += sizeof(Record) * (block_handle.rec_num - 1) + sizeof(Hash_block);
+			data = HT_RECORDS(handle, data) + sizeof(Record) * (block_handle.rec_num - 1);
 			for (size_t j = block_handle.rec_num; j > 0; j--, data -= sizeof(Record)) {
 				Record rec;
 				memcpy(&rec, data, sizeof(Record));
@@ -234,7 +236,7 @@ void test_delete()
 			memcpy(&block_handle, data, sizeof(Hash_block));
 
 			rec_count += block_handle.rec_num;
-			data += sizeof(Record) * (block_handle.rec_num - 1) + sizeof(Hash_block);
+			data = HT_RECORDS(handle, data) + sizeof(Record) * (block_handle.rec_num - 1);
 			for (size_t j = block_handle.rec_num; j > 0; j--, data -= sizeof(Record)) {
 				Record rec;
 				memcpy(&rec, data, sizeof(Record));
@@ -353,11 +355,1134 @@ void test_find()
 }
 
 
+void test_extendible() 
+{
+	HT_Init();
+
+	srand(time(NULL) * getpid());
+	TEST_ASSERT(BF_Init(LRU) == BF_OK);
+
+	TEST_ASSERT(HT_CreateFileEx(FILENAME, ID, 3, LINEAR_HASH, ROW_LAYOUT, BF_BLOCK_SIZE) == -1);
+	TEST_ASSERT(HT_CreateFileEx(FILENAME, ID, 3, EXTENDIBLE_HASH, ROW_LAYOUT, BF_BLOCK_SIZE) == 0);
+	TEST_ASSERT(SHT_CreateFile(INDEXNAME, CITY, FILENAME, BUCKETS) == 0);
+
+	Hash_file *handle;
+	SHash_file *shandle;
+	TEST_ASSERT((handle = HT_OpenFile(FILENAME)) != NULL);
+	TEST_ASSERT((shandle = SHT_OpenFile(INDEXNAME)) != NULL);
+	TEST_ASSERT(handle->mode == EXTENDIBLE_HASH);
+	TEST_ASSERT(handle->buckets == 4 && handle->global_depth == 2);
+
+	int block_id, count_c = 0;
+	Record rec = random_record();
+	char *city = strdup(rec.city);
+	for (int i = 0; i < RECORDS_NUM; i++) {
+		TEST_ASSERT(INSERTED(handle, HT_InsertEntry(handle, rec, &block_id)));
+		TEST_ASSERT(SHT_InsertEntry(shandle, rec, block_id) == 0);
+		count_c += strcmp(city, rec.city) == 0;
+		rec = random_record();
+	}
+
+	TEST_ASSERT(handle->global_depth > 2);
+	TEST_ASSERT(handle->buckets == 1 << handle->global_depth);
+	TEST_ASSERT(GET_NUM_ENTRIES(SHT_GetEntries(shandle, city, TMP_LIST)) == count_c);
+
+	TEST_ASSERT(HT_CloseFile(handle) == 0);
+	TEST_ASSERT(SHT_CloseFile(shandle) == 0);
+	TEST_ASSERT((handle = HT_OpenFile(FILENAME)) != NULL);
+	TEST_ASSERT(handle->rec_count == RECORDS_NUM);
+
+	BF_Block *block;
+	BF_Block_Init(&block);
+	for (int i = 0; i < handle->buckets; ++i) {
+		Hash_block block_handle;
+		TEST_ASSERT(BF_GetBlock(handle->file_desc, handle->hash_table[i], block) == BF_OK);
+		memcpy(&block_handle, BF_Block_GetData(block), sizeof(Hash_block));
+		TEST_ASSERT(block_handle.overf_block == -1);
+		TEST_ASSERT(block_handle.local_depth <= handle->global_depth);
+		TEST_ASSERT(handle->hash_table[i] == handle->hash_table[i % (1 << block_handle.local_depth)]);
+		TEST_ASSERT(BF_UnpinBlock(block) == BF_OK);
+	}
+	BF_Block_Destroy(&block);
+
+	Record find;
+	int *to_delete = random_numbers(TO_DELETE, 0, RECORDS_NUM - 1);
+	for (int i = 0; i < TO_DELETE; i++)
+		TEST_ASSERT(DELETED(handle, HT_DeleteEntry(handle, &to_delete[i])));
+
+	for (int i = 0; i < TO_DELETE; i++) {
+		TEST_ASSERT(HT_GetEntry(handle, &to_delete[i], &find) == 0);
+		TEST_ASSERT(find.id == -1);
+	}
+	TEST_ASSERT(HT_GetEntry(handle, &rec.id, &find) == 0);
+	TEST_ASSERT(find.id == -1);
+	TEST_ASSERT(GET_NUM_ENTRIES(HT_GetAllEntries(handle, CITY, city, TMP_LIST)) 
+		== GET_NUM_ENTRIES(SHT_GetEntries((shandle = SHT_OpenFile(INDEXNAME)), city, TMP_LIST)));
+
+	TEST_ASSERT(SHT_CloseFile(shandle) == 0);
+	TEST_ASSERT(HT_CloseFile(handle) == 0);
+	TEST_ASSERT(BF_Close() == BF_OK);
+	TEST_ASSERT(remove(FILENAME) == 0);
+	TEST_ASSERT(remove(INDEXNAME) == 0);
+
+	free(to_delete);
+	free(city);
+	HT_Close();
+}
+
+
+static void check_buckets(Hash_file *handle) 
+{
+	int rec_count = 0;
+	BF_Block *block;
+	BF_Block_Init(&block);
+	for (int i = 0; i < handle->buckets; ++i) {
+		int block_t = handle->hash_table[i];
+		while (block_t != -1) {
+			Hash_block block_handle;
+			TEST_ASSERT(BF_GetBlock(handle->file_desc, block_t, block) == BF_OK);
+			char *data = BF_Block_GetData(block);
+			memcpy(&block_handle, data, sizeof(Hash_block));
+			data = HT_RECORDS(handle, data);
+			for (int j = 0; j < block_handle.rec_num; j++, data += sizeof(Record)) {
+				Record rec;
+				memcpy(&rec, data, sizeof(Record));
+				TEST_ASSERT(hash_key(INT, &rec.id) % handle->buckets == i);
+			}
+			rec_count += block_handle.rec_num;
+			block_t = block_handle.overf_block;
+			TEST_ASSERT(BF_UnpinBlock(block) == BF_OK);
+		}
+	}
+	BF_Block_Destroy(&block);
+	TEST_ASSERT(rec_count == handle->rec_count);
+}
+
+
+void test_resize() 
+{
+	HT_Init();
+
+	srand(time(NULL) * getpid());
+	TEST_ASSERT(BF_Init(LRU) == BF_OK);
+
+	TEST_ASSERT(HT_CreateFile(FILENAME, ID, BUCKETS) == 0);
+	TEST_ASSERT(SHT_CreateFile(INDEXNAME, CITY, FILENAME, BUCKETS) == 0);
+
+	Hash_file *handle;
+	SHash_file *shandle;
+	TEST_ASSERT((handle = HT_OpenFile(FILENAME)) != NULL);
+	TEST_ASSERT((shandle = SHT_OpenFile(INDEXNAME)) != NULL);
+
+	int block_id;
+	Record rec = random_record(), find;
+	int first_id = rec.id;
+	for (int i = 0; i < RECORDS_NUM; i++) {
+		TEST_ASSERT(INSERTED(handle, HT_InsertEntry(handle, rec, &block_id)));
+		TEST_ASSERT(SHT_InsertEntry(shandle, rec, block_id) == 0);
+		rec = random_record();
+	}
+
+	TEST_ASSERT(HT_Resize(handle, 0) == -1);
+	TEST_ASSERT(handle->buckets == BUCKETS);
+
+	const int sizes[] = { 3 * BUCKETS + 7, 13 };
+	for (int k = 0; k < array_size(sizes); ++k) {
+		TEST_ASSERT(HT_Resize(handle, sizes[k]) == 0);
+		TEST_ASSERT(handle->buckets == sizes[k]);
+		check_buckets(handle);
+
+		TEST_ASSERT(HT_CloseFile(handle) == 0);
+		TEST_ASSERT((handle = HT_OpenFile(FILENAME)) != NULL);
+		TEST_ASSERT(handle->buckets == sizes[k]);
+		check_buckets(handle);
+
+		for (int id = first_id; id < first_id + RECORDS_NUM; ++id) {
+			TEST_ASSERT(HT_GetEntry(handle, &id, &find) == 0);
+			TEST_ASSERT(find.id == id);
+		}
+		for (int c = 0; c < 12; ++c) {
+			rec = random_record();
+			TEST_ASSERT(GET_NUM_ENTRIES(HT_GetAllEntries(handle, CITY, rec.city, TMP_LIST)) 
+				== GET_NUM_ENTRIES(SHT_GetEntries(shandle, rec.city, TMP_LIST)));
+		}
+	}
+
+	TEST_ASSERT(HT_CloseFile(handle) == 0);
+	TEST_ASSERT(SHT_CloseFile(shandle) == 0);
+	TEST_ASSERT(BF_Close() == BF_OK);
+	TEST_ASSERT(remove(FILENAME) == 0);
+	TEST_ASSERT(remove(INDEXNAME) == 0);
+	HT_Close();
+}
+
+
+void test_bulk_load() 
+{
+	HT_Init();
+
+	srand(time(NULL) * getpid());
+	TEST_ASSERT(BF_Init(LRU) == BF_OK);
+	TEST_ASSERT(HT_CreateFile(FILENAME, ID, BUCKETS) == 0);
+
+	Hash_file *handle;
+	TEST_ASSERT((handle = HT_OpenFile(FILENAME)) != NULL);
+
+	for (int i = 0; i < TO_DELETE; i++) {
+		Record rec = random_record();
+		rec.id = i;
+		TEST_ASSERT(INSERTED(handle, HT_InsertEntry(handle, rec, NULL)));
+	}
+
+	Record *recs = malloc(RECORDS_NUM * sizeof(Record));
+	int *block_ids = malloc(RECORDS_NUM * sizeof(int));
+	for (int i = 0; i < RECORDS_NUM; i++) {
+		recs[i] = random_record();
+		recs[i].id = i % (RECORDS_NUM / 2);
+	}
+
+	TEST_ASSERT(HT_BulkLoad(handle, recs, RECORDS_NUM, true, block_ids) == 0);
+	TEST_ASSERT(handle->rec_count == RECORDS_NUM / 2);
+	for (int i = 0; i < RECORDS_NUM / 2; i++) {
+		TEST_ASSERT(block_ids[i] > 0);
+		TEST_ASSERT(block_ids[i] == block_ids[i + RECORDS_NUM / 2]);
+	}
+
+	check_buckets(handle);
+	TEST_ASSERT(HT_CloseFile(handle) == 0);
+	TEST_ASSERT((handle = HT_OpenFile(FILENAME)) != NULL);
+
+	Record find;
+	for (int i = TO_DELETE; i < RECORDS_NUM / 2; i++) {
+		TEST_ASSERT(HT_GetEntry(handle, &i, &find) == 0);
+		TEST_ASSERT(!memcmp(&find, &recs[i], sizeof(Record)));
+	}
+
+	for (int i = 0; i < RECORDS_NUM; i++)
+		recs[i].id += RECORDS_NUM;
+
+	TEST_ASSERT(HT_BulkLoad(handle, recs + RECORDS_NUM / 2, RECORDS_NUM / 2, false, NULL) == 0);
+	TEST_ASSERT(handle->rec_count == RECORDS_NUM);
+	check_buckets(handle);
+	for (int i = RECORDS_NUM / 2; i < RECORDS_NUM; i++) {
+		TEST_ASSERT(HT_GetEntry(handle, &recs[i].id, &find) == 0);
+		TEST_ASSERT(!memcmp(&find, &recs[i], sizeof(Record)));
+	}
+
+	free(recs);
+	free(block_ids);
+	TEST_ASSERT(HT_CloseFile(handle) == 0);
+	TEST_ASSERT(BF_Close() == BF_OK);
+	TEST_ASSERT(remove(FILENAME) == 0);
+	HT_Close();
+}
+
+
+void test_insert_batch() 
+{
+	HT_Init();
+
+	srand(time(NULL) * getpid());
+	TEST_ASSERT(BF_Init(LRU) == BF_OK);
+	TEST_ASSERT(HT_CreateFile(FILENAME, ID, BUCKETS) == 0);
+	TEST_ASSERT(SHT_CreateFile(INDEXNAME, CITY, FILENAME, BUCKETS) == 0);
+
+	Hash_file *handle;
+	SHash_file *shandle;
+	TEST_ASSERT((handle = HT_OpenFile(FILENAME)) != NULL);
+	TEST_ASSERT((shandle = SHT_OpenFile(INDEXNAME)) != NULL);
+
+	int block_id;
+	for (int i = 0; i < TO_DELETE; i++) {
+		Record rec = random_record();
+		rec.id = i;
+		TEST_ASSERT(INSERTED(handle, HT_InsertEntry(handle, rec, &block_id)));
+		TEST_ASSERT(SHT_InsertEntry(shandle, rec, block_id) == 0);
+	}
+
+	Record *recs = malloc(RECORDS_NUM * sizeof(Record));
+	int *block_ids = malloc(RECORDS_NUM * sizeof(int));
+	for (int i = 0; i < RECORDS_NUM; i++) {
+		recs[i] = random_record();
+		recs[i].id = i % (RECORDS_NUM / 2);
+	}
+
+	TEST_ASSERT(HT_InsertBatch(handle, recs, RECORDS_NUM, block_ids) == 0);
+	TEST_ASSERT(handle->rec_count == RECORDS_NUM / 2);
+	for (int i = 0; i < RECORDS_NUM / 2; i++) {
+		TEST_ASSERT(block_ids[i] > 0);
+		TEST_ASSERT(block_ids[i] == block_ids[i + RECORDS_NUM / 2]);
+	}
+	check_buckets(handle);
+
+	TEST_ASSERT(SHT_CloseFile(shandle) == 0);
+	for (int i = 0; i < RECORDS_NUM; i++)
+		recs[i].id += RECORDS_NUM;
+	TEST_ASSERT(HT_InsertBatch(handle, recs, RECORDS_NUM / 2, NULL) == 0);
+	TEST_ASSERT(handle->rec_count == RECORDS_NUM);
+
+	TEST_ASSERT((shandle = SHT_OpenFile(INDEXNAME)) != NULL);
+	for (int i = 0; i < RECORDS_NUM; i += RECORDS_NUM / 10)
+		TEST_ASSERT(GET_NUM_ENTRIES(HT_GetAllEntries(handle, CITY, recs[i].city, TMP_LIST)) 
+			== GET_NUM_ENTRIES(SHT_GetEntries(shandle, recs[i].city, TMP_LIST)));
+
+	free(recs);
+	free(block_ids);
+	TEST_ASSERT(SHT_CloseFile(shandle) == 0);
+	TEST_ASSERT(HT_CloseFile(handle) == 0);
+	TEST_ASSERT(BF_Close() == BF_OK);
+	TEST_ASSERT(remove(FILENAME) == 0);
+	TEST_ASSERT(remove(INDEXNAME) == 0);
+	HT_Close();
+}
+
+
+typedef struct {
+	rec_attr attr;
+	Record last;
+	int count;
+	int limit;
+	bool sorted;
+} Scan_state;
+
+static int check_order(Record *rec, void *arg) 
+{
+	Scan_state *state = arg;
+	if (state->count++ > 0 && compare_keys(get_rec_member(&state->last, state->attr), 
+	                                       get_rec_member(rec, state->attr), 
+	                                       state->attr) > 0)
+		state->sorted = false;
+	state->last = *rec;
+	return state->count == state->limit;
+}
+
+void test_range_scan() 
+{
+	HT_Init();
+
+	srand(time(NULL) * getpid());
+	TEST_ASSERT(BF_Init(LRU) == BF_OK);
+	TEST_ASSERT(HT_CreateFile(FILENAME, ID, BUCKETS) == 0);
+
+	Hash_file *handle;
+	TEST_ASSERT((handle = HT_OpenFile(FILENAME)) != NULL);
+
+	int records = 20 * RECORDS_NUM;
+	Record *recs = malloc(records * sizeof(Record));
+	for (int i = 0; i < records; i++) {
+		recs[i] = random_record();
+		recs[i].id = i;
+	}
+	TEST_ASSERT(HT_BulkLoad(handle, recs, records, false, NULL) == 0);
+
+	Scan_state state = { .attr = ID, .sorted = true };
+	TEST_ASSERT(HT_RangeScan(handle, ID, NULL, NULL, check_order, &state) == 0);
+	TEST_ASSERT(state.count == records && state.sorted);
+	TEST_ASSERT(state.last.id == records - 1);
+
+	int low = RECORDS_NUM, high = 2 * RECORDS_NUM;
+	state = (Scan_state) { .attr = ID, .sorted = true };
+	TEST_ASSERT(HT_RangeScan(handle, ID, &low, &high, check_order, &state) == 0);
+	TEST_ASSERT(state.count == high - low + 1 && state.sorted);
+	TEST_ASSERT(!memcmp(&state.last, &recs[high], sizeof(Record)));
+
+	state = (Scan_state) { .attr = ID, .sorted = true, .limit = TO_DELETE };
+	TEST_ASSERT(HT_RangeScan(handle, ID, &low, NULL, check_order, &state) == 1);
+	TEST_ASSERT(state.count == TO_DELETE && state.sorted);
+	TEST_ASSERT(state.last.id == low + TO_DELETE - 1);
+
+	char *city = recs[0].city;
+	state = (Scan_state) { .attr = CITY, .sorted = true };
+	TEST_ASSERT(HT_RangeScan(handle, CITY, city, city, check_order, &state) == 0);
+	TEST_ASSERT(state.count == GET_NUM_ENTRIES(HT_GetAllEntries(handle, CITY, city, TMP_LIST)));
+
+	state = (Scan_state) { .attr = CITY, .sorted = true };
+	TEST_ASSERT(HT_RangeScan(handle, CITY, NULL, NULL, check_order, &state) == 0);
+	TEST_ASSERT(state.count == records && state.sorted);
+
+	free(recs);
+	TEST_ASSERT(HT_CloseFile(handle) == 0);
+	TEST_ASSERT(BF_Close() == BF_OK);
+	TEST_ASSERT(remove(FILENAME) == 0);
+	HT_Close();
+}
+
+
+void test_scan() 
+{
+	HT_Init();
+
+	srand(time(NULL) * getpid());
+	TEST_ASSERT(BF_Init(LRU) == BF_OK);
+	TEST_ASSERT(HT_CreateFile(FILENAME, ID, BUCKETS) == 0);
+	TEST_ASSERT(SHT_CreateFile(INDEXNAME, CITY, FILENAME, BUCKETS) == 0);
+
+	Hash_file *handle;
+	SHash_file *shandle;
+	TEST_ASSERT((handle = HT_OpenFile(FILENAME)) != NULL);
+	TEST_ASSERT((shandle = SHT_OpenFile(INDEXNAME)) != NULL);
+
+	Record *recs = malloc(RECORDS_NUM * sizeof(Record));
+	for (int i = 0; i < RECORDS_NUM; i++) {
+		recs[i] = random_record();
+		recs[i].id = i;
+	}
+	TEST_ASSERT(HT_InsertBatch(handle, recs, RECORDS_NUM, NULL) == 0);
+
+	Record *rec;
+	HT_Scan *scan;
+	int count = 0, id = RECORDS_NUM / 2;
+	TEST_ASSERT((scan = HT_Scan_Open(handle, ID, NULL)) != NULL);
+	while (HT_Scan_Next(scan, &rec) > 0)
+		TEST_ASSERT(!memcmp(rec, &recs[rec->id], sizeof(Record)) && ++count);
+	TEST_ASSERT(HT_Scan_Close(scan) == 0);
+	TEST_ASSERT(count == RECORDS_NUM);
+
+	TEST_ASSERT((scan = HT_Scan_Open(handle, ID, &id)) != NULL);
+	TEST_ASSERT(HT_Scan_Next(scan, &rec) == 1);
+	TEST_ASSERT(!memcmp(rec, &recs[id], sizeof(Record)));
+	TEST_ASSERT(HT_Scan_Next(scan, &rec) == 0);
+	TEST_ASSERT(HT_Scan_Close(scan) == 0);
+
+	/* Closing a cursor midway releases its block */
+	char *city = recs[id].city;
+	TEST_ASSERT((scan = HT_Scan_Open(handle, CITY, city)) != NULL);
+	TEST_ASSERT(HT_Scan_Next(scan, &rec) == 1);
+	TEST_ASSERT(!strcmp(rec->city, city));
+	TEST_ASSERT(HT_Scan_Close(scan) == 0);
+
+	SHT_Scan *sscan;
+	count = 0;
+	TEST_ASSERT((sscan = SHT_Scan_Open(shandle, city)) != NULL);
+	while (SHT_Scan_Next(sscan, &rec) > 0)
+		TEST_ASSERT(!memcmp(rec, &recs[rec->id], sizeof(Record)) && !strcmp(rec->city, city) && ++count);
+	TEST_ASSERT(SHT_Scan_Close(sscan) == 0);
+	TEST_ASSERT(count == GET_NUM_ENTRIES(HT_GetAllEntries(handle, CITY, city, TMP_LIST)));
+
+	/* Values longer than the attribute match nothing */
+	char long_city[100];
+	memset(long_city, 'a', sizeof(long_city) - 1);
+	long_city[sizeof(long_city) - 1] = '\0';
+	memcpy(long_city, city, strlen(city));
+	TEST_ASSERT((scan = HT_Scan_Open(handle, CITY, long_city)) != NULL);
+	TEST_ASSERT(HT_Scan_Next(scan, &rec) == 0);
+	TEST_ASSERT(HT_Scan_Close(scan) == 0);
+	TEST_ASSERT((sscan = SHT_Scan_Open(shandle, long_city)) != NULL);
+	TEST_ASSERT(SHT_Scan_Next(sscan, &rec) == 0);
+	TEST_ASSERT(SHT_Scan_Close(sscan) == 0);
+
+	free(recs);
+	TEST_ASSERT(SHT_CloseFile(shandle) == 0);
+	TEST_ASSERT(HT_CloseFile(handle) == 0);
+	TEST_ASSERT(BF_Close() == BF_OK);
+	TEST_ASSERT(remove(FILENAME) == 0);
+	TEST_ASSERT(remove(INDEXNAME) == 0);
+	HT_Close();
+}
+
+
+typedef struct {
+	int count;
+	int min;
+	int max;
+	int limit;
+} Aggregate;
+
+static int aggregate(Record *rec, void *arg) 
+{
+	Aggregate *agg = arg;
+	if (agg->count++ == 0 || rec->id < agg->min)
+		agg->min = rec->id;
+	if (agg->count == 1 || rec->id > agg->max)
+		agg->max = rec->id;
+	return agg->count == agg->limit;
+}
+
+void test_for_each() 
+{
+	HT_Init();
+
+	srand(time(NULL) * getpid());
+	TEST_ASSERT(BF_Init(LRU) == BF_OK);
+	TEST_ASSERT(HT_CreateFile(FILENAME, ID, BUCKETS) == 0);
+	TEST_ASSERT(SHT_CreateFile(INDEXNAME, CITY, FILENAME, BUCKETS) == 0);
+
+	Hash_file *handle;
+	SHash_file *shandle;
+	TEST_ASSERT((handle = HT_OpenFile(FILENAME)) != NULL);
+	TEST_ASSERT((shandle = SHT_OpenFile(INDEXNAME)) != NULL);
+
+	Record *recs = malloc(RECORDS_NUM * sizeof(Record));
+	for (int i = 0; i < RECORDS_NUM; i++) {
+		recs[i] = random_record();
+		recs[i].id = i;
+	}
+	TEST_ASSERT(HT_InsertBatch(handle, recs, RECORDS_NUM, NULL) == 0);
+
+	Aggregate agg = { 0 };
+	TEST_ASSERT(HT_ForEach(handle, ID, NULL, aggregate, &agg) == 0);
+	TEST_ASSERT(agg.count == RECORDS_NUM);
+	TEST_ASSERT(agg.min == 0 && agg.max == RECORDS_NUM - 1);
+
+	int id = RECORDS_NUM / 2;
+	agg = (Aggregate) { 0 };
+	TEST_ASSERT(HT_ForEach(handle, ID, &id, aggregate, &agg) == 0);
+	TEST_ASSERT(agg.count == 1 && agg.min == id && agg.max == id);
+
+	agg = (Aggregate) { .limit = TO_DELETE };
+	TEST_ASSERT(HT_ForEach(handle, ID, NULL, aggregate, &agg) == 1);
+	TEST_ASSERT(agg.count == TO_DELETE);
+
+	char *city = recs[id].city;
+	int expected = 0, min = RECORDS_NUM, max = -1;
+	for (int i = 0; i < RECORDS_NUM; i++) {
+		if (strcmp(recs[i].city, city))
+			continue;
+		expected++;
+		min = i < min ? i : min;
+		max = i > max ? i : max;
+	}
+
+	agg = (Aggregate) { 0 };
+	TEST_ASSERT(HT_ForEach(handle, CITY, city, aggregate, &agg) == 0);
+	TEST_ASSERT(agg.count == expected && agg.min == min && agg.max == max);
+
+	agg = (Aggregate) { 0 };
+	TEST_ASSERT(SHT_ForEach(shandle, city, aggregate, &agg) == 0);
+	TEST_ASSERT(agg.count == expected && agg.min == min && agg.max == max);
+
+	agg = (Aggregate) { .limit = 1 };
+	TEST_ASSERT(SHT_ForEach(shandle, city, aggregate, &agg) == 1);
+	TEST_ASSERT(agg.count == 1);
+
+	free(recs);
+	TEST_ASSERT(SHT_CloseFile(shandle) == 0);
+	TEST_ASSERT(HT_CloseFile(handle) == 0);
+	TEST_ASSERT(BF_Close() == BF_OK);
+	TEST_ASSERT(remove(FILENAME) == 0);
+	TEST_ASSERT(remove(INDEXNAME) == 0);
+	HT_Close();
+}
+
+
+typedef struct {
+	Hash_file *handle;
+	int code;
+} Write_visit;
+
+static int delete_visited(Record *rec, void *arg) 
+{
+	Write_visit *write = arg;
+	write->code = HT_DeleteEntry(write->handle, &rec->id);
+	return 1;
+}
+
+static int insert_visited(Record *rec, void *arg) 
+{
+	Write_visit *write = arg;
+	write->code = HT_InsertEntry(write->handle, *rec, NULL);
+	return 1;
+}
+
+/* Writes that would wait on a latch held by a cursor of the same thread fail */
+void test_cursor_writes() 
+{
+	HT_Init();
+
+	srand(time(NULL) * getpid());
+	TEST_ASSERT(BF_Init(LRU) == BF_OK);
+
+	Hash_file *handle;
+	const hash_mode modes[] = { STATIC_HASH, EXTENDIBLE_HASH };
+	for (int m = 0; m < array_size(modes); m++) {
+		TEST_ASSERT(HT_CreateFileEx(FILENAME, ID, BUCKETS, modes[m], ROW_LAYOUT, BF_BLOCK_SIZE) == 0);
+		TEST_ASSERT((handle = HT_OpenFile(FILENAME)) != NULL);
+
+		Record *recs = malloc(RECORDS_NUM * sizeof(Record));
+		for (int i = 0; i < RECORDS_NUM; i++) {
+			recs[i] = random_record();
+			recs[i].id = i;
+		}
+		TEST_ASSERT(HT_InsertBatch(handle, recs, RECORDS_NUM / 2, NULL) == 0);
+
+		/* A lookup holds the latch of its key's bucket, and a full scan that of its 
+		 * current bucket. Static files still take writes to other buckets */
+		int id = 0, other = 1;
+		while (hash_key(INT, &other) % BUCKETS % HT_LATCHES == hash_key(INT, &id) % BUCKETS % HT_LATCHES)
+			other++;
+
+		HT_Scan *scan;
+		Record *rec;
+		TEST_ASSERT((scan = HT_Scan_Open(handle, ID, &id)) != NULL);
+		TEST_ASSERT(HT_Scan_Next(scan, &rec) == 1);
+		TEST_ASSERT(HT_DeleteEntry(handle, &id) == -1);
+		TEST_ASSERT(HT_InsertEntry(handle, recs[id], NULL) == -1);
+		TEST_ASSERT(HT_Resize(handle, 2 * BUCKETS) == -1);
+		TEST_ASSERT(HT_InsertBatch(handle, recs + RECORDS_NUM / 2, 1, NULL) == -1);
+		TEST_ASSERT(HT_DeleteEntry(handle, &other) == (modes[m] == STATIC_HASH ? 0 : -1));
+		TEST_ASSERT(HT_Scan_Close(scan) == 0);
+
+		Write_visit write = { .handle = handle };
+		TEST_ASSERT(HT_ForEach(handle, ID, NULL, delete_visited, &write) == 1);
+		TEST_ASSERT(write.code == -1);
+
+		write = (Write_visit) { .handle = handle };
+		TEST_ASSERT(HT_ForEach(handle, CITY, recs[0].city, insert_visited, &write) == 1);
+		TEST_ASSERT(write.code == -1);
+
+		/* Closed cursors release their latches */
+		TEST_ASSERT(HT_DeleteEntry(handle, &id) == 0);
+		TEST_ASSERT(HT_InsertEntry(handle, recs[RECORDS_NUM / 2], NULL) == 0);
+		TEST_ASSERT(handle->rec_count == RECORDS_NUM / 2 - (modes[m] == STATIC_HASH ? 1 : 0));
+
+		free(recs);
+		TEST_ASSERT(HT_CloseFile(handle) == 0);
+		TEST_ASSERT(remove(FILENAME) == 0);
+	}
+
+	/* Secondary cursors hold the primary file latch, 
+	 * so writes to a file with indexes always need it */
+	TEST_ASSERT(HT_CreateFile(FILENAME, ID, BUCKETS) == 0);
+	TEST_ASSERT(SHT_CreateFile(INDEXNAME, CITY, FILENAME, BUCKETS) == 0);
+	SHash_file *shandle;
+	TEST_ASSERT((handle = HT_OpenFile(FILENAME)) != NULL);
+	TEST_ASSERT((shandle = SHT_OpenFile(INDEXNAME)) != NULL);
+
+	Record rec = random_record();
+	int block_id;
+	rec.id = 0;
+	TEST_ASSERT(HT_InsertEntry(handle, rec, &block_id) == 0);
+	TEST_ASSERT(SHT_InsertEntry(shandle, rec, block_id) == 0);
+
+	Write_visit write = { .handle = handle };
+	TEST_ASSERT(SHT_ForEach(shandle, rec.city, insert_visited, &write) == 1);
+	TEST_ASSERT(write.code == -1);
+
+	write = (Write_visit) { .handle = handle };
+	TEST_ASSERT(SHT_ForEach(shandle, rec.city, delete_visited, &write) == 1);
+	TEST_ASSERT(write.code == -1);
+
+	HT_Scan *scan;
+	TEST_ASSERT((scan = HT_Scan_Open(handle, ID, NULL)) != NULL);
+	TEST_ASSERT(SHT_Build(FILENAME2, NAME, FILENAME) == -1);
+	TEST_ASSERT(HT_Scan_Close(scan) == 0);
+	TEST_ASSERT(HT_DeleteEntry(handle, &rec.id) == 0);
+	TEST_ASSERT(handle->rec_count == 0);
+
+	TEST_ASSERT(SHT_CloseFile(shandle) == 0);
+	TEST_ASSERT(HT_CloseFile(handle) == 0);
+	TEST_ASSERT(BF_Close() == BF_OK);
+	TEST_ASSERT(remove(FILENAME) == 0);
+	TEST_ASSERT(remove(INDEXNAME) == 0);
+	HT_Close();
+}
+
+
+void test_pax() 
+{
+	HT_Init();
+
+	srand(time(NULL) * getpid());
+	TEST_ASSERT(BF_Init(LRU) == BF_OK);
+	TEST_ASSERT(HT_CreateFileEx(FILENAME, ID, 2, EXTENDIBLE_HASH, PAX_LAYOUT, BF_BLOCK_SIZE) == 0);
+	TEST_ASSERT(SHT_CreateFile(INDEXNAME, CITY, FILENAME, BUCKETS) == 0);
+
+	Hash_file *handle;
+	SHash_file *shandle;
+	TEST_ASSERT((handle = HT_OpenFile(FILENAME)) != NULL);
+	TEST_ASSERT((shandle = SHT_OpenFile(INDEXNAME)) != NULL);
+	TEST_ASSERT(handle->layout == PAX_LAYOUT);
+
+	Record rec, *recs = malloc(RECORDS_NUM * sizeof(Record));
+	for (int i = 0; i < RECORDS_NUM; i++) {
+		recs[i] = random_record();
+		recs[i].id = i;
+	}
+	TEST_ASSERT(HT_InsertBatch(handle, recs, RECORDS_NUM, NULL) == 0);
+	TEST_ASSERT(handle->rec_count == RECORDS_NUM);
+
+	for (int i = 0; i < TO_DELETE; i++)
+		TEST_ASSERT(DELETED(handle, HT_DeleteEntry(handle, &i)));
+
+	for (int i = 0; i < RECORDS_NUM; i++) {
+		TEST_ASSERT(HT_GetEntry(handle, &i, &rec) == 0);
+		TEST_ASSERT(i < TO_DELETE ? rec.id == -1 : !memcmp(&rec, &recs[i], sizeof(Record)));
+	}
+
+	char *city = recs[RECORDS_NUM / 2].city;
+	int expected = 0;
+	for (int i = TO_DELETE; i < RECORDS_NUM; i++)
+		expected += !strcmp(recs[i].city, city);
+
+	Aggregate agg = { 0 };
+	TEST_ASSERT(HT_ForEach(handle, CITY, city, aggregate, &agg) == 0);
+	TEST_ASSERT(agg.count == expected);
+
+	Record *found;
+	SHT_Scan *sscan;
+	int count = 0;
+	TEST_ASSERT((sscan = SHT_Scan_Open(shandle, city)) != NULL);
+	while (SHT_Scan_Next(sscan, &found) > 0)
+		TEST_ASSERT(!memcmp(found, &recs[found->id], sizeof(Record)) && ++count);
+	TEST_ASSERT(SHT_Scan_Close(sscan) == 0);
+	TEST_ASSERT(count == expected);
+
+	Scan_state state = { .attr = ID, .sorted = true };
+	TEST_ASSERT(HT_RangeScan(handle, ID, NULL, NULL, check_order, &state) == 0);
+	TEST_ASSERT(state.count == RECORDS_NUM - TO_DELETE && state.sorted);
+
+	free(recs);
+	TEST_ASSERT(SHT_CloseFile(shandle) == 0);
+	TEST_ASSERT(HT_CloseFile(handle) == 0);
+	TEST_ASSERT(BF_Close() == BF_OK);
+	TEST_ASSERT(remove(FILENAME) == 0);
+	TEST_ASSERT(remove(INDEXNAME) == 0);
+	HT_Close();
+}
+
+
+void test_fingerprint() 
+{
+	HT_Init();
+
+	srand(time(NULL) * getpid());
+	TEST_ASSERT(BF_Init(LRU) == BF_OK);
+	TEST_ASSERT(HT_CreateFile(FILENAME, ID, 5) == 0);
+	TEST_ASSERT(SHT_CreateFile(INDEXNAME, NAME, FILENAME, 5) == 0);
+
+	Hash_file *handle;
+	SHash_file *shandle;
+	TEST_ASSERT((handle = HT_OpenFile(FILENAME)) != NULL);
+	TEST_ASSERT((shandle = SHT_OpenFile(INDEXNAME)) != NULL);
+
+	Record rec, *recs = malloc(RECORDS_NUM * sizeof(Record));
+	for (int i = 0; i < RECORDS_NUM; i++) {
+		recs[i] = random_record();
+		recs[i].id = i;
+	}
+	TEST_ASSERT(HT_InsertBatch(handle, recs, RECORDS_NUM, NULL) == 0);
+	for (int i = 0; i < TO_DELETE; i++)
+		TEST_ASSERT(DELETED(handle, HT_DeleteEntry(handle, &i)));
+
+	/* Every stored key sits next to its fingerprint */
+	BF_Block *block;
+	BF_Block_Init(&block);
+	for (int i = 0; i < handle->buckets; ++i) {
+		int block_t = handle->hash_table[i];
+		while (block_t != -1) {
+			Hash_block block_handle;
+			TEST_ASSERT(BF_GetBlock(handle->file_desc, block_t, block) == BF_OK);
+			char *data = BF_Block_GetData(block);
+			memcpy(&block_handle, data, sizeof(Hash_block));
+			for (int j = 0; j < block_handle.rec_num; j++) {
+				memcpy(&rec, HT_RECORDS(handle, data) + j * sizeof(Record), sizeof(Record));
+				TEST_ASSERT(HT_FINGERPRINTS(data)[j] == key_fingerprint(INT, &rec.id));
+			}
+			block_t = block_handle.overf_block;
+			TEST_ASSERT(BF_UnpinBlock(block) == BF_OK);
+		}
+	}
+	for (int i = 0; i < shandle->buckets; ++i) {
+		int block_t = shandle->hash_table[i];
+		while (block_t != -1) {
+			SHash_block block_handle;
+			TEST_ASSERT(BF_GetBlock(shandle->file_desc, block_t, block) == BF_OK);
+			char *data = BF_Block_GetData(block);
+			memcpy(&block_handle, data, sizeof(SHash_block));
+			for (int j = 0; j < block_handle.rec_num; j++) {
+				SRecord srec;
+				memcpy(&srec, SHT_RECORDS(shandle, data) + j * sizeof(SRecord), sizeof(SRecord));
+				TEST_ASSERT(SHT_FINGERPRINTS(data)[j] == key_fingerprint(STRING, srec.key.skey));
+			}
+			block_t = block_handle.overf_block;
+			TEST_ASSERT(BF_UnpinBlock(block) == BF_OK);
+		}
+	}
+	BF_Block_Destroy(&block);
+
+	for (int i = 0; i < RECORDS_NUM; i++) {
+		TEST_ASSERT(HT_GetEntry(handle, &i, &rec) == 0);
+		TEST_ASSERT(i < TO_DELETE ? rec.id == -1 : !memcmp(&rec, &recs[i], sizeof(Record)));
+	}
+
+	char *name = recs[RECORDS_NUM - 1].name;
+	int expected = 0;
+	for (int i = TO_DELETE; i < RECORDS_NUM; i++)
+		expected += !strcmp(recs[i].name, name);
+
+	Aggregate agg = { 0 };
+	TEST_ASSERT(SHT_ForEach(shandle, name, aggregate, &agg) == 0);
+	TEST_ASSERT(agg.count == expected);
+
+	free(recs);
+	TEST_ASSERT(SHT_CloseFile(shandle) == 0);
+	TEST_ASSERT(HT_CloseFile(handle) == 0);
+	TEST_ASSERT(BF_Close() == BF_OK);
+	TEST_ASSERT(remove(FILENAME) == 0);
+	TEST_ASSERT(remove(INDEXNAME) == 0);
+	HT_Close();
+}
+
+
+void test_bloom() 
+{
+	HT_Init();
+
+	srand(time(NULL) * getpid());
+	TEST_ASSERT(BF_Init(LRU) == BF_OK);
+	TEST_ASSERT(HT_CreateFile(FILENAME, ID, BUCKETS) == 0);
+	TEST_ASSERT(HT_CreateFileEx(FILENAME2, ID, 2, EXTENDIBLE_HASH, ROW_LAYOUT, BF_BLOCK_SIZE) == 0);
+
+	Hash_file *handle, *ehandle;
+	TEST_ASSERT((handle = HT_OpenFile(FILENAME)) != NULL);
+	TEST_ASSERT((ehandle = HT_OpenFile(FILENAME2)) != NULL);
+	TEST_ASSERT(handle->bloom_block == -1);
+
+	/* Even ids are stored, odd ids are missing */
+	Record rec;
+	for (int i = 0; i < RECORDS_NUM; i++) {
+		rec = random_record();
+		rec.id = 2 * i;
+		TEST_ASSERT(INSERTED(handle, HT_InsertEntry(handle, rec, NULL)));
+		TEST_ASSERT(INSERTED(ehandle, HT_InsertEntry(ehandle, rec, NULL)));
+	}
+	TEST_ASSERT(HT_CloseFile(handle) == 0);
+	TEST_ASSERT(HT_CloseFile(ehandle) == 0);
+
+	TEST_ASSERT((handle = HT_OpenFile(FILENAME)) != NULL);
+	TEST_ASSERT((ehandle = HT_OpenFile(FILENAME2)) != NULL);
+	TEST_ASSERT(handle->bloom_block > 0 && ehandle->bloom_block > 0);
+
+	for (int round = 0; round < 2; round++) {
+		int passed = 0;
+		for (int i = 0; i < 2 * RECORDS_NUM; i++) {
+			TEST_ASSERT(HT_GetEntry(handle, &i, &rec) == 0);
+			TEST_ASSERT(rec.id == (i % 2 ? -1 : i));
+			TEST_ASSERT(HT_GetEntry(ehandle, &i, &rec) == 0);
+			TEST_ASSERT(rec.id == (i % 2 ? -1 : i));
+
+			int bucket = hash_key(INT, &i) % handle->buckets;
+			passed += i % 2 && bloom_test(handle->bloom + bucket * BLOOM_BUCKET_SIZE, 
+			                              BLOOM_BUCKET_SIZE, 
+			                              hash_key(INT, &i));
+		}
+		/* Few missing keys get past the filters */
+		TEST_ASSERT(passed < RECORDS_NUM / 10);
+		TEST_ASSERT(HT_Resize(handle, 2 * BUCKETS) == 0);
+	}
+
+	/* Keys new to a bucket's filter take the room deletes left anywhere in its chain */
+	int blocks, blocks_after, key = 1;
+	TEST_ASSERT(BF_GetBlockCounter(handle->file_desc, &blocks) == BF_OK);
+	for (int i = 0; i < RECORDS_NUM; i += 2) {
+		int bucket = hash_key(INT, &i) % handle->buckets;
+		TEST_ASSERT(DELETED(handle, HT_DeleteEntry(handle, &i)));
+		while (hash_key(INT, &key) % handle->buckets != bucket
+		    || bloom_test(handle->bloom + bucket * BLOOM_BUCKET_SIZE, BLOOM_BUCKET_SIZE, 
+		                                                             hash_key(INT, &key)))
+			key += 2;
+		rec = random_record();
+		rec.id = key;
+		key += 2;
+		TEST_ASSERT(INSERTED(handle, HT_InsertEntry(handle, rec, NULL)));
+	}
+	TEST_ASSERT(BF_GetBlockCounter(handle->file_desc, &blocks_after) == BF_OK);
+	TEST_ASSERT(blocks_after == blocks);
+
+	TEST_ASSERT(HT_CloseFile(handle) == 0);
+	TEST_ASSERT(HT_CloseFile(ehandle) == 0);
+	TEST_ASSERT(BF_Close() == BF_OK);
+	TEST_ASSERT(remove(FILENAME) == 0);
+	TEST_ASSERT(remove(FILENAME2) == 0);
+	HT_Close();
+}
+
+
+void test_block_size() 
+{
+	HT_Init();
+
+	srand(time(NULL) * getpid());
+	TEST_ASSERT(BF_Init(LRU) == BF_OK);
+	TEST_ASSERT(HT_CreateFileEx(FILENAME, ID, 2, EXTENDIBLE_HASH, ROW_LAYOUT, 3000) == -1);
+	TEST_ASSERT(HT_CreateFileEx(FILENAME, ID, 2, EXTENDIBLE_HASH, ROW_LAYOUT, 4096) == 0);
+
+	Hash_file *handle;
+	SHash_file *shandle;
+	TEST_ASSERT((handle = HT_OpenFile(FILENAME)) != NULL);
+	TEST_ASSERT(handle->block_size == 4096);
+	TEST_ASSERT(handle->rec_capacity == (4096 - sizeof(Hash_block)) / (sizeof(Record) + 1));
+
+	Record *recs = malloc(RECORDS_NUM * sizeof(Record));
+	for (int i = 0; i < RECORDS_NUM; i++) {
+		recs[i] = random_record();
+		recs[i].id = i;
+		TEST_ASSERT(INSERTED(handle, HT_InsertEntry(handle, recs[i], NULL)));
+	}
+
+	/* An index built from the file gets the same block size */
+	TEST_ASSERT(SHT_Build(INDEXNAME, CITY, FILENAME) == 0);
+	TEST_ASSERT(HT_CloseFile(handle) == 0);
+	TEST_ASSERT((handle = HT_OpenFile(FILENAME)) != NULL);
+	TEST_ASSERT((shandle = SHT_OpenFile(INDEXNAME)) != NULL);
+	TEST_ASSERT(handle->block_size == 4096 && shandle->block_size == 4096);
+
+	Record rec;
+	for (int i = 0; i < RECORDS_NUM; i++) {
+		TEST_ASSERT(HT_GetEntry(handle, &i, &rec) == 0);
+		TEST_ASSERT(compare_records(&rec, &recs[i], ID, hash_key(INT, &i) % BUCKETS));
+	}
+	for (int i = 0; i < 12; i++) {
+		char *city = recs[rand() % RECORDS_NUM].city;
+		int count = GET_NUM_ENTRIES(HT_GetAllEntries(handle, CITY, city, TMP_LIST));
+		TEST_ASSERT(count > 0);
+		TEST_ASSERT(GET_NUM_ENTRIES(SHT_GetEntries(shandle, city, TMP_LIST)) == count);
+	}
+
+	free(recs);
+	TEST_ASSERT(SHT_CloseFile(shandle) == 0);
+	TEST_ASSERT(HT_CloseFile(handle) == 0);
+	TEST_ASSERT(BF_Close() == BF_OK);
+	TEST_ASSERT(remove(FILENAME) == 0);
+	TEST_ASSERT(remove(INDEXNAME) == 0);
+	HT_Close();
+}
+
+
+void test_replacement() 
+{
+	HT_Init();
+
+	srand(time(NULL) * getpid());
+	const ReplacementAlgorithm policies[] = { LRU, MRU, TWO_Q, ARC, CLOCK_PRO };
+	Record *recs = malloc(RECORDS_NUM * sizeof(Record));
+	for (int i = 0; i < RECORDS_NUM; i++) {
+		recs[i] = random_record();
+		recs[i].id = i;
+	}
+
+	for (int p = 0; p < array_size(policies); p++) {
+		TEST_ASSERT(BF_InitEx(policies[p], 128, BF_MAX_OPEN_FILES) == BF_OK);
+		TEST_ASSERT(HT_CreateFile(FILENAME, ID, BUCKETS) == 0);
+
+		Hash_file *handle;
+		TEST_ASSERT((handle = HT_OpenFile(FILENAME)) != NULL);
+		TEST_ASSERT(HT_InsertBatch(handle, recs, RECORDS_NUM, NULL) == 0);
+		TEST_ASSERT(HT_CloseFile(handle) == 0);
+		TEST_ASSERT((handle = HT_OpenFile(FILENAME)) != NULL);
+
+		/* A few keys are looked up over and over, then the whole file is scanned */
+		Record rec;
+		BF_Stats stats;
+		for (int round = 0; round < 3; round++) {
+			for (int i = 0; i < 8; i++) {
+				int id = i * (RECORDS_NUM / 8);
+				TEST_ASSERT(HT_GetEntry(handle, &id, &rec) == 0);
+				TEST_ASSERT(!memcmp(&rec, &recs[id], sizeof(Record)));
+			}
+		}
+		char *city = recs[0].city;
+		TEST_ASSERT(GET_NUM_ENTRIES(HT_GetAllEntries(handle, CITY, city, TMP_LIST)) > 0);
+
+		BF_GetStats(&stats);
+		unsigned long reads = stats.reads;
+		for (int i = 0; i < 8; i++) {
+			int id = i * (RECORDS_NUM / 8);
+			TEST_ASSERT(HT_GetEntry(handle, &id, &rec) == 0);
+			TEST_ASSERT(!memcmp(&rec, &recs[id], sizeof(Record)));
+		}
+		BF_GetStats(&stats);
+		if (policies[p] == LRU)
+			TEST_ASSERT(stats.reads > reads);
+		else if (policies[p] != MRU)
+			TEST_ASSERT(stats.reads == reads);
+
+		TEST_ASSERT(HT_CloseFile(handle) == 0);
+		TEST_ASSERT(BF_Close() == BF_OK);
+		TEST_ASSERT(remove(FILENAME) == 0);
+	}
+
+	free(recs);
+	HT_Close();
+}
+
+
+void test_mapped() 
+{
+	HT_Init();
+
+	srand(time(NULL) * getpid());
+	TEST_ASSERT(BF_Init(LRU) == BF_OK);
+	TEST_ASSERT(HT_CreateFile(FILENAME, ID, BUCKETS) == 0);
+
+	Hash_file *handle;
+	TEST_ASSERT((handle = HT_OpenFile(FILENAME)) != NULL);
+
+	Record *recs = malloc(RECORDS_NUM * sizeof(Record));
+	for (int i = 0; i < RECORDS_NUM; i++) {
+		recs[i] = random_record();
+		recs[i].id = i;
+	}
+	TEST_ASSERT(HT_InsertBatch(handle, recs, RECORDS_NUM, NULL) == 0);
+	TEST_ASSERT(HT_CloseFile(handle) == 0);
+
+	/* Mapped files are read without going through the buffer pool */
+	BF_Stats stats;
+	TEST_ASSERT((handle = HT_OpenFileMapped(FILENAME)) != NULL);
+	BF_GetStats(&stats);
+	unsigned long reads = stats.reads;
+
+	Record rec;
+	for (int i = 0; i < RECORDS_NUM; i++) {
+		TEST_ASSERT(HT_GetEntry(handle, &i, &rec) == 0);
+		TEST_ASSERT(compare_records(&rec, &recs[i], ID, hash_key(INT, &i) % BUCKETS));
+	}
+	char *city = recs[0].city;
+	int count = GET_NUM_ENTRIES(HT_GetAllEntries(handle, CITY, city, TMP_LIST));
+	TEST_ASSERT(count > 0);
+	TEST_ASSERT(GET_NUM_ENTRIES(HT_GetAllEntries(handle, ID, NULL, TMP_LIST)) == RECORDS_NUM);
+
+	FILE *stream = fopen("/dev/null", "w");
+	TEST_ASSERT(HT_PrintFile(handle, stream) == 0);
+	fclose(stream);
+	BF_GetStats(&stats);
+	TEST_ASSERT(stats.reads == reads);
+
+	/* and cannot be changed */
+	int id = 0;
+	Record extra = random_record();
+	extra.id = RECORDS_NUM;
+	TEST_ASSERT(HT_InsertEntry(handle, extra, NULL) == -1);
+	TEST_ASSERT(HT_DeleteEntry(handle, &id) == -1);
+	TEST_ASSERT(HT_Resize(handle, 2 * BUCKETS) == -1);
+	TEST_ASSERT(HT_CloseFile(handle) == 0);
+
+	TEST_ASSERT((handle = HT_OpenFile(FILENAME)) != NULL);
+	TEST_ASSERT(handle->rec_count == RECORDS_NUM);
+	TEST_ASSERT(GET_NUM_ENTRIES(HT_GetAllEntries(handle, CITY, city, TMP_LIST)) == count);
+
+	free(recs);
+	TEST_ASSERT(HT_CloseFile(handle) == 0);
+	TEST_ASSERT(BF_Close() == BF_OK);
+	TEST_ASSERT(remove(FILENAME) == 0);
+	HT_Close();
+}
+
+
+#define THREADS 4
+
+typedef struct {
+	Hash_file *handle;
+	Record *recs;
+	int first;
+	int errors;
+} Worker;
+
+/* Workers insert their own share of the records and look up the shares 
+ * of the others, which are being inserted at the same time */
+static void *insert_records(void *arg) 
+{
+	Worker *worker = arg;
+	Record rec;
+	int share = RECORDS_NUM / THREADS;
+	for (int i = worker->first; i < worker->first + share; i++) {
+		if (HT_InsertEntry(worker->handle, worker->recs[i], NULL) < 0)
+			worker->errors++;
+		if (HT_GetEntry(worker->handle, &worker->recs[i].id, &rec) < 0
+		 || memcmp(&rec, &worker->recs[i], sizeof(Record)))
+			worker->errors++;
+
+		int other = (i + share) % RECORDS_NUM;
+		if (HT_GetEntry(worker->handle, &other, &rec) < 0 || (rec.id != -1 && rec.id != other))
+			worker->errors++;
+		if (i % 100 == 0 && GET_NUM_ENTRIES(HT_GetAllEntries(worker->handle, CITY, 
+		                                                     worker->recs[i].city, 
+		                                                     TMP_LIST)) < 1)
+			worker->errors++;
+	}
+
+	/* and then delete a tenth of their share */
+	for (int i = worker->first; i < worker->first + share; i += 10)
+		if (HT_DeleteEntry(worker->handle, &worker->recs[i].id) < 0)
+			worker->errors++;
+	return NULL;
+}
+
+void test_threads() 
+{
+	HT_Init();
+
+	srand(time(NULL) * getpid());
+	const hash_mode modes[] = { STATIC_HASH, EXTENDIBLE_HASH };
+	Record *recs = malloc(RECORDS_NUM * sizeof(Record));
+	for (int i = 0; i < RECORDS_NUM; i++) {
+		recs[i] = random_record();
+		recs[i].id = i;
+	}
+
+	/* A small pool makes threads miss and write out dirty blocks at the same time */
+	const int pools[] = { BF_BUFFER_SIZE, 16 };
+	for (int c = 0; c < array_size(modes) * array_size(pools); c++) {
+		hash_mode mode = modes[c % array_size(modes)];
+		TEST_ASSERT(BF_InitEx(LRU, pools[c / array_size(modes)], BF_MAX_OPEN_FILES) == BF_OK);
+		TEST_ASSERT(HT_CreateFileEx(FILENAME, ID, BUCKETS, mode, ROW_LAYOUT, BF_BLOCK_SIZE) == 0);
+
+		Hash_file *handle;
+		TEST_ASSERT((handle = HT_OpenFile(FILENAME)) != NULL);
+
+		pthread_t threads[THREADS];
+		Worker workers[THREADS];
+		for (int t = 0; t < THREADS; t++) {
+			workers[t] = (Worker) { .handle = handle, .recs = recs, .first = t * RECORDS_NUM / THREADS };
+			TEST_ASSERT(pthread_create(&threads[t], NULL, insert_records, &workers[t]) == 0);
+		}
+		for (int t = 0; t < THREADS; t++) {
+			TEST_ASSERT(pthread_join(threads[t], NULL) == 0);
+			TEST_ASSERT(workers[t].errors == 0);
+		}
+
+		int deleted = THREADS * ((RECORDS_NUM / THREADS - 1) / 10 + 1);
+		TEST_ASSERT(handle->rec_count == RECORDS_NUM - deleted);
+		TEST_ASSERT(GET_NUM_ENTRIES(HT_GetAllEntries(handle, ID, NULL, TMP_LIST)) == RECORDS_NUM - deleted);
+
+		Record rec;
+		for (int i = 0; i < RECORDS_NUM; i++) {
+			TEST_ASSERT(HT_GetEntry(handle, &recs[i].id, &rec) == 0);
+			TEST_ASSERT((i - i / (RECORDS_NUM / THREADS) * (RECORDS_NUM / THREADS)) % 10 == 0 
+			            ? rec.id == -1 
+			            : !memcmp(&rec, &recs[i], sizeof(Record)));
+		}
+
+		TEST_ASSERT(HT_CloseFile(handle) == 0);
+		TEST_ASSERT(remove(FILENAME) == 0);
+		TEST_ASSERT(BF_Close() == BF_OK);
+	}
+
+	free(recs);
+	HT_Close();
+}
+
+
 TEST_LIST = {
     { "test_create", test_create },
     { "test_insert", test_insert },
     { "test_delete", test_delete },
     { "test_find",   test_find   },
+    { "test_extendible", test_extendible },
+    { "test_resize", test_resize },
+    { "test_bulk_load", test_bulk_load },
+    { "test_insert_batch", test_insert_batch },
+    { "test_range_scan", test_range_scan },
+    { "test_scan", test_scan },
+    { "test_for_each", test_for_each },
+    { "test_cursor_writes", test_cursor_writes },
+    { "test_pax", test_pax },
+    { "test_fingerprint", test_fingerprint },
+    { "test_bloom", test_bloom },
+    { "test_block_size", test_block_size },
+    { "test_replacement", test_replacement },
+    { "test_mapped", test_mapped },
+    { "test_threads", test_threads },
 
     { NULL, NULL }
 };
@@ -118,6 +118,7 @@ void test_insert()
         memcpy(&rec_num, (data = BF_Block_GetData(block)), sizeof(int));
         TEST_ASSERT(++rec_counter == rec_num);
     }
+    TEST_ASSERT(BF_UnpinBlock(block) == BF_OK);
 
     Record dummy_rec = { .id = 125 };
     TEST_ASSERT(!INSERTED(handle, HP_InsertEntry(handle, dummy_rec)));
@@ -149,6 +150,11 @@ void test_insert()
         }
         TEST_ASSERT(BF_UnpinBlock(block) == BF_OK);
     }
+
+    /* Files with pinned blocks are not closed */
+    TEST_ASSERT(BF_GetBlock(handle->file_desc, 1, block) == BF_OK);
+    TEST_ASSERT(BF_CloseFile(handle->file_desc) == BF_AVAILABLE_PIN_BLOCKS_ERROR);
+    TEST_ASSERT(BF_UnpinBlock(block) == BF_OK);
     free(rec);
     BF_Block_Destroy(&block);
 
@@ -314,11 +320,759 @@ void test_find()
 }
 
 
+void test_bulk_load() 
+{
+    srand(time(NULL) * getpid());
+
+    int rec_num;
+    BF_Block *block;
+    Heap_file *handle;
+
+    TEST_ASSERT(BF_Init(LRU) == BF_OK);
+    TEST_ASSERT(HP_CreateFile(FILENAME, ID) == 0);
+    TEST_ASSERT((handle = HP_OpenFile(FILENAME)) != NULL);
+
+    for (int i = 0; i < TO_DELETE; ++i) {
+        Record rec = random_record();
+        rec.id = i;
+        TEST_ASSERT(INSERTED(handle, HP_InsertEntry(handle, rec)));
+    }
+
+    Record *rec = malloc(RECORDS_NUM * sizeof(*rec));
+    for (int i = 0; i < RECORDS_NUM; ++i) {
+        rec[i] = random_record();
+        rec[i].id = i % (RECORDS_NUM / 2);
+    }
+
+    TEST_ASSERT(HP_BulkLoad(handle, rec, RECORDS_NUM) == 0);
+    TEST_ASSERT(handle->rec_count == RECORDS_NUM / 2);
+    TEST_ASSERT(HP_CloseFile(handle) == 0);
+    TEST_ASSERT((handle = HP_OpenFile(FILENAME)) != NULL);
+
+    BF_Block_Init(&block);
+    int counter = 0;
+    for (int i = 1; i <= handle->last_block_id; ++i) {
+        TEST_ASSERT(BF_GetBlock(handle->file_desc, i, block) == BF_OK);
+        memcpy(&rec_num, BF_Block_GetData(block), sizeof(int));
+        TEST_ASSERT(i != handle->last_block_id
+            ? rec_num == handle->rec_capacity
+            : rec_num <= handle->rec_capacity
+        );
+        counter += rec_num;
+        TEST_ASSERT(BF_UnpinBlock(block) == BF_OK);
+    }
+    BF_Block_Destroy(&block);
+    TEST_ASSERT(counter == RECORDS_NUM / 2);
+
+    Record find;
+    for (int i = TO_DELETE; i < RECORDS_NUM / 2; ++i) {
+        TEST_ASSERT(HP_GetEntry(handle, &i, &find) == 0);
+        TEST_ASSERT(compare_records(&find, &rec[i]));
+    }
+    free(rec);
+
+    TEST_ASSERT(HP_CloseFile(handle) == 0);
+    TEST_ASSERT(remove(FILENAME) == 0);
+    TEST_ASSERT(BF_Close() == BF_OK);
+}
+
+
+void test_free_map() 
+{
+    srand(time(NULL) * getpid());
+
+    int rec_num, records, cap;
+    BF_Block *block;
+    Heap_file *handle;
+
+    TEST_ASSERT(BF_Init(LRU) == BF_OK);
+    TEST_ASSERT(HP_CreateFile(FILENAME, ID) == 0);
+    TEST_ASSERT((handle = HP_OpenFile(FILENAME)) != NULL);
+
+    records = 25 * (cap = handle->rec_capacity);
+    for (int i = 0; i < records; ++i) {
+        Record rec = random_record();
+        rec.id = i;
+        TEST_ASSERT(INSERTED(handle, HP_InsertEntry(handle, rec)));
+    }
+    TEST_ASSERT(handle->last_block_id == 25);
+
+    for (int i = 2 * cap; i < 3 * cap; ++i)
+        TEST_ASSERT(DELETED(handle, HP_DeleteEntry(handle, &i)));
+    int id = 10 * cap;
+    TEST_ASSERT(DELETED(handle, HP_DeleteEntry(handle, &id)));
+
+    TEST_ASSERT(HP_CloseFile(handle) == 0);
+    TEST_ASSERT((handle = HP_OpenFile(FILENAME)) != NULL);
+
+    for (int i = 0; i <= cap; ++i) {
+        Record rec = random_record();
+        rec.id = records + i;
+        TEST_ASSERT(INSERTED(handle, HP_InsertEntry(handle, rec)));
+    }
+    TEST_ASSERT(handle->last_block_id == 25);
+
+    BF_Block_Init(&block);
+    for (int i = 1; i <= handle->last_block_id; ++i) {
+        TEST_ASSERT(BF_GetBlock(handle->file_desc, i, block) == BF_OK);
+        memcpy(&rec_num, BF_Block_GetData(block), sizeof(int));
+        TEST_ASSERT(rec_num == handle->rec_capacity);
+        TEST_ASSERT(BF_UnpinBlock(block) == BF_OK);
+    }
+    BF_Block_Destroy(&block);
+
+    Record rec = random_record();
+    rec.id = 2 * records;
+    TEST_ASSERT(INSERTED(handle, HP_InsertEntry(handle, rec)));
+    TEST_ASSERT(handle->last_block_id == 26);
+
+    TEST_ASSERT(HP_CloseFile(handle) == 0);
+    TEST_ASSERT((handle = HP_OpenFile(FILENAME)) != NULL);
+
+    Record find;
+    TEST_ASSERT(handle->rec_count == records + 1);
+    TEST_ASSERT(HP_GetEntry(handle, &rec.id, &find) == 0);
+    TEST_ASSERT(compare_records(&find, &rec));
+
+    TEST_ASSERT(HP_CloseFile(handle) == 0);
+    TEST_ASSERT(remove(FILENAME) == 0);
+    TEST_ASSERT(BF_Close() == BF_OK);
+}
+
+
+void test_key_index() 
+{
+    srand(time(NULL) * getpid());
+
+    Heap_file *handle;
+    Record find, *rec = malloc(RECORDS_NUM * sizeof(*rec));
+
+    TEST_ASSERT(BF_Init(LRU) == BF_OK);
+    TEST_ASSERT(HP_CreateFile(FILENAME, ID) == 0);
+    TEST_ASSERT((handle = HP_OpenFileEx(FILENAME, true)) != NULL);
+
+    for (int i = 0; i < RECORDS_NUM / 2; ++i) {
+        rec[i] = random_record();
+        rec[i].id = i;
+        TEST_ASSERT(INSERTED(handle, HP_InsertEntry(handle, rec[i])));
+    }
+    TEST_ASSERT(!INSERTED(handle, HP_InsertEntry(handle, rec[0])));
+
+    int *to_delete = random_numbers(TO_DELETE, 0, RECORDS_NUM / 2 - 1);
+    for (int i = 0; i < TO_DELETE; ++i) {
+        TEST_ASSERT(DELETED(handle, HP_DeleteEntry(handle, &to_delete[i])));
+        TEST_ASSERT(!DELETED(handle, HP_DeleteEntry(handle, &to_delete[i])));
+        rec[to_delete[i]].id = -1;
+    }
+
+    for (int i = 0; i < RECORDS_NUM / 2; ++i) {
+        int id = i;
+        TEST_ASSERT(HP_GetEntry(handle, &id, &find) == 0);
+        TEST_ASSERT(rec[i].id < 0 ? find.id == -1 : compare_records(&find, &rec[i]));
+    }
+    TEST_ASSERT(HP_CloseFile(handle) == 0);
+
+    for (int i = RECORDS_NUM / 2; i < RECORDS_NUM; ++i) {
+        rec[i] = random_record();
+        rec[i].id = i;
+    }
+    TEST_ASSERT((handle = HP_OpenFileEx(FILENAME, true)) != NULL);
+    TEST_ASSERT(HP_BulkLoad(handle, rec + RECORDS_NUM / 2, RECORDS_NUM / 2) == 0);
+    TEST_ASSERT(handle->rec_count == RECORDS_NUM - TO_DELETE);
+    TEST_ASSERT(HP_CloseFile(handle) == 0);
+
+    TEST_ASSERT((handle = HP_OpenFile(FILENAME)) != NULL);
+    for (int i = 0; i < RECORDS_NUM; i += RECORDS_NUM / 100) {
+        TEST_ASSERT(HP_GetEntry(handle, &i, &find) == 0);
+        TEST_ASSERT(rec[i].id < 0 ? find.id == -1 : compare_records(&find, &rec[i]));
+    }
+
+    free(rec);
+    free(to_delete);
+    TEST_ASSERT(HP_CloseFile(handle) == 0);
+    TEST_ASSERT(remove(FILENAME) == 0);
+    TEST_ASSERT(BF_Close() == BF_OK);
+}
+
+
+void test_scan() 
+{
+    srand(time(NULL) * getpid());
+
+    Heap_file *handle;
+    Record *rec, *recs = malloc(RECORDS_NUM * sizeof(*recs));
+
+    TEST_ASSERT(BF_Init(LRU) == BF_OK);
+    TEST_ASSERT(HP_CreateFile(FILENAME, ID) == 0);
+    TEST_ASSERT((handle = HP_OpenFile(FILENAME)) != NULL);
+
+    for (int i = 0; i < RECORDS_NUM; ++i) {
+        recs[i] = random_record();
+        recs[i].id = i;
+    }
+    TEST_ASSERT(HP_BulkLoad(handle, recs, RECORDS_NUM) == 0);
+
+    HP_Scan *scan;
+    int count = 0, id = RECORDS_NUM / 2;
+    TEST_ASSERT((scan = HP_Scan_Open(handle, ID, NULL)) != NULL);
+    while (HP_Scan_Next(scan, &rec) > 0)
+        TEST_ASSERT(compare_records(rec, &recs[count++]));
+    TEST_ASSERT(HP_Scan_Close(scan) == 0);
+    TEST_ASSERT(count == RECORDS_NUM);
+
+    TEST_ASSERT((scan = HP_Scan_Open(handle, ID, &id)) != NULL);
+    TEST_ASSERT(HP_Scan_Next(scan, &rec) == 1);
+    TEST_ASSERT(compare_records(rec, &recs[id]));
+    TEST_ASSERT(HP_Scan_Next(scan, &rec) == 0);
+    TEST_ASSERT(HP_Scan_Close(scan) == 0);
+
+    count = 0;
+    char *name = recs[id].name;
+    TEST_ASSERT((scan = HP_Scan_Open(handle, NAME, name)) != NULL);
+    while (HP_Scan_Next(scan, &rec) > 0)
+        TEST_ASSERT(!strcmp(rec->name, name) && ++count);
+    TEST_ASSERT(HP_Scan_Close(scan) == 0);
+    TEST_ASSERT(count == GET_NUM_ENTRIES(HP_GetAllEntries(handle, NAME, name, TMP_LIST)));
+
+    /* Values longer than the attribute match nothing */
+    char long_name[100];
+    memset(long_name, 'a', sizeof(long_name) - 1);
+    long_name[sizeof(long_name) - 1] = '\0';
+    memcpy(long_name, name, strlen(name));
+    TEST_ASSERT((scan = HP_Scan_Open(handle, NAME, long_name)) != NULL);
+    TEST_ASSERT(HP_Scan_Next(scan, &rec) == 0);
+    TEST_ASSERT(HP_Scan_Close(scan) == 0);
+
+    free(recs);
+    TEST_ASSERT(HP_CloseFile(handle) == 0);
+    TEST_ASSERT(remove(FILENAME) == 0);
+    TEST_ASSERT(BF_Close() == BF_OK);
+}
+
+
+typedef struct {
+    int count;
+    int min;
+    int max;
+    int limit;
+} Aggregate;
+
+static int aggregate(Record *rec, void *arg) 
+{
+    Aggregate *agg = arg;
+    if (agg->count++ == 0 || rec->id < agg->min)
+        agg->min = rec->id;
+    if (agg->count == 1 || rec->id > agg->max)
+        agg->max = rec->id;
+    return agg->count == agg->limit;
+}
+
+void test_for_each() 
+{
+    srand(time(NULL) * getpid());
+    TEST_ASSERT(BF_Init(LRU) == BF_OK);
+    TEST_ASSERT(HP_CreateFile(FILENAME, ID) == 0);
+
+    Heap_file *handle;
+    TEST_ASSERT((handle = HP_OpenFile(FILENAME)) != NULL);
+
+    Record *recs = malloc(RECORDS_NUM * sizeof(*recs));
+    for (int i = 0; i < RECORDS_NUM; ++i) {
+        recs[i] = random_record();
+        recs[i].id = i;
+    }
+    TEST_ASSERT(HP_BulkLoad(handle, recs, RECORDS_NUM) == 0);
+
+    Aggregate agg = { 0 };
+    TEST_ASSERT(HP_ForEach(handle, ID, NULL, aggregate, &agg) == 0);
+    TEST_ASSERT(agg.count == RECORDS_NUM);
+    TEST_ASSERT(agg.min == 0 && agg.max == RECORDS_NUM - 1);
+
+    int id = RECORDS_NUM / 2;
+    agg = (Aggregate) { 0 };
+    TEST_ASSERT(HP_ForEach(handle, ID, &id, aggregate, &agg) == 0);
+    TEST_ASSERT(agg.count == 1 && agg.min == id && agg.max == id);
+
+    agg = (Aggregate) { .limit = TO_DELETE };
+    TEST_ASSERT(HP_ForEach(handle, ID, NULL, aggregate, &agg) == 1);
+    TEST_ASSERT(agg.count == TO_DELETE);
+
+    char *city = recs[id].city;
+    int expected = 0, min = RECORDS_NUM, max = -1;
+    for (int i = 0; i < RECORDS_NUM; ++i) {
+        if (strcmp(recs[i].city, city))
+            continue;
+        expected++;
+        min = i < min ? i : min;
+        max = i > max ? i : max;
+    }
+
+    agg = (Aggregate) { 0 };
+    TEST_ASSERT(HP_ForEach(handle, CITY, city, aggregate, &agg) == 0);
+    TEST_ASSERT(agg.count == expected && agg.min == min && agg.max == max);
+
+    free(recs);
+    TEST_ASSERT(HP_CloseFile(handle) == 0);
+    TEST_ASSERT(remove(FILENAME) == 0);
+    TEST_ASSERT(BF_Close() == BF_OK);
+}
+
+
+void test_match() 
+{
+    srand(time(NULL) * getpid());
+
+    const int counts[] = { 1, 2, 7, 8, 9, 63, 64, 65, 130 };
+    const match_level levels[] = { MATCH_SCALAR, MATCH_SSE42, MATCH_AVX2 };
+
+    for (int c = 0; c < array_size(counts); ++c) {
+        int count = counts[c];
+        Record *recs = malloc(count * sizeof(*recs));
+        for (int i = 0; i < count; ++i) {
+            recs[i] = random_record();
+            recs[i].id = rand() % 4;
+        }
+
+        for (int a = 0; a < array_size(attr); ++a) {
+            void *value = get_rec_member(&recs[rand() % count], attr[a]);
+            int size = get_attr_type(attr[a]) == STRING
+                ? strlen(value) + 1
+                : get_attr_size(attr[a]);
+
+            uint64_t expected[MATCH_WORDS(count)];
+            memset(expected, 0, sizeof(expected));
+            for (int i = 0; i < count; ++i) {
+                if (!memcmp(get_rec_member(&recs[i], attr[a]), value, size))
+                    expected[i / 64] |= (uint64_t)1 << i % 64;
+            }
+
+            /* Every kernel the CPU supports gives the same mask */
+            for (int l = 0; l < array_size(levels); ++l) {
+                uint64_t mask[MATCH_WORDS(count)];
+                match_select(levels[l]);
+                match_records((char*)recs, count, sizeof(Record), get_attr_offset(attr[a]), 
+                                                                  value, 
+                                                                  size, 
+                                                                  mask);
+                TEST_ASSERT(!memcmp(mask, expected, sizeof(mask)));
+
+                int matches = 0;
+                for (int i = match_next(mask, 0, count); i < count; i = match_next(mask, i + 1, count))
+                    TEST_ASSERT(!memcmp(get_rec_member(&recs[i], attr[a]), value, size) && ++matches);
+                TEST_ASSERT(matches > 0);
+            }
+        }
+
+        /* Keys stored next to each other, as in PAX blocks */
+        int *ids = malloc(count * sizeof(int)), id = recs[0].id;
+        uint64_t expected[MATCH_WORDS(count)];
+        memset(expected, 0, sizeof(expected));
+        for (int i = 0; i < count; ++i)
+            if ((ids[i] = recs[i].id) == id)
+                expected[i / 64] |= (uint64_t)1 << i % 64;
+
+        for (int l = 0; l < array_size(levels); ++l) {
+            uint64_t mask[MATCH_WORDS(count)];
+            match_select(levels[l]);
+            match_records((char*)ids, count, sizeof(int), 0, &id, sizeof(int), mask);
+            TEST_ASSERT(!memcmp(mask, expected, sizeof(mask)));
+        }
+        free(ids);
+
+        /* Byte arrays, as the fingerprints of hash blocks */
+        unsigned char *bytes = malloc(count), byte = rand() % 4;
+        memset(expected, 0, sizeof(expected));
+        for (int i = 0; i < count; ++i)
+            if ((bytes[i] = rand() % 4) == byte)
+                expected[i / 64] |= (uint64_t)1 << i % 64;
+
+        for (int l = 0; l < array_size(levels); ++l) {
+            uint64_t mask[MATCH_WORDS(count)];
+            match_select(levels[l]);
+            match_bytes(bytes, count, byte, mask);
+            TEST_ASSERT(!memcmp(mask, expected, sizeof(mask)));
+        }
+        free(bytes);
+        free(recs);
+    }
+
+    /* Values longer than MATCH_MAX_SIZE */
+    char rows[8][MATCH_MAX_SIZE + 16];
+    for (int i = 0; i < array_size(rows); ++i)
+        memset(rows[i], 'a' + i % 2, sizeof(rows[i]));
+    for (int l = 0; l < array_size(levels); ++l) {
+        uint64_t mask[1];
+        match_select(levels[l]);
+        match_records((char*)rows, array_size(rows), sizeof(rows[0]), 0, rows[1], sizeof(rows[0]), mask);
+        TEST_ASSERT(mask[0] == 0xAA);
+    }
+    match_select(MATCH_AUTO);
+}
+
+
+void test_pax() 
+{
+    srand(time(NULL) * getpid());
+
+    Heap_file *handle;
+    Record rec, *recs = malloc(RECORDS_NUM * sizeof(*recs));
+
+    TEST_ASSERT(BF_Init(LRU) == BF_OK);
+    TEST_ASSERT(HP_CreateFileEx(FILENAME, ID, PAX_LAYOUT, BF_BLOCK_SIZE) == 0);
+    TEST_ASSERT((handle = HP_OpenFile(FILENAME)) != NULL);
+    TEST_ASSERT(handle->layout == PAX_LAYOUT);
+
+    for (int i = 0; i < RECORDS_NUM; ++i) {
+        recs[i] = random_record();
+        recs[i].id = i;
+    }
+    for (int i = 0; i < RECORDS_NUM / 2; ++i)
+        TEST_ASSERT(INSERTED(handle, HP_InsertEntry(handle, recs[i])));
+    TEST_ASSERT(HP_BulkLoad(handle, recs, RECORDS_NUM) == 0);
+    TEST_ASSERT(handle->rec_count == RECORDS_NUM);
+
+    for (int i = 0; i < TO_DELETE; ++i)
+        TEST_ASSERT(DELETED(handle, HP_DeleteEntry(handle, &i)));
+
+    TEST_ASSERT(HP_CloseFile(handle) == 0);
+    TEST_ASSERT((handle = HP_OpenFileEx(FILENAME, true)) != NULL);
+    TEST_ASSERT(handle->layout == PAX_LAYOUT);
+
+    for (int i = 0; i < RECORDS_NUM; ++i) {
+        TEST_ASSERT(HP_GetEntry(handle, &i, &rec) == 0);
+        TEST_ASSERT(i < TO_DELETE ? rec.id == -1 : compare_records(&rec, &recs[i]));
+    }
+
+    char *city = recs[RECORDS_NUM / 2].city;
+    int expected = 0;
+    for (int i = TO_DELETE; i < RECORDS_NUM; ++i)
+        expected += !strcmp(recs[i].city, city);
+
+    Dl_list list = list_create(free);
+    TEST_ASSERT(HP_GetAllEntries(handle, CITY, city, list) == 0);
+    TEST_ASSERT(list_size(list) == expected);
+    for (Dl_list_node node = list_first(list); node != NULL; node = list_next(node)) {
+        Record *found = list_value(node);
+        TEST_ASSERT(compare_records(found, &recs[found->id]));
+    }
+    list_destroy(list);
+
+    free(recs);
+    TEST_ASSERT(HP_CloseFile(handle) == 0);
+    TEST_ASSERT(remove(FILENAME) == 0);
+    TEST_ASSERT(BF_Close() == BF_OK);
+}
+
+
+void test_bloom() 
+{
+    srand(time(NULL) * getpid());
+
+    Heap_file *handle;
+    Record rec, *recs = malloc(RECORDS_NUM * sizeof(*recs));
+
+    TEST_ASSERT(BF_Init(LRU) == BF_OK);
+    TEST_ASSERT(HP_CreateFile(FILENAME, ID) == 0);
+    TEST_ASSERT((handle = HP_OpenFile(FILENAME)) != NULL);
+
+    /* Even ids are stored, odd ids are missing. The filter grows with the file */
+    int size = handle->bloom_size;
+    for (int i = 0; i < RECORDS_NUM / 2; ++i) {
+        rec = random_record();
+        rec.id = 2 * i;
+        TEST_ASSERT(INSERTED(handle, HP_InsertEntry(handle, rec)));
+    }
+    TEST_ASSERT(handle->bloom_size > size);
+
+    for (int i = 0; i < RECORDS_NUM / 2; ++i) {
+        recs[i] = random_record();
+        recs[i].id = RECORDS_NUM + 2 * i;
+    }
+    TEST_ASSERT(HP_BulkLoad(handle, recs, RECORDS_NUM / 2) == 0);
+    TEST_ASSERT(handle->rec_count == RECORDS_NUM);
+
+    size = handle->bloom_size;
+    TEST_ASSERT(HP_CloseFile(handle) == 0);
+    TEST_ASSERT((handle = HP_OpenFile(FILENAME)) != NULL);
+    TEST_ASSERT(handle->bloom_size == size);
+
+    int passed = 0;
+    for (int i = 0; i < 2 * RECORDS_NUM; ++i) {
+        TEST_ASSERT(HP_GetEntry(handle, &i, &rec) == 0);
+        TEST_ASSERT(rec.id == (i % 2 ? -1 : i));
+        passed += i % 2 && bloom_test(handle->bloom, handle->bloom_size, hash_key(INT, &i));
+    }
+    /* Few missing keys get past the filter */
+    TEST_ASSERT(passed < RECORDS_NUM / 10);
+
+    /* Deleted keys stay in the filter, so churn rebuilds it before it fills up */
+    for (int round = 0, id = 4 * RECORDS_NUM; round < 8; ++round) {
+        for (int i = 0; i < RECORDS_NUM / 2; ++i, id += 2) {
+            TEST_ASSERT(DELETED(handle, HP_DeleteEntry(handle, &recs[i].id)));
+            recs[i] = random_record();
+            recs[i].id = id;
+            TEST_ASSERT(INSERTED(handle, HP_InsertEntry(handle, recs[i])));
+        }
+    }
+    TEST_ASSERT(handle->rec_count == RECORDS_NUM);
+
+    passed = 0;
+    for (int i = 1; i < 2 * RECORDS_NUM; i += 2)
+        passed += bloom_test(handle->bloom, handle->bloom_size, hash_key(INT, &i));
+    TEST_ASSERT(passed < RECORDS_NUM / 10);
+
+    free(recs);
+    TEST_ASSERT(HP_CloseFile(handle) == 0);
+    TEST_ASSERT(remove(FILENAME) == 0);
+    TEST_ASSERT(BF_Close() == BF_OK);
+}
+
+
+void test_block_size() 
+{
+    srand(time(NULL) * getpid());
+
+    Heap_file *handle;
+    Record rec, *recs = malloc(RECORDS_NUM * sizeof(*recs));
+
+    TEST_ASSERT(BF_Init(LRU) == BF_OK);
+    TEST_ASSERT(HP_CreateFileEx(FILENAME, ID, ROW_LAYOUT, 1000) == -1);
+    TEST_ASSERT(HP_CreateFileEx(FILENAME, ID, ROW_LAYOUT, 2 * BF_MAX_BLOCK_SIZE) == -1);
+    TEST_ASSERT(HP_CreateFileEx(FILENAME, ID, PAX_LAYOUT, 16384) == 0);
+    TEST_ASSERT((handle = HP_OpenFile(FILENAME)) != NULL);
+    TEST_ASSERT(handle->block_size == 16384);
+    TEST_ASSERT(handle->rec_capacity == (16384 - sizeof(int)) / sizeof(Record));
+
+    for (int i = 0; i < RECORDS_NUM; ++i) {
+        recs[i] = random_record();
+        recs[i].id = i;
+    }
+    for (int i = 0; i < RECORDS_NUM / 2; ++i)
+        TEST_ASSERT(INSERTED(handle, HP_InsertEntry(handle, recs[i])));
+    TEST_ASSERT(HP_BulkLoad(handle, recs, RECORDS_NUM) == 0);
+    TEST_ASSERT(handle->last_block_id == (RECORDS_NUM - 1) / handle->rec_capacity + 1);
+
+    for (int i = 0; i < TO_DELETE; ++i)
+        TEST_ASSERT(DELETED(handle, HP_DeleteEntry(handle, &i)));
+
+    /* The block size is read back from the file */
+    TEST_ASSERT(HP_CloseFile(handle) == 0);
+    TEST_ASSERT((handle = HP_OpenFile(FILENAME)) != NULL);
+    TEST_ASSERT(handle->block_size == 16384);
+
+    for (int i = 0; i < RECORDS_NUM; ++i) {
+        TEST_ASSERT(HP_GetEntry(handle, &i, &rec) == 0);
+        TEST_ASSERT(i < TO_DELETE ? rec.id == -1 : compare_records(&rec, &recs[i]));
+    }
+
+    free(recs);
+    TEST_ASSERT(HP_CloseFile(handle) == 0);
+    TEST_ASSERT(remove(FILENAME) == 0);
+    TEST_ASSERT(BF_Close() == BF_OK);
+}
+
+
+void test_buffer_pool() 
+{
+    srand(time(NULL) * getpid());
+
+    Heap_file *handle;
+    Record *recs = malloc(RECORDS_NUM * sizeof(*recs));
+    BF_Stats stats;
+
+    TEST_ASSERT(BF_InitEx(LRU, 0, 1) != BF_OK);
+    TEST_ASSERT(BF_InitEx(LRU, 4 * RECORDS_NUM, 1) == BF_OK);
+    TEST_ASSERT(BF_Init(LRU) == BF_ACTIVE_ERROR);
+    TEST_ASSERT(HP_CreateFile(FILENAME, ID) == 0);
+    TEST_ASSERT(HP_CreateFile(FILENAME2, ID) == 0);
+    TEST_ASSERT((handle = HP_OpenFile(FILENAME)) != NULL);
+
+    /* Only one file can be open at a time */
+    TEST_ASSERT(HP_OpenFile(FILENAME2) == NULL);
+
+    for (int i = 0; i < RECORDS_NUM; ++i) {
+        recs[i] = random_record();
+        recs[i].id = i;
+    }
+    TEST_ASSERT(HP_BulkLoad(handle, recs, RECORDS_NUM) == 0);
+    TEST_ASSERT(HP_CloseFile(handle) == 0);
+    TEST_ASSERT((handle = HP_OpenFile(FILENAME)) != NULL);
+
+    /* The whole file fits in the pool, so only the first scan reads from disk */
+    char *city = recs[RECORDS_NUM / 2].city;
+    BF_GetStats(&stats);
+    unsigned long reads = stats.reads;
+    int count = GET_NUM_ENTRIES(HP_GetAllEntries(handle, CITY, city, TMP_LIST));
+    TEST_ASSERT(count > 0);
+
+    BF_GetStats(&stats);
+    TEST_ASSERT(stats.reads - reads >= handle->last_block_id);
+    reads = stats.reads;
+    TEST_ASSERT(GET_NUM_ENTRIES(HP_GetAllEntries(handle, CITY, city, TMP_LIST)) == count);
+    BF_GetStats(&stats);
+    TEST_ASSERT(stats.reads == reads);
+
+    free(recs);
+    TEST_ASSERT(HP_CloseFile(handle) == 0);
+    TEST_ASSERT(remove(FILENAME) == 0);
+    TEST_ASSERT(remove(FILENAME2) == 0);
+    TEST_ASSERT(BF_Close() == BF_OK);
+}
+
+
+void test_mapped() 
+{
+    srand(time(NULL) * getpid());
+
+    Heap_file *handle;
+    Record *rec, *recs = malloc(RECORDS_NUM * sizeof(*recs));
+    BF_Stats stats;
+
+    TEST_ASSERT(BF_Init(LRU) == BF_OK);
+    TEST_ASSERT(HP_CreateFile(FILENAME, ID) == 0);
+    TEST_ASSERT((handle = HP_OpenFile(FILENAME)) != NULL);
+
+    for (int i = 0; i < RECORDS_NUM; ++i) {
+        recs[i] = random_record();
+        recs[i].id = i;
+    }
+    TEST_ASSERT(HP_BulkLoad(handle, recs, RECORDS_NUM) == 0);
+    TEST_ASSERT(HP_CloseFile(handle) == 0);
+
+    /* Mapped files are read without going through the buffer pool */
+    TEST_ASSERT((handle = HP_OpenFileMapped(FILENAME)) != NULL);
+    TEST_ASSERT(handle->rec_count == RECORDS_NUM);
+    BF_GetStats(&stats);
+    unsigned long reads = stats.reads;
+
+    HP_Scan *scan;
+    int count = 0;
+    TEST_ASSERT((scan = HP_Scan_Open(handle, ID, NULL)) != NULL);
+    while (HP_Scan_Next(scan, &rec) > 0)
+        TEST_ASSERT(compare_records(rec, &recs[count++]));
+    TEST_ASSERT(HP_Scan_Close(scan) == 0);
+    TEST_ASSERT(count == RECORDS_NUM);
+
+    Record found;
+    char *city = recs[RECORDS_NUM / 2].city;
+    TEST_ASSERT(HP_GetEntry(handle, &recs[RECORDS_NUM / 2].id, &found) == 0);
+    TEST_ASSERT(compare_records(&found, &recs[RECORDS_NUM / 2]));
+    TEST_ASSERT((count = GET_NUM_ENTRIES(HP_GetAllEntries(handle, CITY, city, TMP_LIST))) > 0);
+    BF_GetStats(&stats);
+    TEST_ASSERT(stats.reads == reads);
+
+    /* and cannot be changed */
+    Record extra = random_record();
+    extra.id = RECORDS_NUM;
+    TEST_ASSERT(HP_InsertEntry(handle, extra) == -1);
+    TEST_ASSERT(HP_DeleteEntry(handle, &recs[0].id) == -1);
+    TEST_ASSERT(HP_CloseFile(handle) == 0);
+
+    TEST_ASSERT((handle = HP_OpenFile(FILENAME)) != NULL);
+    TEST_ASSERT(handle->rec_count == RECORDS_NUM);
+    TEST_ASSERT(GET_NUM_ENTRIES(HP_GetAllEntries(handle, CITY, city, TMP_LIST)) == count);
+
+    free(recs);
+    TEST_ASSERT(HP_CloseFile(handle) == 0);
+    TEST_ASSERT(remove(FILENAME) == 0);
+    TEST_ASSERT(BF_Close() == BF_OK);
+}
+
+
+void test_prefetch() 
+{
+    srand(time(NULL) * getpid());
+
+    Heap_file *handle;
+    Record *rec, *recs = malloc(RECORDS_NUM * sizeof(*recs));
+    BF_Stats before, after;
+
+    TEST_ASSERT(BF_InitEx(LRU, 16, BF_MAX_OPEN_FILES) == BF_OK);
+    TEST_ASSERT(HP_CreateFile(FILENAME, ID) == 0);
+    TEST_ASSERT((handle = HP_OpenFile(FILENAME)) != NULL);
+
+    for (int i = 0; i < RECORDS_NUM; ++i) {
+        recs[i] = random_record();
+        recs[i].id = i;
+    }
+    TEST_ASSERT(HP_BulkLoad(handle, recs, RECORDS_NUM) == 0);
+    TEST_ASSERT(HP_CloseFile(handle) == 0);
+    TEST_ASSERT((handle = HP_OpenFile(FILENAME)) != NULL);
+
+    /* Prefetched blocks are found in the pool when they are asked for */
+    int blocks[] = { 1, 2, 3 }, blocks_num;
+    BF_Block *block;
+    BF_Block_Init(&block);
+    TEST_ASSERT(BF_GetBlockCounter(handle->file_desc, &blocks_num) == BF_OK);
+    TEST_ASSERT(BF_Prefetch(handle->file_desc, &blocks_num, 1) == BF_INVALID_BLOCK_NUMBER_ERROR);
+    BF_GetStats(&before);
+    TEST_ASSERT(BF_Prefetch(handle->file_desc, blocks, array_size(blocks)) == BF_OK);
+    for (int i = 0; i < array_size(blocks); ++i) {
+        TEST_ASSERT(BF_GetBlock(handle->file_desc, blocks[i], block) == BF_OK);
+        TEST_ASSERT(BF_UnpinBlock(block) == BF_OK);
+    }
+    BF_GetStats(&after);
+    TEST_ASSERT(after.prefetches - before.prefetches == array_size(blocks));
+    TEST_ASSERT(after.reads - before.reads == array_size(blocks));
+    TEST_ASSERT(after.hits - before.hits == array_size(blocks));
+    BF_Block_Destroy(&block);
+
+    /* Full scans read ahead of the cursor, even through a pool smaller than the file */
+    HP_Scan *scan;
+    int count = 0;
+    BF_GetStats(&before);
+    TEST_ASSERT((scan = HP_Scan_Open(handle, ID, NULL)) != NULL);
+    while (HP_Scan_Next(scan, &rec) > 0)
+        TEST_ASSERT(compare_records(rec, &recs[count++]));
+    TEST_ASSERT(HP_Scan_Close(scan) == 0);
+    TEST_ASSERT(count == RECORDS_NUM);
+    BF_GetStats(&after);
+    TEST_ASSERT(after.prefetches > before.prefetches);
+    TEST_ASSERT(after.reads - before.reads <= handle->last_block_id);
+
+    /* A scan that ends early leaves the advice to one still running */
+    HP_Scan *other;
+    count = 0;
+    TEST_ASSERT((scan = HP_Scan_Open(handle, ID, NULL)) != NULL);
+    TEST_ASSERT((other = HP_Scan_Open(handle, ID, NULL)) != NULL);
+    TEST_ASSERT(HP_Scan_Next(other, &rec) > 0);
+    TEST_ASSERT(HP_Scan_Close(other) == 0);
+    while (HP_Scan_Next(scan, &rec) > 0)
+        TEST_ASSERT(compare_records(rec, &recs[count++]));
+    TEST_ASSERT(HP_Scan_Close(scan) == 0);
+    TEST_ASSERT(count == RECORDS_NUM);
+    TEST_ASSERT(BF_AdviseSequential(handle->file_desc, false) == BF_OK);
+
+    char *city = recs[RECORDS_NUM / 2].city;
+    int matches = 0;
+    for (int i = 0; i < RECORDS_NUM; ++i)
+        matches += !strcmp(recs[i].city, city);
+    TEST_ASSERT(GET_NUM_ENTRIES(HP_GetAllEntries(handle, CITY, city, TMP_LIST)) == matches);
+
+    free(recs);
+    TEST_ASSERT(HP_CloseFile(handle) == 0);
+    TEST_ASSERT(remove(FILENAME) == 0);
+    TEST_ASSERT(BF_Close() == BF_OK);
+}
+
+
 TEST_LIST = {
     { "test_create", test_create },
     { "test_insert", test_insert },
     { "test_delete", test_delete },
     { "test_find",   test_find   },
+    { "test_bulk_load", test_bulk_load },
+    { "test_free_map", test_free_map },
+    { "test_key_index", test_key_index },
+    { "test_scan", test_scan },
+    { "test_for_each", test_for_each },
+    { "test_match", test_match },
+    { "test_pax", test_pax },
+    { "test_bloom", test_bloom },
+    { "test_block_size", test_block_size },
+    { "test_buffer_pool", test_buffer_pool },
+    { "test_mapped", test_mapped },
+    { "test_prefetch", test_prefetch },
 
     { NULL, NULL }
 };
@@ -10,6 +10,7 @@
 
 #define FILENAME "data.db"
 #define INDEXNAME "data1.db"
+#define INDEXNAME2 "data2.db"
 
 
 #define UNIQUE_REC(i) ({                                        \
@@ -221,10 +222,10 @@ void test_insert()
         while (block_t != -1) {
             TEST_ASSERT(BF_GetBlock(shandle->file_desc, block_t, block) == BF_OK);
             char *data = BF_Block_GetData(block);
-            memcpy(&block_handle, data, sizeof(Hash_block));
+            memcpy(&block_handle, data, sizeof(SHash_block));
 
             rec_count += block_handle.rec_num;
-            data += sizeof(SRecord) * (block_handle.rec_num - 1) + sizeof(SHash_block);
+            data = SHT_RECORDS(shandle, data) + sizeof(SRecord) * (block_handle.rec_num - 1);
             for (size_t j = block_handle.rec_num; j > 0; j--, data -= sizeof(SRecord)) {
                 SRecord rec;
                 memcpy(&rec, data, sizeof(SRecord));
@@ -317,7 +318,7 @@ void test_delete()
             memcpy(&block_handle, data, sizeof(SHash_block));
             rec_count += block_handle.rec_num;
 			
-            data += sizeof(SRecord) * (block_handle.rec_num - 1) + sizeof(SHash_block);
+            data = SHT_RECORDS(shandle, data) + sizeof(SRecord) * (block_handle.rec_num - 1);
             for (int j = block_handle.rec_num; j > 0; j--, data -= sizeof(SRecord)) {
                 SRecord rec;
                 memcpy(&rec, data, sizeof(SRecord));
@@ -372,7 +373,300 @@ void test_delete()
 		);
 	}
 
+	/* Batches fold the copies of a pair and drop it once its counter reaches zero */
+	int ids[] = { block_id, block_id, block_id };
+	TEST_ASSERT(SHT_InsertBatch(shandle, rec_dupl, size, ids) == 0);
+	TEST_ASSERT(shandle->rec_count == 1);
+
+	ids[0] = -1;
+	TEST_ASSERT(SHT_DeleteBatch(shandle, rec_dupl, size, ids) == 0);
+	TEST_ASSERT(shandle->rec_count == 1);
+	TEST_ASSERT(GET_NUM_ENTRIES(SHT_GetEntries(shandle, rec_dupl[0].city, TMP_LIST)) == size);
+
+	ids[0] = block_id;
+	TEST_ASSERT(SHT_DeleteBatch(shandle, rec_dupl, 1, ids) == 0);
+	TEST_ASSERT(SHT_DeleteBatch(shandle, rec_dupl, 1, ids) == 0);
+	TEST_ASSERT(shandle->rec_count == 0);
+	TEST_ASSERT(GET_NUM_ENTRIES(SHT_GetEntries(shandle, rec_dupl[0].city, TMP_LIST)) == 0);
+
+
+	TEST_ASSERT(SHT_CloseFile(shandle) == 0);
+	TEST_ASSERT(remove(FILENAME) == 0);
+	TEST_ASSERT(remove(INDEXNAME) == 0);
+	TEST_ASSERT(BF_Close() == BF_OK);
+	HT_Close();
+}
+
+
+void test_linear()
+{
+	HT_Init();
+
+	srand(time(NULL) * getpid());
+	TEST_ASSERT(BF_Init(LRU) == BF_OK);
+
+	Hash_file *handle;
+	SHash_file *shandle;
+
+	TEST_ASSERT(HT_CreateFile(FILENAME, ID, BUCKETS) == 0);
+	TEST_ASSERT(SHT_CreateFileEx(INDEXNAME, NAME, FILENAME, 2, EXTENDIBLE_HASH, BF_BLOCK_SIZE) == -1);
+	TEST_ASSERT(SHT_CreateFileEx(INDEXNAME, NAME, FILENAME, 2, LINEAR_HASH, BF_BLOCK_SIZE) == 0);
+	TEST_ASSERT((handle = HT_OpenFile(FILENAME)) != NULL);
+	TEST_ASSERT((shandle = SHT_OpenFile(INDEXNAME)) != NULL);
+	TEST_ASSERT(shandle->mode == LINEAR_HASH);
+
+	int block_id;
+	Record rec;
+	for (int i = 0; i < RECORDS_NUM; ++i) {
+		rec = UNIQUE_REC(i);
+		TEST_ASSERT(INSERTED(handle, HT_InsertEntry(handle, rec, &block_id)));
+		TEST_ASSERT(INSERTED(shandle, SHT_InsertEntry(shandle, rec, block_id)));
+		TEST_ASSERT(shandle->buckets == (shandle->init_buckets << shandle->level) + shandle->next);
+	}
+	TEST_ASSERT(shandle->buckets > 2);
+	TEST_ASSERT(SHT_CloseFile(shandle) == 0);
+
+	int *to_delete = random_numbers(TO_DELETE, 0, RECORDS_NUM - 1);
+	for (int i = 0; i < TO_DELETE; ++i)
+		TEST_ASSERT(DELETED(handle, HT_DeleteEntry(handle, &to_delete[i])));
 
+	TEST_ASSERT((shandle = SHT_OpenFile(INDEXNAME)) != NULL);
+	TEST_ASSERT(shandle->rec_count == RECORDS_NUM - TO_DELETE);
+	TEST_ASSERT(shandle->bloom_block > 0);
+
+	int round = shandle->init_buckets << shandle->level;
+	int block_t, rec_count = 0;
+	BF_Block *block;
+	BF_Block_Init(&block);
+	for (int i = 0; i < shandle->buckets; ++i) {
+		block_t = shandle->hash_table[i];
+		while (block_t != -1) {
+			SHash_block block_handle;
+			TEST_ASSERT(BF_GetBlock(shandle->file_desc, block_t, block) == BF_OK);
+			char *data = BF_Block_GetData(block);
+			memcpy(&block_handle, data, sizeof(SHash_block));
+			data = SHT_RECORDS(shandle, data);
+			for (int j = 0; j < block_handle.rec_num; j++, data += sizeof(SRecord)) {
+				SRecord srec;
+				memcpy(&srec, data, sizeof(SRecord));
+				size_t hash = hash_key(STRING, srec.key.skey);
+				TEST_ASSERT(i == (hash % round < shandle->next ? hash % (2 * round) : hash % round));
+			}
+			rec_count += block_handle.rec_num;
+			block_t = block_handle.overf_block;
+			TEST_ASSERT(BF_UnpinBlock(block) == BF_OK);
+		}
+	}
+	BF_Block_Destroy(&block);
+	TEST_ASSERT(rec_count == shandle->rec_count);
+
+	for (int i = 0; i < RECORDS_NUM; ++i) {
+		bool deleted = false;
+		for (int j = 0; j < TO_DELETE; ++j)
+			deleted |= to_delete[j] == i;
+
+		rec = UNIQUE_REC(i);
+		TEST_ASSERT(GET_NUM_ENTRIES(SHT_GetEntries(shandle, rec.name, TMP_LIST)) == !deleted);
+
+		rec = UNIQUE_REC(RECORDS_NUM + i);
+		TEST_ASSERT(GET_NUM_ENTRIES(SHT_GetEntries(shandle, rec.name, TMP_LIST)) == 0);
+	}
+	free(to_delete);
+
+	TEST_ASSERT(HT_CloseFile(handle) == 0);
+	TEST_ASSERT(SHT_CloseFile(shandle) == 0);
+	TEST_ASSERT(remove(FILENAME) == 0);
+	TEST_ASSERT(remove(INDEXNAME) == 0);
+	TEST_ASSERT(BF_Close() == BF_OK);
+	HT_Close();
+}
+
+
+void test_build()
+{
+	HT_Init();
+
+	srand(time(NULL) * getpid());
+	TEST_ASSERT(BF_Init(LRU) == BF_OK);
+
+	Hash_file *handle;
+	SHash_file *shandle, *shandle_;
+
+	TEST_ASSERT(HT_CreateFile(FILENAME, ID, BUCKETS) == 0);
+	TEST_ASSERT(SHT_CreateFile(INDEXNAME, CITY, FILENAME, BUCKETS) == 0);
+	TEST_ASSERT((handle = HT_OpenFile(FILENAME)) != NULL);
+	TEST_ASSERT((shandle = SHT_OpenFile(INDEXNAME)) != NULL);
+
+	int block_id;
+	for (int i = 0; i < RECORDS_NUM; ++i) {
+		Record rec = random_record();
+		TEST_ASSERT(INSERTED(handle, HT_InsertEntry(handle, rec, &block_id)));
+		TEST_ASSERT(SHT_InsertEntry(shandle, rec, block_id) == 0);
+	}
+
+	TEST_ASSERT(SHT_Build(INDEXNAME2, CITY, FILENAME) == 0);
+	TEST_ASSERT(SHT_Build(INDEXNAME2, CITY, FILENAME) == -1);
+	TEST_ASSERT(strcmp(handle->index_files[CITY - 1].filename, INDEXNAME2) == 0);
+	TEST_ASSERT((shandle_ = SHT_OpenFile(INDEXNAME2)) != NULL);
+	TEST_ASSERT(shandle_->rec_count == shandle->rec_count);
+
+	for (int i = 0; i < 12; ++i) {
+		Record rec = random_record();
+		int count = GET_NUM_ENTRIES(HT_GetAllEntries(handle, CITY, rec.city, TMP_LIST));
+		TEST_ASSERT(GET_NUM_ENTRIES(SHT_GetEntries(shandle, rec.city, TMP_LIST)) == count);
+		TEST_ASSERT(GET_NUM_ENTRIES(SHT_GetEntries(shandle_, rec.city, TMP_LIST)) == count);
+	}
+
+	TEST_ASSERT(HT_CloseFile(handle) == 0);
+	TEST_ASSERT(SHT_CloseFile(shandle) == 0);
+	TEST_ASSERT(SHT_CloseFile(shandle_) == 0);
+	TEST_ASSERT(remove(FILENAME) == 0);
+	TEST_ASSERT(remove(INDEXNAME) == 0);
+	TEST_ASSERT(remove(INDEXNAME2) == 0);
+	TEST_ASSERT(BF_Close() == BF_OK);
+	HT_Close();
+}
+
+
+void test_scan_order()
+{
+	HT_Init();
+
+	srand(time(NULL) * getpid());
+	TEST_ASSERT(BF_Init(LRU) == BF_OK);
+
+	Hash_file *handle;
+	SHash_file *shandle;
+
+	TEST_ASSERT(HT_CreateFile(FILENAME, ID, BUCKETS) == 0);
+	TEST_ASSERT(SHT_CreateFile(INDEXNAME, CITY, FILENAME, BUCKETS) == 0);
+	TEST_ASSERT((handle = HT_OpenFile(FILENAME)) != NULL);
+	TEST_ASSERT((shandle = SHT_OpenFile(INDEXNAME)) != NULL);
+
+	int block_id;
+	for (int i = 0; i < RECORDS_NUM; ++i) {
+		Record rec = random_record();
+		TEST_ASSERT(INSERTED(handle, HT_InsertEntry(handle, rec, &block_id)));
+		TEST_ASSERT(SHT_InsertEntry(shandle, rec, block_id) == 0);
+	}
+
+	/* Each primary block of a value is visited once, in ascending order */
+	for (int i = 0; i < 12; ++i) {
+		Record *rec, tmp = random_record();
+		SHT_Scan *scan;
+		int count = 0, last_block = -1;
+		TEST_ASSERT((scan = SHT_Scan_Open(shandle, tmp.city)) != NULL);
+		while (SHT_Scan_Next(scan, &rec) > 0) {
+			TEST_ASSERT(strcmp(rec->city, tmp.city) == 0);
+			TEST_ASSERT(scan->block_id >= last_block);
+			last_block = scan->block_id;
+			count++;
+		}
+		TEST_ASSERT(SHT_Scan_Close(scan) == 0);
+		TEST_ASSERT(GET_NUM_ENTRIES(HT_GetAllEntries(handle, CITY, tmp.city, TMP_LIST)) == count);
+	}
+
+	TEST_ASSERT(HT_CloseFile(handle) == 0);
+	TEST_ASSERT(SHT_CloseFile(shandle) == 0);
+	TEST_ASSERT(remove(FILENAME) == 0);
+	TEST_ASSERT(remove(INDEXNAME) == 0);
+	TEST_ASSERT(BF_Close() == BF_OK);
+	HT_Close();
+}
+
+
+#define THREADS 4
+
+typedef struct {
+	Hash_file *handle;
+	SHash_file *shandle;
+	Record *recs;
+	int first;
+	int errors;
+} Worker;
+
+static int other_city(Record *rec, void *city) 
+{
+	return strcmp(rec->city, city) != 0;
+}
+
+/* Writers insert their own share of the records into both files 
+ * and then delete a tenth of it, which also deletes it from the index */
+static void *index_records(void *arg) 
+{
+	Worker *worker = arg;
+	int block_id, share = RECORDS_NUM / THREADS;
+
+	for (int i = worker->first; i < worker->first + share; i++)
+		if (HT_InsertEntry(worker->handle, worker->recs[i], &block_id) < 0
+		 || SHT_InsertEntry(worker->shandle, worker->recs[i], block_id) < 0)
+			worker->errors++;
+
+	for (int i = worker->first; i < worker->first + share; i += 10)
+		if (HT_DeleteEntry(worker->handle, &worker->recs[i].id) < 0)
+			worker->errors++;
+	return NULL;
+}
+
+/* Readers look up the cities of the records meanwhile, 
+ * and every record they are handed must be in that city */
+static void *scan_records(void *arg) 
+{
+	Worker *worker = arg;
+	int share = RECORDS_NUM / THREADS;
+
+	for (int i = worker->first; i < worker->first + share; i++)
+		if (SHT_ForEach(worker->shandle, worker->recs[i].city, other_city, 
+		                                 worker->recs[i].city) != 0)
+			worker->errors++;
+	return NULL;
+}
+
+void test_threads()
+{
+	HT_Init();
+
+	srand(time(NULL) * getpid());
+	TEST_ASSERT(BF_Init(LRU) == BF_OK);
+
+	Hash_file *handle;
+	SHash_file *shandle;
+
+	TEST_ASSERT(HT_CreateFile(FILENAME, ID, BUCKETS) == 0);
+	TEST_ASSERT(SHT_CreateFileEx(INDEXNAME, CITY, FILENAME, 2, LINEAR_HASH, BF_BLOCK_SIZE) == 0);
+	TEST_ASSERT((handle = HT_OpenFile(FILENAME)) != NULL);
+	TEST_ASSERT((shandle = SHT_OpenFile(INDEXNAME)) != NULL);
+
+	Record *recs = malloc(RECORDS_NUM * sizeof(Record));
+	for (int i = 0; i < RECORDS_NUM; i++) {
+		recs[i] = random_record();
+		recs[i].id = i;
+	}
+
+	pthread_t threads[2 * THREADS];
+	Worker workers[2 * THREADS];
+	for (int t = 0; t < 2 * THREADS; t++) {
+		workers[t] = (Worker) { 
+			.handle = handle, 
+			.shandle = shandle, 
+			.recs = recs, 
+			.first = t % THREADS * RECORDS_NUM / THREADS 
+		};
+		TEST_ASSERT(pthread_create(&threads[t], NULL, t < THREADS ? index_records : scan_records, 
+		                                              &workers[t]) == 0);
+	}
+	for (int t = 0; t < 2 * THREADS; t++) {
+		TEST_ASSERT(pthread_join(threads[t], NULL) == 0);
+		TEST_ASSERT(workers[t].errors == 0);
+	}
+
+	for (int i = 0; i < RECORDS_NUM; i += RECORDS_NUM / 12) {
+		int count = GET_NUM_ENTRIES(HT_GetAllEntries(handle, CITY, recs[i].city, TMP_LIST));
+		TEST_ASSERT(GET_NUM_ENTRIES(SHT_GetEntries(shandle, recs[i].city, TMP_LIST)) == count);
+	}
+	free(recs);
+
+	TEST_ASSERT(HT_CloseFile(handle) == 0);
 	TEST_ASSERT(SHT_CloseFile(shandle) == 0);
 	TEST_ASSERT(remove(FILENAME) == 0);
 	TEST_ASSERT(remove(INDEXNAME) == 0);
@@ -385,5 +679,9 @@ TEST_LIST = {
     { "test_create", test_create },
 	{ "test_insert", test_insert},
 	{ "test_delete", test_delete },
+	{ "test_linear", test_linear },
+	{ "test_build", test_build },
+	{ "test_scan_order", test_scan_order },
+	{ "test_threads", test_threads },
     { NULL, NULL }
 };